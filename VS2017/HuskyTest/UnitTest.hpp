@@ -1,11 +1,25 @@
 #include <sstream>
 #include <iostream>
 #include <iomanip>
+#include <array>
+#include <glad/glad.h>
 #include <husky/Log.hpp>
 #include <husky/geo/CoordSys.hpp>
+#include <husky/image/BlockCompression.hpp>
 #include <husky/math/Math.hpp>
 #include <husky/math/EulerAngles.hpp>
+#include <husky/mesh/Animation.hpp>
+#include <husky/mesh/Mesh.hpp>
+#include <husky/mesh/MeshSkinner.hpp>
+#include <husky/render/CullingPass.hpp>
+#include <husky/render/DepthPyramid.hpp>
+#include <husky/render/OcclusionCuller.hpp>
+#include <husky/render/RenderData.hpp>
+#include <husky/render/RenderQueue.hpp>
+#include <husky/render/RenderState.hpp>
+#include <husky/render/SharedMeshBuffer.hpp>
 #include <husky/util/StringUtil.hpp>
+#include <husky/util/ThreadPool.hpp>
 #include <glm/mat4x4.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
@@ -53,6 +67,59 @@ static double quatDiff(const husky::Quaterniond &a, const glm::dquat &g)
   return diffSumSq;
 }
 
+static void decodeBC1(const std::uint8_t *block, std::uint8_t *rgba) // Reference decoder for the BlockEncoder tests
+{
+  std::array<std::array<int, 3>, 4> palette;
+  const int c[2] = { block[0] | (block[1] << 8), block[2] | (block[3] << 8) };
+  for (int i = 0; i < 2; i++) {
+    const int r = (c[i] >> 11) & 31, g = (c[i] >> 5) & 63, b = c[i] & 31;
+    palette[i] = { (r << 3) | (r >> 2), (g << 2) | (g >> 4), (b << 3) | (b >> 2) };
+  }
+  for (int ch = 0; ch < 3; ch++) {
+    palette[2][ch] = (c[0] > c[1] ? (2 * palette[0][ch] + palette[1][ch]) / 3 : (palette[0][ch] + palette[1][ch]) / 2);
+    palette[3][ch] = (c[0] > c[1] ? (palette[0][ch] + 2 * palette[1][ch]) / 3 : 0);
+  }
+  for (int i = 0; i < 16; i++) {
+    const int index = (block[4 + i / 4] >> (2 * (i % 4))) & 3;
+    for (int ch = 0; ch < 3; ch++) {
+      rgba[i * 4 + ch] = (std::uint8_t)palette[index][ch];
+    }
+    rgba[i * 4 + 3] = 255;
+  }
+}
+
+static void decodeBC7Mode6(const std::uint8_t *block, std::uint8_t *rgba) // Reference decoder for the BlockEncoder tests
+{
+  int bitPos = 0;
+  auto readBits = [&](int numBits) {
+    int value = 0;
+    for (int i = 0; i < numBits; i++, bitPos++) {
+      value |= ((block[bitPos / 8] >> (bitPos % 8)) & 1) << i;
+    }
+    return value;
+  };
+  const int modeBits = readBits(7);
+  assert(modeBits == 0x40); // Mode 6
+  int endpoints[2][4];
+  for (int ch = 0; ch < 4; ch++) {
+    endpoints[0][ch] = readBits(7) << 1;
+    endpoints[1][ch] = readBits(7) << 1;
+  }
+  for (int e = 0; e < 2; e++) {
+    const int pBit = readBits(1);
+    for (int ch = 0; ch < 4; ch++) {
+      endpoints[e][ch] |= pBit;
+    }
+  }
+  static const int weights[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+  for (int i = 0; i < 16; i++) {
+    const int weight = weights[readBits(i == 0 ? 3 : 4)]; // The anchor index drops its most significant bit
+    for (int ch = 0; ch < 4; ch++) {
+      rgba[i * 4 + ch] = (std::uint8_t)(((64 - weight) * endpoints[0][ch] + weight * endpoints[1][ch] + 32) >> 6);
+    }
+  }
+}
+
 static void runUnitTests() // TODO: Remove GLM; use explicit expected matrices
 {
   husky::Matrix44d lookAtInv;
@@ -198,6 +265,173 @@ static void runUnitTests() // TODO: Remove GLM; use explicit expected matrices
   assert(husky::StringUtil::endsWith("bcd", "bcd"));
   assert(husky::StringUtil::endsWith("bcd", "abcd") == false);
 
+  husky::Animation anim("Test", 100.0, 25.0);
+  husky::AnimationChannel animChannel("Node");
+  for (int iKey = 0; iKey <= 100; iKey++) {
+    animChannel.keyframePosition[iKey] = { std::sin(iKey * 0.1), 2.0, iKey * 0.01 };
+    animChannel.keyframeRotation[iKey] = husky::Quaterniond::fromAxisAngle(iKey * 0.05, husky::Vector3d(1, 2, 3).normalized());
+    animChannel.keyframeScale[iKey] = husky::Vector3d(1.0);
+  }
+  anim.channels.emplace(animChannel.nodeName, animChannel);
+  husky::Animation animCompressed = anim;
+  animCompressed.compressionSettings = husky::AnimationCompressionSettings(1e-3, 1e-3, 1e-3);
+  animCompressed.compress();
+  assert(animCompressed.isCompressed());
+  assert(animCompressed.compressedChannels.at("Node").scale.constant);
+  assert(animCompressed.getKeyframeByteCount() < anim.getKeyframeByteCount() / 4);
+  for (double ticks = -1.0; ticks < 101.0; ticks += 0.3) {
+    husky::Matrix44d mtxAnim, mtxAnimCompressed;
+    assert(anim.getAnimatedNodeTransform("Node", ticks, mtxAnim));
+    assert(animCompressed.getAnimatedNodeTransform("Node", ticks, mtxAnimCompressed));
+    double animCompressedDiff = matDiff(mtxAnimCompressed, glm::make_mat4(mtxAnim.m));
+    assert(animCompressedDiff < 1e-5);
+  }
+  husky::Animation animBudget("Budget", 100.0, 25.0); // Quantization counts against the default error budget
+  husky::AnimationChannel budgetChannel("Node");
+  for (int iKey = 0; iKey <= 100; iKey++) {
+    budgetChannel.keyframePosition[iKey] = { 3.0 * std::sin(iKey * 0.02), 2.0, iKey * 0.02 };
+    budgetChannel.keyframeRotation[iKey] = husky::Quaterniond::fromAxisAngle(std::sin(iKey * 0.02), husky::Vector3d(1, 2, 3).normalized());
+  }
+  animBudget.channels.emplace(budgetChannel.nodeName, budgetChannel);
+  animBudget.compress();
+  const husky::CompressedAnimationChannel &budgetCompressed = animBudget.compressedChannels.at("Node");
+  for (const auto &keyframe : budgetChannel.keyframeRotation) {
+    const husky::Quaterniond q = budgetCompressed.rotation.sample(keyframe.first);
+    assert(2.0 * std::acos(std::min(std::abs(q.dot(keyframe.second)), 1.0)) <= 1e-4);
+    assert((budgetCompressed.position.sample(keyframe.first, {}) - budgetChannel.keyframePosition[keyframe.first]).length() <= 1e-4);
+  }
+  assert(anim.getSegmentBounds(0.0) == nullptr);
+  anim.segmentDurationTicks = 25.0;
+  anim.segmentBounds.assign(4, husky::Box({ 0, 0, 0 }, { 1, 1, 1 }));
+  assert(anim.getSegmentBounds(0.0) == &anim.segmentBounds[0]);
+  assert(anim.getSegmentBounds(60.0) == &anim.segmentBounds[2]);
+  assert(anim.getSegmentBounds(100.0) == &anim.segmentBounds[3]);
+
+  husky::Mesh skinMesh; // 7 vertices => a partial group of four
+  const std::vector<husky::Matrix44f> skinBones = {
+    husky::Matrix44f::identity(),
+    husky::Matrix44f::translate({ 1, 2, 3 }) * husky::Matrix44f::rotate(0.7f, { 0, 0, 1 }),
+    husky::Matrix44f::rotate(-1.2f, husky::Vector3f(1, 1, 0).normalized()) * husky::Matrix44f::scale({ 1.5f, 1.5f, 1.5f }),
+  };
+  for (int iVert = 0; iVert < 7; iVert++) {
+    skinMesh.addVert(husky::Vector3d(iVert, iVert * 0.5 - 1.0, 2.0 - iVert * 0.25), husky::Vector3d(0, 0.6, 0.8), husky::Vector2d(0, 0));
+    std::vector<husky::BoneWeight> weights;
+    for (int k = 0; k <= iVert % 4; k++) {
+      weights.emplace_back((iVert + k) % 3, 0.2 + 0.3 * k); // One to four influences; sums are not normalized
+    }
+    skinMesh.setBoneWeights(iVert, weights);
+  }
+  const husky::MeshSkinner skinner(skinMesh);
+  husky::SkinnedVertices skinned;
+  assert(skinner.skin(skinBones, skinned, &husky::ThreadPool::global()));
+  for (int iVert = 0; iVert < 7; iVert++) { // Scalar reference
+    double weightSum = 0.0;
+    for (const husky::BoneWeight &weight : skinMesh.getBoneWeights(iVert)) {
+      weightSum += weight.weight;
+    }
+    husky::Vector4d pos(0, 0, 0, 0), nor(0, 0, 0, 0);
+    for (const husky::BoneWeight &weight : skinMesh.getBoneWeights(iVert)) {
+      const husky::Matrix44d mtxBone = (husky::Matrix44d)skinBones[weight.boneIndex];
+      pos += (mtxBone * husky::Vector4d(skinMesh.getPosition(iVert), 1.0)) * (weight.weight / weightSum);
+      nor += (mtxBone * husky::Vector4d(skinMesh.getNormal(iVert), 0.0)) * (weight.weight / weightSum);
+    }
+    assert((skinned.getPosition(iVert) - pos.xyz).length() < 1e-4);
+    assert((skinned.getNormal(iVert) - nor.xyz.normalized()).length() < 1e-4);
+  }
+
+  husky::IndexData indexData(husky::PrimitiveType::TRIANGLES);
+  for (int iTri = 0; iTri < 50000; iTri++) {
+    indexData.addTriangle(iTri * 2, iTri * 2 + 1, iTri * 2 + 300);
+  }
+  std::vector<std::uint16_t> chunkIndices;
+  const std::vector<husky::IndexChunk> indexChunks = indexData.buildChunks(chunkIndices);
+  assert(indexChunks.size() > 1);
+  assert((int)chunkIndices.size() == indexData.getIndexCount());
+  for (const husky::IndexChunk &chunk : indexChunks) {
+    assert(chunk.indexCount % 3 == 0);
+    for (int i = chunk.firstIndex; i < chunk.firstIndex + chunk.indexCount; i++) {
+      assert(chunkIndices[i] + chunk.baseVertex == (int)indexData.indices32[i]);
+    }
+  }
+
+  assert(husky::RenderQueue::makeSortKey(husky::RenderPass::SOLID, 1, 1, 1, 10.f) < husky::RenderQueue::makeSortKey(husky::RenderPass::SOLID, 1, 1, 1, 20.f)); // Front-to-back
+  assert(husky::RenderQueue::makeSortKey(husky::RenderPass::SOLID, 1, 1, 1, 20.f) < husky::RenderQueue::makeSortKey(husky::RenderPass::SOLID, 2, 1, 1, 10.f)); // State before depth
+  assert(husky::RenderQueue::makeSortKey(husky::RenderPass::TRANSLUCENT, 1, 1, 1, 20.f) < husky::RenderQueue::makeSortKey(husky::RenderPass::TRANSLUCENT, 1, 1, 1, 10.f)); // Back-to-front
+  assert(husky::RenderQueue::makeSortKey(husky::RenderPass::SOLID, 4095, 4095, 16383, 1e9f) < husky::RenderQueue::makeSortKey(husky::RenderPass::TRANSLUCENT, 0, 0, 0, 1e9f));
+
+  husky::SharedMeshBuffers sharedMeshBuffers;
+  husky::RenderData boxData = husky::Mesh::box(1.0, 1.0, 1.0).getRenderData(false);
+  husky::RenderData sphereData = husky::Mesh::sphere(1.0).getRenderData(false);
+  husky::SharedMeshBuffer *sharedBox = sharedMeshBuffers.add(boxData);
+  husky::SharedMeshBuffer *sharedSphere = sharedMeshBuffers.add(sphereData);
+  assert(sharedBox != nullptr && sharedSphere == sharedBox); // Same vertex layout
+  assert(sharedBox->vertCount == boxData._vertData.vertCount + sphereData._vertData.vertCount);
+  assert(sharedBox->indexCount == boxData._indexData.getIndexCount() + sphereData._indexData.getIndexCount());
+
+  husky::OcclusionCuller occlusionCuller(64, 32);
+  const husky::Mesh occluderMesh = husky::Mesh::box(10.0, 10.0, 1.0);
+  const husky::Box smallBox({ -0.5, -0.5, -0.5 }, { 0.5, 0.5, 0.5 });
+  occlusionCuller.beginFrame(husky::Matrix44d::perspective(husky::Math::pi2, 2.0, 0.1, 100.0)); // Camera looks along -z
+  occlusionCuller.addOccluder(occluderMesh, husky::Matrix44d::translate({ 0, 0, -5 }));
+  occlusionCuller.rasterize(husky::ThreadPool::global());
+  assert(occlusionCuller.numOccluderTriangles == 12);
+  assert(!occlusionCuller.isVisible(smallBox, husky::Matrix44d::translate({ 0, 0, -10 }))); // Behind
+  assert(occlusionCuller.isVisible(smallBox, husky::Matrix44d::translate({ 0, 0, -2 }))); // In front
+  assert(occlusionCuller.isVisible(smallBox, husky::Matrix44d::translate({ 15, 0, -10 }))); // Beside
+
+  husky::Image bcImage(6, 5, husky::ImageFormat::RGBA8);
+  for (int i = 0; i < 6 * 5; i++) {
+    bcImage.setPixel(i % 6, i / 6, std::array<std::uint8_t, 4>{ 200, 100, 50, 255 });
+  }
+  const husky::CompressedImage bc1Image = husky::CompressedImage::compress(bcImage, husky::BlockFormat::BC1, true, husky::ThreadPool::global());
+  const husky::CompressedImage bc7Image = husky::CompressedImage::compress(bcImage, husky::BlockFormat::BC7, false, husky::ThreadPool::global());
+  assert(bc1Image.levels.size() == 3); // 6x5, 3x2, 1x1
+  assert(bc1Image.levels[0].size() == 2 * 2 * 8 && bc1Image.levels[2].size() == 8);
+  assert(bc7Image.levels.size() == 1 && bc7Image.numBytesTotal() == 2 * 2 * 16);
+  std::uint8_t uniformTexels[64], bcBlock[8];
+  for (int i = 0; i < 16; i++) { // One packed 4x4 block in the color of bcImage
+    uniformTexels[i * 4] = 200;
+    uniformTexels[i * 4 + 1] = 100;
+    uniformTexels[i * 4 + 2] = 50;
+    uniformTexels[i * 4 + 3] = 255;
+  }
+  husky::BlockEncoder::encodeBC4(uniformTexels, 0, bcBlock); // Red
+  assert(bcBlock[0] == 200 && bcBlock[1] == 200);
+  husky::BlockEncoder::encodeBC4(uniformTexels, 1, bcBlock); // Green
+  assert(bcBlock[0] == 100 && bcBlock[1] == 100);
+  std::uint8_t gradient[64], decoded[64], bc7Block[16];
+  for (int i = 0; i < 16; i++) { // Linear along the texel order; green and alpha run the other way
+    gradient[i * 4] = (std::uint8_t)(10 + i * 15);
+    gradient[i * 4 + 1] = (std::uint8_t)(200 - i * 12);
+    gradient[i * 4 + 2] = (std::uint8_t)(50 + i * 8);
+    gradient[i * 4 + 3] = (std::uint8_t)(255 - i * 10);
+  }
+  husky::BlockEncoder::encodeBC1(gradient, bcBlock);
+  decodeBC1(bcBlock, decoded);
+  int bc1MaxError = 0;
+  for (int i = 0; i < 64; i++) {
+    bc1MaxError = std::max(bc1MaxError, (i % 4 == 3 ? 0 : std::abs(decoded[i] - gradient[i])));
+  }
+  assert(bc1MaxError <= 40); // 16 shades from 4 palette entries
+  husky::BlockEncoder::encodeBC7(gradient, bc7Block);
+  decodeBC7Mode6(bc7Block, decoded);
+  int bc7MaxError = 0;
+  for (int i = 0; i < 64; i++) {
+    bc7MaxError = std::max(bc7MaxError, std::abs(decoded[i] - gradient[i]));
+  }
+  assert(bc7MaxError <= 4);
+  const husky::Image halfImage = bcImage.downsample();
+  assert(halfImage.width == 3 && halfImage.height == 2 && halfImage.data()[0] == 200 && halfImage.data()[3] == 255);
+  const std::vector<husky::Image> bcMipmaps = bcImage.generateMipmaps(husky::ResampleFilter::KAISER, true, husky::ThreadPool::global());
+  assert(bcMipmaps.size() == 2 && bcMipmaps[0].width == 3 && bcMipmaps[1].height == 1 && bcMipmaps[1].data()[0] == 200);
+  husky::Image checkerImage(2, 1, husky::ImageFormat::RGBA8);
+  checkerImage.setPixel(0, 0, std::array<std::uint8_t, 4>{ 0, 0, 0, 255 });
+  checkerImage.setPixel(1, 0, std::array<std::uint8_t, 4>{ 255, 255, 255, 128 });
+  assert(checkerImage.resize(1, 1, husky::ResampleFilter::BOX, true, husky::ThreadPool::global()).data()[0] == 188); // Linear 0.5
+  assert(checkerImage.resize(1, 1, husky::ResampleFilter::BOX, false, husky::ThreadPool::global()).data()[0] == 128);
+  checkerImage.premultiplyAlpha(false, husky::ThreadPool::global());
+  assert(checkerImage.data()[4] == 128 && checkerImage.data()[7] == 128);
+
   husky::CoordSys csUtm33N(32633);
   husky::CoordSys csWgs(4326);
   husky::CoordSys csWgsWkt(
@@ -222,3 +456,62 @@ R"(GEOGCS["WGS 84",
   assert(ct2.convert(pt2));
   assert((pt1 - pt2).length2() < 1e-9);
 }
+
+static void runGpuUnitTests() // Needs a current OpenGL 4.5 context
+{
+  // Hi-Z from a wall at z = -10 with a hole in one corner texel
+  const husky::Matrix44f projection = husky::Matrix44f::perspective(1.0f, 1.0f, 0.1f, 100.0f);
+  const husky::Vector4f wallClip = projection * husky::Vector4f(0.0f, 0.0f, -10.0f, 1.0f);
+  const float wallDepth = wallClip.z / wallClip.w * 0.5f + 0.5f;
+  std::vector<float> depths(8 * 8, wallDepth);
+  depths.back() = 1.0f;
+  unsigned int depthTexture;
+  glCreateTextures(GL_TEXTURE_2D, 1, &depthTexture);
+  glTextureStorage2D(depthTexture, 1, GL_DEPTH_COMPONENT32F, 8, 8);
+  glTextureSubImage2D(depthTexture, 0, 0, 0, 8, 8, GL_DEPTH_COMPONENT, GL_FLOAT, depths.data());
+
+  husky::DepthPyramid pyramid;
+  pyramid.build(depthTexture, 8, 8, projection, false);
+  assert(pyramid.width == 4 && pyramid.height == 4 && pyramid.levelCount == 3);
+  std::vector<float> level0(4 * 4);
+  glGetTextureImage(pyramid.texture, 0, GL_RED, GL_FLOAT, (GLsizei)(level0.size() * sizeof(float)), level0.data());
+  assert(level0[0] == wallDepth);
+  assert(level0[15] == 1.0f);
+  float level2 = 0.0f;
+  glGetTextureImage(pyramid.texture, 2, GL_RED, GL_FLOAT, sizeof(level2), &level2);
+  assert(level2 == 1.0f);
+
+  // One command per draw: in front of the wall, outside the frustum, behind the wall
+  const husky::Matrix44f modelViews[] = { husky::Matrix44f::translate({ 0.0f, 0.0f, -5.0f }), husky::Matrix44f::translate({ 0.0f, 50.0f, -5.0f }), husky::Matrix44f::translate({ 0.0f, 0.0f, -20.0f }) };
+  std::vector<husky::CullingDraw> cullingDraws(3);
+  for (std::uint32_t iDraw = 0; iDraw < 3; iDraw++) {
+    cullingDraws[iDraw].boundingSphere = husky::Vector4f(0.0f, 0.0f, 0.0f, 0.5f);
+    cullingDraws[iDraw].firstCommand = iDraw;
+    cullingDraws[iDraw].commandCount = 1;
+    cullingDraws[iDraw].drawId = iDraw;
+  }
+  const std::uint32_t commands[3][5] = { { 36, 1, 0, 0, 0 }, { 36, 1, 0, 0, 1 }, { 36, 1, 0, 0, 2 } }; // DrawElementsIndirectCommand
+  unsigned int commandBuffer, drawParamsBuffer;
+  glCreateBuffers(1, &commandBuffer);
+  glNamedBufferData(commandBuffer, sizeof(commands), commands, GL_DYNAMIC_COPY);
+  glCreateBuffers(1, &drawParamsBuffer);
+  glNamedBufferData(drawParamsBuffer, sizeof(modelViews), modelViews, GL_STATIC_DRAW);
+  husky::RenderState::global().bindBufferBase(GL_SHADER_STORAGE_BUFFER, husky::RenderQueue::drawParamsBinding, drawParamsBuffer);
+
+  husky::CullingPass cullingPass;
+  std::uint32_t culled[3][5];
+  cullingPass.cull(commandBuffer, 0, cullingDraws, husky::Matrix44f::identity(), projection);
+  glGetNamedBufferSubData(commandBuffer, 0, sizeof(culled), culled);
+  assert(culled[0][1] == 1 && culled[1][1] == 0 && culled[2][1] == 1);
+  assert(cullingPass.readVisibleCount() == 2);
+
+  cullingPass.depthPyramid = &pyramid;
+  cullingPass.cull(commandBuffer, 0, cullingDraws, husky::Matrix44f::identity(), projection);
+  glGetNamedBufferSubData(commandBuffer, 0, sizeof(culled), culled);
+  assert(culled[0][1] == 1 && culled[1][1] == 0 && culled[2][1] == 0);
+  assert(cullingPass.readVisibleCount() == 1);
+
+  husky::RenderState::global().deleteBuffer(commandBuffer);
+  husky::RenderState::global().deleteBuffer(drawParamsBuffer);
+  glDeleteTextures(1, &depthTexture);
+}
@@ -6,19 +6,36 @@
 #include <vector>
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
+#include <husky/render/Animator.hpp>
+#include <husky/render/BakedAnimation.hpp>
 #include <husky/render/Camera.hpp>
 #include <husky/render/Component.hpp>
+#include <husky/render/CullingPass.hpp>
+#include <husky/render/DepthPyramid.hpp>
 #include <husky/render/Entity.hpp>
+#include <husky/render/ImpostorBaker.hpp>
+#include <husky/render/MaterialTable.hpp>
+#include <husky/render/OcclusionCuller.hpp>
 #include <husky/render/Billboard.hpp>
 #include <husky/geo/Shapefile.hpp>
 #include <husky/image/Image.hpp>
 #include <husky/mesh/Model.hpp>
+#include <husky/mesh/PoseCache.hpp>
 #include <husky/mesh/Triangulator.hpp>
 #include <husky/math/Intersect.hpp>
 #include <husky/math/EulerAngles.hpp>
 #include <husky/math/Random.hpp>
+#include <husky/render/BonePaletteBuffer.hpp>
+#include <husky/render/RenderQueue.hpp>
+#include <husky/render/RenderState.hpp>
+#include <husky/render/RingBuffer.hpp>
+#include <husky/render/ShaderRegistry.hpp>
+#include <husky/render/SharedMeshBuffer.hpp>
+#include <husky/render/SkinningPass.hpp>
 #include <husky/render/Texture.hpp>
+#include <husky/render/TextureStreamer.hpp>
 #include <husky/util/SharedResource.hpp>
+#include <husky/util/ThreadPool.hpp>
 #include "UnitTest.hpp"
 #include "imgui/imgui.h"
 #include "imgui/imgui_impl_glfw.h"
@@ -51,8 +68,22 @@ static double frameTime = (1.0 / 60.0);
 static bool mouseDragRight = false;
 static std::vector<std::unique_ptr<husky::Model>> models;
 static std::vector<std::unique_ptr<husky::Entity>> entities;
+static husky::Animator animator;
+static husky::PoseCache poseCache;
+static husky::RenderQueue renderQueue;
+static husky::RingBuffer ringBuffer; // Transient per-frame GPU data
+static husky::TextureStreamer textureStreamer; // Model textures load progressively
+static husky::MaterialTable materialTable; // Lets the multi-draw entities share draws across materials
+static bool preSkin = true;
+static bool gpuCulling = true;
+static husky::CullingPass cullingPass;
+static husky::DepthPyramid depthPyramid; // Of the previous frame
+static bool cpuOcclusion = true;
+static husky::OcclusionCuller occlusionCuller;
+static int numOccludedEntities = 0;
 static int iSelectedEntity = -1;
 static GLuint fbo = 0;
+static GLuint fboDepth = 0;
 static husky::Viewport fboViewport;
 static ImGuiIO *io = nullptr;
 
@@ -236,6 +267,7 @@ static void updateViewportAndRebuildFbo()
   glBindFramebuffer(GL_FRAMEBUFFER, fbo);
   glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, color, 0);
   glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depth, 0);
+  fboDepth = depth;
 
   GLenum fboStatus = glCheckFramebufferStatus(GL_FRAMEBUFFER);
   if (fboStatus != GL_FRAMEBUFFER_COMPLETE) {
@@ -278,6 +310,9 @@ int main()
   if (glMajor < 4 || (glMajor == 4 && glMinor < 5)) {
     husky::Log::error("OpenGL 4.5 or greater required"); // GL 4.5+ required for glClipControl()
   }
+  else {
+    runGpuUnitTests();
+  }
 
   IMGUI_CHECKVERSION();
   ImGui::CreateContext();
@@ -300,10 +335,25 @@ int main()
 
   updateViewportAndRebuildFbo();
 
+  { // Start all permutations at once, so drivers with parallel compilation can work on them together
+    husky::ShaderRegistry &shaderRegistry = husky::ShaderRegistry::global();
+    shaderRegistry.binaryCacheDirectory = "ShaderCache";
+    shaderRegistry.precompile(husky::Shader::getDefaultShaderSource(true, husky::SkinningMode::NONE));
+    shaderRegistry.precompile(husky::Shader::getDefaultShaderSource(true, husky::SkinningMode::NONE, true, true));
+    shaderRegistry.precompile(husky::Shader::getDefaultShaderSource(true, husky::SkinningMode::BONE_BUFFER));
+    shaderRegistry.precompile(husky::Shader::getDefaultShaderSource(true, husky::SkinningMode::BAKED_TEXTURE));
+    shaderRegistry.precompile(husky::Billboard::getBillboardShaderSource(husky::BillboardMode::SPHERICAL));
+  }
+
   static const husky::Shader defaultShader = husky::Shader::getDefaultShader(true, false);
-  static const husky::Shader defaultShaderBones = husky::Shader::getDefaultShader(true, true);
+  static const husky::Shader defaultShaderMultiDraw = husky::Shader::getDefaultShader(true, husky::SkinningMode::NONE, true, true); // Materials from materialTable
+  static const husky::Shader defaultShaderBones = husky::Shader::getDefaultShader(true, husky::SkinningMode::BONE_BUFFER);
+  static const husky::Shader defaultShaderBakedBones = husky::Shader::getDefaultShader(true, husky::SkinningMode::BAKED_TEXTURE);
   //static const husky::Shader lineShader = husky::Shader::getLineShader();
   static const husky::Shader billboardShader = husky::Billboard::getBillboardShader(husky::BillboardMode::SPHERICAL);
+  static husky::SkinningPass skinningPass;
+  static husky::BonePaletteBuffer bonePalettes;
+  static husky::SharedMeshBuffers sharedMeshBuffers;
 
   husky::Image image(2, 2, husky::ImageFormat::RGBA8);
   image.setPixel(0, 0, husky::Vector4b(255, 255, 255, 255));
@@ -314,43 +364,67 @@ int main()
 
   {
     models.emplace_back(std::make_unique<husky::Model>(husky::Mesh::sphere(1.0), husky::Material({ 0, 1, 0 }, tex)));
-    entities.emplace_back(std::make_unique<husky::Entity>("Sphere", &defaultShader, models.back().get()));
+    models.back()->useSharedBuffers(sharedMeshBuffers);
+    entities.emplace_back(std::make_unique<husky::Entity>("Sphere", &defaultShaderMultiDraw, models.back().get()));
     entities.back()->setTransform(husky::Matrix44d::translate({ 3, 3, 0 }));
   }
 
   {
     models.emplace_back(std::make_unique<husky::Model>(husky::Mesh::cylinder(0.5, 0.3, 2.0, true, false, 8, 1), husky::Material({ 1, 0, 1 }, tex)));
-    entities.emplace_back(std::make_unique<husky::Entity>("Cylinder", &defaultShader, models.back().get()));
+    models.back()->useSharedBuffers(sharedMeshBuffers);
+    entities.emplace_back(std::make_unique<husky::Entity>("Cylinder", &defaultShaderMultiDraw, models.back().get()));
     entities.back()->setTransform(husky::Matrix44d::translate({ 4, -2, 0 }));
   }
 
   {
     models.emplace_back(std::make_unique<husky::Model>(husky::Mesh::cone(0.5, 1.0, true, 8), husky::Material({ 1, 0, 1 }, tex)));
-    entities.emplace_back(std::make_unique<husky::Entity>("Cone", &defaultShader, models.back().get()));
+    models.back()->useSharedBuffers(sharedMeshBuffers);
+    entities.emplace_back(std::make_unique<husky::Entity>("Cone", &defaultShaderMultiDraw, models.back().get()));
     entities.back()->setTransform(husky::Matrix44d::translate({ 4, -2, 2 }));
   }
 
   {
     models.emplace_back(std::make_unique<husky::Model>(husky::Mesh::box(2.0, 3.0, 1.0), husky::Material({ 1, 0, 0 }, tex)));
-    entities.emplace_back(std::make_unique<husky::Entity>("Box", &defaultShader, models.back().get()));
+    models.back()->useSharedBuffers(sharedMeshBuffers);
+    entities.emplace_back(std::make_unique<husky::Entity>("Box", &defaultShaderMultiDraw, models.back().get()));
+    entities.back()->occluder = true;
     entities.back()->setTransform(husky::Matrix44d::translate({ -20, 0, 0 }) * husky::Matrix44d::rotate(husky::Math::pi2, { 0, 0, 1 }));
   }
 
   {
     models.emplace_back(std::make_unique<husky::Model>(husky::Mesh::torus(8.0, 1.0), husky::Material({ 1, 1, 0 }, tex)));
-    entities.emplace_back(std::make_unique<husky::Entity>("Torus", &defaultShader, models.back().get()));
+    models.back()->useSharedBuffers(sharedMeshBuffers);
+    entities.emplace_back(std::make_unique<husky::Entity>("Torus", &defaultShaderMultiDraw, models.back().get()));
+    entities.back()->occluder = true;
     entities.back()->setTransform(husky::Matrix44d::translate({ 0, 0, 0 }));
   }
 
   {
-    models.emplace_back(std::make_unique<husky::Model>(husky::Model::load("C:/Users/chris/Stash/Blender/BoynBot/Bot/Bot.fbx")));
+    models.emplace_back(std::make_unique<husky::Model>(husky::Model::load("C:/Users/chris/Stash/Blender/BoynBot/Bot/Bot.fbx", 0, false, &textureStreamer)));
+    models.back()->compressAnimations({});
     entities.emplace_back(std::make_unique<husky::Entity>("Bot", &defaultShaderBones, models.back().get()));
     entities.back()->setTransform(husky::Matrix44d::compose({ 1, 1, 1 }, husky::Matrix33d::rotate(husky::Math::pi2, { 1, 0, 0 }), { -3, 0, 0 }));
+
+    static husky::BakedAnimation botCrowdAnimation;
+    if (!models.back()->animations.empty()) { // Crowd animated entirely on the GPU
+      botCrowdAnimation = husky::BakedAnimation::bake(*models.back(), 0);
+      husky::Random random;
+      for (int iRow = 0; iRow < 8; iRow++) {
+        for (int iCol = 0; iCol < 8; iCol++) {
+          entities.emplace_back(std::make_unique<husky::Entity>("BotCrowd", &defaultShaderBakedBones, models.back().get()));
+          entities.back()->setTransform(husky::Matrix44d::compose({ 1, 1, 1 }, husky::Matrix33d::rotate(husky::Math::pi2, { 1, 0, 0 }), { -10.0 - 2 * iCol, 5.0 + 2 * iRow, 0 }));
+          entities.back()->modelInstance.setAnimationIndex(0); // For animation bounds
+          entities.back()->modelInstance.bakedAnimation = &botCrowdAnimation;
+          entities.back()->modelInstance.animationTime = random.getDouble(0, botCrowdAnimation.getDuration()); // Phase offset
+        }
+      }
+    }
   }
 
   {
     //husky::Model mdl = husky::Model::load("C:/Users/chris/Stash/Blender/Explora/character.fbx");
-    husky::Model mdl = husky::Model::load("C:/Users/chris/Stash/Blender/BoynBot/Boy/Boy_FBX2013.fbx");
+    husky::Model mdl = husky::Model::load("C:/Users/chris/Stash/Blender/BoynBot/Boy/Boy_FBX2013.fbx", 0, false, &textureStreamer);
+    mdl.compressAnimations({});
     models.emplace_back(std::make_unique<husky::Model>(std::move(mdl)));
     entities.emplace_back(std::make_unique<husky::Entity>("Boy", &defaultShaderBones, models.back().get()));
     entities.back()->modelInstance.mtxTransform = husky::Matrix44d::rotate(husky::Math::pi2, { 1, 0, 0 }) * husky::Matrix44d::translate(-entities.back()->modelInstance.model->bboxLocal.center());
@@ -439,12 +513,16 @@ int main()
 
     models.emplace_back(std::make_unique<husky::Model>(husky::Model(std::move(mesh), husky::Material({ 0.1f, 0.5f, 0.2f }, tex))));
     entities.emplace_back(std::make_unique<husky::Entity>("Countries", &defaultShader, models.back().get()));
+    entities.back()->occluder = true;
     entities.back()->setTransform(husky::Matrix44d::compose({ 1, 1, 1 }, husky::Matrix33d::identity(), { 0, 0, 0 }));
   }
 
   {
     //const husky::Texture texTree("C:/tmp/Billboard/tree.png", husky::TexWrap::REPEAT, husky::TexFilter::LINEAR, husky::TexMipmaps::STANDARD);
-    const husky::MultidirTexture texBillboard = husky::Billboard::getMultidirectionalBillboardTexture(*entities[6].get(), 8192, 8192, 64, 63);
+    husky::ImpostorBaker impostorBaker;
+    impostorBaker.cacheDirectory = "ImpostorCache";
+    const husky::MultidirTexture texBillboard = impostorBaker.bake(*entities[6].get(), 8192, 8192, husky::ImpostorLayout::LON_LAT, 64, 63);
+    husky::Billboard::bindMultidirTexture(billboardShader, texBillboard);
     //texBillboard.tex.downloadImageData().save("C:/tmp/hejhopp.png");
 
     husky::Random random;
@@ -465,6 +543,16 @@ int main()
     //entities.back()->setTransform(husky::Matrix44d::identity());
   }
 
+  sharedMeshBuffers.upload();
+  for (const auto &entity : entities) {
+    if (entity->shader == &defaultShaderMultiDraw) {
+      for (const husky::Material &material : entity->modelInstance.model->materials) {
+        materialTable.add(material);
+      }
+    }
+  }
+  materialTable.build();
+
   cam.lookAt({ 0, 0, 0 }, { 0, 0, 1 });
 
   while (!glfwWindowShouldClose(window)) {
@@ -473,8 +561,12 @@ int main()
     prevTime = time;
     double fps = (frameTime != 0 ? (1.0 / frameTime) : 0.0);
 
-    for (auto &entity : entities) {
-      entity->update(frameTime);
+    {
+      std::vector<husky::Entity*> animEntities;
+      for (auto &entity : entities) {
+        animEntities.emplace_back(entity.get());
+      }
+      animator.update(animEntities, frameTime, cam, viewport);
     }
 
     if (!io->WantCaptureKeyboard) {
@@ -483,6 +575,30 @@ int main()
 
     cam.buildViewMatrix();
 
+    husky::RenderState::global().resetCounters();
+    ringBuffer.beginFrame();
+    textureStreamer.update(); // Levels requested by the previous frame
+
+    { // Skin visible meshes once per frame, or upload their bone palettes; all passes below reuse the result
+      const husky::Frustum frustum = cam.frustum();
+      skinningPass.beginFrame();
+      bonePalettes.beginFrame();
+      bonePalettes.ringBuffer = &ringBuffer;
+      for (const auto &entity : entities) {
+        const husky::Matrix44d mtxTransform = entity->getTransform() * entity->modelInstance.mtxTransform;
+        if ((bool)frustum.touches(entity->modelInstance.getBbox(), &mtxTransform)) {
+          if (preSkin) {
+            skinningPass.skin(entity->modelInstance);
+          }
+          else {
+            bonePalettes.add(entity->modelInstance);
+          }
+        }
+      }
+      skinningPass.execute();
+      bonePalettes.upload();
+    }
+
     std::vector<int> viewEntities;
 
     { // Render scene to FBO
@@ -505,19 +621,52 @@ int main()
         glDisable(GL_DEPTH_CLAMP);
       }
 
-      glEnable(GL_DEPTH_TEST);
+      const husky::Frustum frustum = cam.frustum(); // Depth test and culling are set per draw by RenderState
 
-      const husky::Frustum frustum = cam.frustum();
+      renderQueue.begin(viewport, (husky::Matrix44f)cam.view, (husky::Matrix44f)cam.proj);
+      renderQueue.cullingPass = (gpuCulling ? &cullingPass : nullptr); // Per mesh, and against the previous frame's depth
+      renderQueue.ringBuffer = &ringBuffer;
+      renderQueue.materialTable = &materialTable;
+      cullingPass.depthPyramid = &depthPyramid;
+      cullingPass.ringBuffer = &ringBuffer;
 
+      if (cpuOcclusion) { // Current frame occluders; unlike the depth pyramid, no latency
+        occlusionCuller.beginFrame(cam.proj * cam.view);
+        for (const auto &entity : entities) {
+          if (entity->occluder) {
+            occlusionCuller.addOccluder(*entity->modelInstance.model, entity->getTransform() * entity->modelInstance.mtxTransform);
+          }
+        }
+        occlusionCuller.rasterize(husky::ThreadPool::global());
+      }
+
+      numOccludedEntities = 0;
       for (int iEntity = 0; iEntity < (int)entities.size(); iEntity++) {
         const auto &entity = entities[iEntity];
-        entity->draw(viewport, cam);
-
-        if ((bool)frustum.touches(entity->bboxLocal, &entity->getTransform())) {
+        const husky::Matrix44d mtxTransform = entity->getTransform() * entity->modelInstance.mtxTransform;
+        if ((bool)frustum.touches(entity->modelInstance.getBbox(), &mtxTransform)) { // Cull before anything is queued
+          if (cpuOcclusion && !entity->occluder && !occlusionCuller.isVisible(entity->modelInstance.getBbox(), mtxTransform)) {
+            numOccludedEntities++;
+            continue;
+          }
           viewEntities.emplace_back(iEntity);
+          entity->enqueue(renderQueue, cam);
+          textureStreamer.request(entity->modelInstance, mtxTransform, cam, viewport);
         }
       }
 
+      renderQueue.sort();
+      renderQueue.submit();
+      ringBuffer.endFrame(); // Nothing below reads this frame's region
+
+      if (gpuCulling) { // Occluders for the next frame; debug overlays below are not included
+        depthPyramid.build(fboDepth, fboViewport.width, fboViewport.height, (husky::Matrix44f)(cam.proj * cam.view), cam.isRevZ());
+      }
+
+      for (const auto &entity : entities) {
+        entity->drawComponents(viewport, cam);
+      }
+
       glBindFramebuffer(GL_FRAMEBUFFER, 0);
     }
 
@@ -548,6 +697,31 @@ int main()
       }
 
       ImGui::Text("fps: %d", (int)std::round(fps));
+      ImGui::Text("queued draws: %d (%d batches)", renderQueue.size(), renderQueue.numBatches());
+      ImGui::Text("state changes: %d issued, %d skipped", husky::RenderState::global().numStateChanges, husky::RenderState::global().numSkippedChanges);
+      ImGui::Text("shaders: %d compiled, %d from cache", husky::ShaderRegistry::global().numCompiled, husky::ShaderRegistry::global().numLoaded);
+      ImGui::Text("ring buffer: %d KB per frame, %d stalls", (int)(ringBuffer.frameSize / 1024), ringBuffer.numStalls);
+      ImGui::Text("textures: %d streaming, %d KB uploaded", textureStreamer.numPending, (int)(textureStreamer.numBytesUploaded / 1024));
+      ImGui::Text("material table: %d materials, %d texture arrays", materialTable.size(), materialTable.numTextureArrays());
+      ImGui::Text("animated: %d full, %d reduced, %d off-screen", animator.numFullRate, animator.numReducedRate, animator.numOffscreen);
+      ImGui::Checkbox("GPU culling", &gpuCulling);
+      ImGui::SameLine();
+      ImGui::Text("(%d candidates)", gpuCulling ? cullingPass.numCandidates : 0);
+      ImGui::Checkbox("CPU occlusion", &cpuOcclusion);
+      ImGui::SameLine();
+      ImGui::Text("(%d occluded, %d triangles)", cpuOcclusion ? numOccludedEntities : 0, cpuOcclusion ? occlusionCuller.numOccluderTriangles : 0);
+      ImGui::Checkbox("Pre-skin", &preSkin);
+      ImGui::SameLine();
+      ImGui::Text("(%d meshes, %d palette bones)", skinningPass.numSkinnedMeshes, bonePalettes.numBones());
+
+      bool sharePoses = (animator.poseCache != nullptr);
+      if (ImGui::Checkbox("Share poses", &sharePoses)) {
+        animator.poseCache = (sharePoses ? &poseCache : nullptr);
+      }
+      if (sharePoses) {
+        ImGui::SameLine();
+        ImGui::Text("(%d cached)", poseCache.size());
+      }
       ImGui::Text("cam.pos:\n  %f\n  %f\n  %f", cam.pos.x, cam.pos.y, cam.pos.z);
 
       int projMode = (int)cam.projMode;
@@ -692,12 +866,14 @@ int main()
 
       ImGui::Render();
       ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+      husky::RenderState::global().invalidate(); // ImGui changes GL state behind our back
     }
 
     glfwSwapBuffers(window);
     glfwPollEvents();
   }
 
+  husky::RenderData::releaseSharedGpuData();
   ImGui_ImplOpenGL3_Shutdown();
   ImGui_ImplGlfw_Shutdown();
   ImGui::DestroyContext();
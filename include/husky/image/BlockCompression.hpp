@@ -0,0 +1,49 @@
+#pragma once
+
+#include <husky/image/Image.hpp>
+#include <cstdint>
+#include <vector>
+
+namespace husky {
+
+class ThreadPool;
+
+enum class BlockFormat // 4x4 texel blocks
+{
+  BC1, // RGB, 8 bytes per block; alpha is dropped
+  BC3, // RGBA, 16 bytes per block; BC1 color and BC4 alpha
+  BC4, // R, 8 bytes per block
+  BC5, // RG, 16 bytes per block; e.g., normal maps
+  BC7, // RGBA, 16 bytes per block; mode 6 only
+};
+
+class HUSKY_DLL CompressedImage // Block-compressed mip chain, ready for Texture upload
+{
+public:
+  static CompressedImage compress(const Image &image, BlockFormat format, bool mipmaps, ThreadPool &threadPool); // RGB8 or RGBA8; blocks are encoded in parallel
+  static int getBlockBytes(BlockFormat format);
+
+  CompressedImage();
+
+  bool valid() const;
+  int getLevelWidth(int level) const;
+  int getLevelHeight(int level) const;
+  std::size_t numBytesTotal() const;
+
+  BlockFormat format;
+  int width;
+  int height;
+  std::vector<std::vector<std::uint8_t>> levels; // Level 0 first; blocks row by row
+};
+
+class HUSKY_DLL BlockEncoder // Encodes one block of 4x4 RGBA8 texels, row by row
+{
+public:
+  static void encodeBC1(const std::uint8_t *rgba, std::uint8_t *block);
+  static void encodeBC3(const std::uint8_t *rgba, std::uint8_t *block);
+  static void encodeBC4(const std::uint8_t *rgba, int channel, std::uint8_t *block);
+  static void encodeBC5(const std::uint8_t *rgba, std::uint8_t *block);
+  static void encodeBC7(const std::uint8_t *rgba, std::uint8_t *block);
+};
+
+}
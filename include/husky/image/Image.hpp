@@ -3,14 +3,24 @@
 #include <husky/Common.hpp>
 #include <cassert>
 #include <string>
+#include <vector>
 
 namespace husky {
 
+class ThreadPool;
+
 enum class ImageFormat
 {
   UNDEFINED,
   RGB8,
   RGBA8,
+  RGBA32F, // Not supported by load() or save()
+};
+
+enum class ResampleFilter
+{
+  BOX, // Area average; fast, slightly blurry
+  KAISER, // Kaiser-windowed sinc; sharper, may ring slightly at hard edges
 };
 
 class HUSKY_DLL Image
@@ -26,6 +36,10 @@ public:
 
   bool save(const std::string &filePath) const;
   bool valid() const;
+  Image downsample() const; // Next mip level: half size, at least 1x1, 2x2 box filter; RGB8 and RGBA8
+  Image resize(int newWidth, int newHeight, ResampleFilter filter, bool srgb, ThreadPool &threadPool) const; // RGB8 and RGBA8; srgb => Color channels are filtered in linear space; alpha is always linear
+  std::vector<Image> generateMipmaps(ResampleFilter filter, bool srgb, ThreadPool &threadPool) const; // Levels 1 to 1x1, each resized from the one before
+  void premultiplyAlpha(bool srgb, ThreadPool &threadPool); // RGBA8; filter premultiplied images so transparent texels do not bleed into their neighbors
   const std::uint8_t* data() const;
   std::uint8_t* data();
 
@@ -19,11 +19,13 @@ public:
   IntersectionResult touches(const Box &box, const Matrix44d *boxTransform = nullptr) const;
   IntersectionResult touches(const Sphere &sphere) const;
   IntersectionResult touches(const std::vector<Vector3d> &polyPts) const;
+  const Vector4d& getClippingPlane(int i) const; // Normalized; positive distances are inside
+
+  static constexpr unsigned int NUM_CLIPPING_PLANES = 6; // Right, left, far, near, top, bottom
 
 private:
   static double getPointDistToPlane(const Vector3d &pt, const Vector4d &plane);
 
-  static constexpr unsigned int NUM_CLIPPING_PLANES = 6;
   Vector4d clippingPlanes[NUM_CLIPPING_PLANES];
 };
 
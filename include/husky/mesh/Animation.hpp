@@ -1,5 +1,6 @@
 #pragma once
 
+#include <husky/math/Box.hpp>
 #include <husky/math/Matrix44.hpp>
 #include <husky/math/Quaternion.hpp>
 #include <map>
@@ -18,6 +19,66 @@ public:
   std::map<double, Vector3d> keyframeScale;
 };
 
+class HUSKY_DLL AnimationCompressionSettings // Error budget for Animation::compress()
+{
+public:
+  AnimationCompressionSettings();
+  AnimationCompressionSettings(double maxPositionError, double maxRotationError, double maxScaleError);
+
+  double maxPositionError; // Model units
+  double maxRotationError; // Radians
+  double maxScaleError;
+};
+
+class HUSKY_DLL CompressedVector3Track // Keyframes quantized to 16 bits per component against the track range
+{
+public:
+  CompressedVector3Track();
+
+  bool empty() const;
+  Vector3d sample(double ticks, const Vector3d &defaultValue) const;
+  size_t getByteCount() const;
+
+  std::vector<float> keyTicks;
+  std::vector<std::uint16_t> keyValues; // 3 values per key
+  Vector3f rangeMin;
+  Vector3f rangeExtent;
+  Vector3f constValue; // Used instead of keyframes for constant tracks
+  bool constant;
+
+private:
+  Vector3d getKeyValue(int iKey) const;
+};
+
+class HUSKY_DLL CompressedQuaternionTrack // Keyframes quantized to 48 bits per key ("smallest three")
+{
+public:
+  CompressedQuaternionTrack();
+
+  bool empty() const;
+  Quaterniond sample(double ticks) const;
+  size_t getByteCount() const;
+
+  std::vector<float> keyTicks;
+  std::vector<std::uint16_t> keyValues; // 3 values per key
+  Quaternionf constValue; // Used instead of keyframes for constant tracks
+  bool constant;
+
+private:
+  Quaterniond getKeyValue(int iKey) const;
+};
+
+class HUSKY_DLL CompressedAnimationChannel
+{
+public:
+  CompressedAnimationChannel(const AnimationChannel &ch, const AnimationCompressionSettings &settings);
+
+  std::string nodeName;
+  CompressedVector3Track position;
+  CompressedQuaternionTrack rotation;
+  CompressedVector3Track scale;
+};
+
 class HUSKY_DLL AnimatedNode
 {
 public:
@@ -36,11 +97,19 @@ public:
 
   double getTicks(double seconds) const;
   bool getAnimatedNodeTransform(const std::string &nodeName, double ticks, Matrix44d &mtxAnimNode) const;
+  void compress(); // Lossy; uses compressionSettings and releases the uncompressed channels
+  bool isCompressed() const;
+  size_t getKeyframeByteCount() const;
+  const Box* getSegmentBounds(double ticks) const; // nullptr => Not computed
 
   std::string name;
   double durationTicks;
   double ticksPerSecond;
   std::map<std::string, AnimationChannel> channels; // Node name is map key
+  std::map<std::string, CompressedAnimationChannel> compressedChannels; // Node name is map key
+  AnimationCompressionSettings compressionSettings;
+  std::vector<Box> segmentBounds; // Model space bounds of the skinned model per time segment; see Model::calcAnimationBounds()
+  double segmentDurationTicks;
 };
 
 }
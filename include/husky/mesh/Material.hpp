@@ -2,6 +2,7 @@
 
 #include <husky/math/Vector3.hpp>
 #include <husky/render/Texture.hpp>
+#include <husky/render/UniformBuffer.hpp>
 #include <stdint.h>
 #include <string>
 
@@ -15,6 +16,8 @@ public:
   Material(const Vector3f &diffuse);
   Material(const Vector3f &diffuse, const Texture &tex);
 
+  MaterialUniforms getUniforms() const;
+
   std::string name;
   Vector3f diffuse;
   Vector3f specular;
@@ -28,6 +31,7 @@ public:
   bool twoSided;
   bool depthTest;
   Texture tex;
+  mutable UniformBuffer uniformBuffer; // MaterialUniforms; refreshed by RenderData::draw() when the material changes
 };
 
 }
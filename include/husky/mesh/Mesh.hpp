@@ -2,6 +2,7 @@
 
 #include <husky/math/Matrix44.hpp>
 #include <husky/render/RenderData.hpp>
+#include <cstdint>
 #include <map>
 #include <vector>
 
@@ -82,6 +83,7 @@ public:
   Tangent   getTangent(int iVert) const;
   TexCoord  getTexCoord(int iVert) const;
   Color     getColor(int iVert) const;
+  const std::vector<BoneWeight>& getBoneWeights(int iVert) const;
   void setPosition(int iVert, const Position &pos);
   void setNormal(int iVert, const Normal &nor);
   void setTangent(int iVert, const Tangent &tangent);
@@ -100,7 +102,8 @@ public:
   void translate(const Vector3d &delta);
   void transform(const Matrix44d &m);
   void convertFacesToWireframeLines();
-  RenderData getRenderData() const;
+  RenderData getRenderData(bool upload = true) const; // !upload => CPU data only, e.g., for SharedMeshBuffer
+  std::uint64_t hash() const; // Of the vertex, face and bone data; stable between runs, e.g., for disk cache keys
 
 private:
   std::vector<Position> vertPosition;
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <husky/mesh/Mesh.hpp>
+#include <husky/math/Box.hpp>
+#include <vector>
+
+namespace husky {
+
+class ThreadPool;
+
+class HUSKY_DLL SkinnedVertices // Output of MeshSkinner; SoA, padded to a multiple of four vertices
+{
+public:
+  SkinnedVertices();
+
+  Vector3d getPosition(int iVert) const;
+  Vector3d getNormal(int iVert) const;
+  Box getBbox() const;
+
+  int vertCount;
+  std::vector<float> posX, posY, posZ;
+  std::vector<float> norX, norY, norZ; // Empty if the mesh has no normals
+};
+
+class HUSKY_DLL MeshSkinner // Skins mesh vertices on the CPU, four vertices at a time with SSE; matches the default shader for up to four normalized weights per vertex, as Model::load() produces
+{
+public:
+  MeshSkinner();
+  MeshSkinner(const Mesh &mesh); // Keeps the four strongest bone weights per vertex and renormalizes them; the shader takes the first four as they are
+
+  bool valid() const;
+  int numVerts() const;
+  bool skin(const std::vector<Matrix44f> &mtxBones, SkinnedVertices &result, ThreadPool *threadPool = nullptr) const; // nullptr => ThreadPool::global()
+
+  int verticesPerTask;
+
+private:
+  void skinRange(const Matrix44f *mtxBones, int begin, int end, SkinnedVertices &result) const;
+
+  int vertCount;
+  int paddedVertCount;
+  int maxBoneIndex;
+  std::vector<float> posX, posY, posZ;
+  std::vector<float> norX, norY, norZ;
+  std::vector<std::uint16_t> boneIndices[4]; // Per influence
+  std::vector<float> boneWeights[4]; // Per influence; zero for unused influences and padding
+};
+
+}
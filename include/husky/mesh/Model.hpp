@@ -12,7 +12,12 @@
 
 namespace husky {
 
+class BakedAnimation;
+class PoseCache;
+class RenderQueue;
 class Shader;
+class SharedMeshBuffers;
+class TextureStreamer;
 class Viewport;
 
 class HUSKY_DLL ModelNode // Coordinate frame
@@ -42,27 +47,48 @@ public:
   RenderData renderData;
 };
 
+class HUSKY_DLL AnimationPose
+{
+public:
+  AnimationPose();
+
+  std::vector<AnimatedNode> nodes; // Indexed like Model::nodes
+  std::vector<std::vector<Matrix44f>> mtxBones; // Bone palette per mesh, ready for upload; empty for meshes without bones
+};
+
 class HUSKY_DLL Model
 {
 public:
-  static Model load(const std::string &filePath);
+  static Model load(const std::string &filePath, int maxBonesPerMesh = 0, bool compressTextures = false, TextureStreamer *textureStreamer = nullptr); // Meshes with more bones are split; 0 => No limit, for SkinningMode::BONE_BUFFER and SkinningPass; SkinningMode::UNIFORM_ARRAY needs Shader::maxUniformBones; compressTextures => BC1/BC7 diffuse maps; textureStreamer => Diffuse maps load progressively, uncompressed
 
-  Model(const std::string &name);
+  Model(const std::string &name); // Empty; build the node tree from root, then call indexNodes()
   Model(Mesh &&mesh, const Material &mtl);
 
   int addMaterial(const Material &mtl);
-  int addMesh(ModelMesh &&mm);
+  int addMesh(ModelMesh &&mm); // Drawn once a node lists it in meshIndices
   const Material& getMaterial(int mtlIndex) const;
-  void draw(const Shader &shader, const Viewport &viewport, const Matrix44f &view, const Matrix44f &modelView, const Matrix44f &projection, const std::map<std::string, AnimatedNode> &animNodes) const;
+  void draw(RenderQueue &queue, const Shader &shader, const Viewport &viewport, const Matrix44f &view, const Matrix44f &modelView, const Matrix44f &projection, const AnimationPose &pose, const std::vector<unsigned int> &skinnedVbos = {}, const std::vector<int> &boneOffsets = {}) const; // Submits immediately; the queue is reused scratch storage
+  void drawBaked(RenderQueue &queue, const Shader &shader, const Viewport &viewport, const Matrix44f &view, const Matrix44f &modelView, const Matrix44f &projection, const BakedAnimation &baked, double time) const; // Requires a shader with baked bones
+  void enqueue(RenderQueue &queue, const Shader &shader, const Matrix44f &modelView, const AnimationPose &pose, const std::vector<unsigned int> &skinnedVbos = {}, const std::vector<int> &boneOffsets = {}) const; // The pose must outlive the queued draws
+  void enqueueBaked(RenderQueue &queue, const Shader &shader, const Matrix44f &modelView, const BakedAnimation &baked, double time) const;
   void calcBbox();
+  void calcAnimationBounds(double segmentSeconds = 0.25, int samplesPerSegment = 4); // Skins sampled poses on the CPU and pads by half the largest vertex step between samples; stores bounds in each Animation
+  void indexNodes();
+  int getNodeIndex(const std::string &nodeName) const;
+  void getAnimationPose(const Animation *anim, double ticks, AnimationPose &pose) const;
+  void compressAnimations(const AnimationCompressionSettings &settings);
+  void useSharedBuffers(SharedMeshBuffers &sharedBuffers); // Moves meshes without bones into shared buffers for multi-draws; call sharedBuffers.upload() before drawing and do not move the model afterwards
 
   std::string name;
   std::vector<Material> materials;
   std::vector<ModelMesh> meshes;
   std::vector<Animation> animations;
   ModelNode *root; // std::unique_ptr?
-  Box bboxLocal; // Does not take animation into consideration
+  Box bboxLocal; // Does not take animation into consideration; see Animation::segmentBounds
   Sphere bsphereLocal; // Does not take animation into consideration
+  std::vector<const ModelNode*> nodes; // Flat list built by indexNodes(); parents precede children
+  std::vector<int> nodeParentIndices;
+  std::vector<std::vector<int>> meshBoneNodeIndices; // Node index of each bone, per mesh
   std::vector<const ModelNode*> getNodesFlatList() const;
 
 private:
@@ -74,16 +100,33 @@ class HUSKY_DLL ModelInstance
 public:
   ModelInstance(const Model *model);
 
-  void animate(double timeDelta);
-  void draw(const Shader &shader, const Viewport &viewport, const Matrix44f &view, const Matrix44f &modelView, const Matrix44f &projection) const;
+  void advance(double timeDelta); // Advances animation time only; the pose is left untouched
+  void animate(double timeDelta, double updateInterval = 0.0); // updateInterval > 0 => Evaluate at most once per interval (seconds) and interpolate in between
+  void animate(double timeDelta, PoseCache &poseCache); // Uses a pose shared with other instances
+  void draw(RenderQueue &queue, const Shader &shader, const Viewport &viewport, const Matrix44f &view, const Matrix44f &modelView, const Matrix44f &projection) const;
+  void enqueue(RenderQueue &queue, const Shader &shader, const Matrix44f &modelView) const;
   void setAnimationIndex(int i);
   const Animation* getActiveAnimation() const;
+  const AnimationPose& getPose() const;
+  Box getBbox() const; // Model space; tight for the current animation segment if bounds have been computed
 
   const Model *model; // std::shared_ptr?
   int animationIndex;
   double animationTime;
-  std::map<std::string, AnimatedNode> animNodes;
+  AnimationPose pose;
+  const AnimationPose *sharedPose; // Owned by a PoseCache; used instead of pose if set
+  const BakedAnimation *bakedAnimation; // If set, the pose is read from a texture on the GPU and animate() only advances time
+  std::vector<unsigned int> skinnedVbos; // Per mesh; set by SkinningPass and cleared by animate(); 0 => Skin in the vertex shader
+  std::vector<int> boneOffsets; // Per mesh; set by BonePaletteBuffer and cleared by animate(); -1 => Mesh has no palette in the bone buffer
   Matrix44d mtxTransform;
+
+private:
+  AnimationPose poseFrom; // Interpolation endpoints used when updateInterval > 0
+  AnimationPose poseTo;
+  double poseTimeFrom;
+  double poseTimeTo;
+  int poseAnimationIndex; // Animation that pose/poseFrom/poseTo were evaluated for; -2 => None
+  bool poseInterpolated; // Whether poseFrom/poseTo are valid
 };
 
 }
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <husky/mesh/Model.hpp>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+
+namespace husky {
+
+class HUSKY_DLL PoseCache // Shares evaluated poses between instances playing the same animation in sync
+{
+public:
+  PoseCache(double timeStep = 1.0 / 30.0);
+  PoseCache(const PoseCache &other) = delete;
+
+  void beginFrame(); // Releases poses that were not requested during the previous frame
+  const AnimationPose* getPose(const Model *model, int animationIndex, double ticks); // Thread-safe; valid until the next beginFrame() that releases it
+  int size() const;
+
+  double timeStep; // Seconds; animation time is quantized to this step; 0 => No quantization
+
+private:
+  class Key
+  {
+  public:
+    bool operator<(const Key &other) const;
+
+    const Model *model;
+    int animationIndex;
+    double ticks;
+  };
+
+  class Entry
+  {
+  public:
+    Entry();
+
+    AnimationPose pose;
+    std::once_flag evaluated;
+    std::atomic<int> lastUsedFrame;
+  };
+
+  mutable std::mutex mutex; // Guards entries
+  std::map<Key, std::unique_ptr<Entry>> entries;
+  int frame;
+};
+
+}
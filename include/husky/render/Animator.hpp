@@ -0,0 +1,38 @@
+#pragma once
+
+#include <husky/render/Entity.hpp>
+#include <vector>
+
+namespace husky {
+
+class Camera;
+class Frustum;
+class PoseCache;
+class ThreadPool;
+class Viewport;
+
+class HUSKY_DLL Animator // Updates the animation poses of many entities in parallel
+{
+public:
+  Animator(ThreadPool *threadPool = nullptr); // nullptr => ThreadPool::global()
+
+  void update(const std::vector<Entity*> &entities, double timeDelta); // Every entity at full rate
+  void update(const std::vector<Entity*> &entities, double timeDelta, const Camera &cam, const Viewport &viewport); // Rate depends on visibility and screen size
+
+  int grainSize; // Entities per task
+  double fullRateScreenSize; // Pixels; entities at least this large on screen are animated every frame
+  double maxUpdateInterval; // Seconds; lower bound on the update rate of tiny entities
+  PoseCache *poseCache; // Optional; visible entities share poses through the cache instead of evaluating their own
+
+  // Statistics from the last update
+  int numFullRate;
+  int numReducedRate;
+  int numOffscreen;
+
+private:
+  double getUpdateInterval(const Entity &entity, double timeDelta, const Camera &cam, const Frustum &frustum, const Viewport &viewport) const; // -1 => Off-screen
+
+  ThreadPool *threadPool;
+};
+
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <husky/render/Texture.hpp>
+#include <vector>
+
+namespace husky {
+
+class Model;
+class Shader;
+
+class HUSKY_DLL BakedAnimation // Bone palettes of one animation sampled at a fixed rate into a float texture; skinned on the GPU without per-frame CPU work
+{
+public:
+  static BakedAnimation bake(const Model &model, int animationIndex, double framesPerSecond = 30.0);
+
+  BakedAnimation();
+
+  bool valid() const;
+  double getDuration() const; // Seconds
+  void bind(const Shader &shader, double time, int meshBoneOffset) const; // Sets the texture and uniforms of a SkinningMode::BAKED_TEXTURE shader
+
+  Texture texture; // RGBA32F; one row per frame, four texels (matrix columns) per bone
+  std::vector<int> meshBoneOffsets; // Index of the first bone of each mesh within a row; -1 for meshes without bones
+  int boneCount; // Bones per row, all meshes combined
+  int frameCount;
+  double framesPerSecond; // Adjusted so that the frames span the animation duration exactly
+};
+
+}
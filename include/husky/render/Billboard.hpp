@@ -20,8 +20,10 @@ class HUSKY_DLL Billboard
 public:
   //static const std::vector<Vector2f> billboardShapeSquareCenter;
   //static const std::vector<Vector2f> billboardShapeSquareCenterBottom;
-  static Shader getBillboardShader(BillboardMode mode);
-  static MultidirTexture getMultidirectionalBillboardTexture(const Entity &entity, int texWidth, int texHeight, int numLon, int numLat);
+  static Shader getBillboardShader(BillboardMode mode); // Draws each point of a points mesh as a quad built in the vertex shader; requires OpenGL 4.3
+  static ShaderSource getBillboardShaderSource(BillboardMode mode); // For ShaderRegistry::precompile()
+  static void bindMultidirTexture(const Shader &shader, const MultidirTexture &texture); // Cell count and ImpostorLayout for SPHERICAL billboards; stored in the program, so billboards sharing the shader share the layout
+  static MultidirTexture getMultidirectionalBillboardTexture(const Entity &entity, int texWidth, int texHeight, int numLon, int numLat); // See ImpostorBaker for other layouts and caching
 };
 
 }
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <husky/math/Matrix44.hpp>
+#include <map>
+#include <vector>
+
+namespace husky {
+
+class AnimationPose;
+class ModelInstance;
+class RingBuffer;
+
+class HUSKY_DLL BonePaletteBuffer // Packs the bone palettes of all instances into one shader storage buffer per frame; see SkinningMode::BONE_BUFFER
+{
+public:
+  BonePaletteBuffer(int binding = 0);
+  BonePaletteBuffer(const BonePaletteBuffer &other) = delete;
+  ~BonePaletteBuffer();
+
+  void beginFrame(); // Clears the palettes of the previous frame
+  int add(const std::vector<Matrix44f> &mtxBones); // Returns the offset of the first bone
+  void add(ModelInstance &modelInstance); // Sets modelInstance.boneOffsets; instances sharing a pose share the palettes
+  void upload(); // Uploads all palettes and binds the buffer; call once per frame after the last add()
+
+  int binding; // Must match the shader
+  RingBuffer *ringBuffer; // Non-null => Palettes are written to its current frame region instead of an orphaned buffer
+  int numBones() const;
+
+private:
+  std::vector<Matrix44f> mtxBones; // Index 0 is identity; used by unskinned meshes
+  std::map<const AnimationPose*, std::vector<int>> poseOffsets;
+  unsigned int buffer;
+  int bufferBoneCount;
+};
+
+}
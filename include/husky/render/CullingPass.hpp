@@ -0,0 +1,43 @@
+#pragma once
+
+#include <husky/math/Matrix44.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace husky {
+
+class DepthPyramid;
+class RingBuffer;
+
+class HUSKY_DLL CullingDraw // Per-draw input of CullingPass; matches the std430 layout in the compute shader
+{
+public:
+  Vector4f boundingSphere; // Model space center and radius
+  std::uint32_t firstCommand; // Indirect draw commands of this draw
+  std::uint32_t commandCount;
+  std::uint32_t drawId; // Index of the model-view matrix in the RenderQueue draw parameters
+  std::uint32_t padding;
+};
+
+class HUSKY_DLL CullingPass // Frustum and Hi-Z occlusion culling of indirect draw commands in a compute shader; see RenderQueue::cullingPass
+{
+public:
+  CullingPass();
+  CullingPass(const CullingPass &other) = delete;
+  ~CullingPass();
+
+  void cull(unsigned int commandBuffer, std::size_t commandOffset, const std::vector<CullingDraw> &draws, const Matrix44f &view, const Matrix44f &projection); // Sets the instance count of culled commands to 0; reads model-view matrices from the RenderQueue draw parameters
+  int readVisibleCount() const; // Waits for the GPU; for statistics and tests
+
+  const DepthPyramid *depthPyramid; // Last frame's depth; nullptr => Frustum culling only
+  RingBuffer *ringBuffer; // Non-null => Draws are written to its current frame region instead of an orphaned buffer
+  int numCandidates; // Draws tested by the last cull()
+
+private:
+  unsigned int drawBuffer;
+  unsigned int visibleBuffer; // Count followed by the draw IDs of visible draws
+  int visibleBufferSize; // Draw IDs
+};
+
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <husky/math/Matrix44.hpp>
+
+namespace husky {
+
+class HUSKY_DLL DepthPyramid // Hi-Z buffer; each texel of each mip level holds the farthest depth of the texels it covers
+{
+public:
+  DepthPyramid();
+  DepthPyramid(const DepthPyramid &other) = delete;
+  ~DepthPyramid();
+
+  void build(unsigned int depthTexture, int depthWidth, int depthHeight, const Matrix44f &viewProjection, bool reversedZ); // Reduces a depth texture with compute shaders; reversedZ also implies glClipControl(..., GL_ZERO_TO_ONE)
+  bool valid() const;
+
+  unsigned int texture; // R32F; level 0 is half the depth resolution
+  int width;
+  int height;
+  int levelCount;
+  Matrix44f viewProjection; // Of the frame the depth was rendered with
+  bool reversedZ;
+};
+
+}
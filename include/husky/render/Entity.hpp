@@ -6,6 +6,7 @@
 namespace husky {
 
 class IComponent;
+class RenderQueue;
 
 class HUSKY_DLL Entity
 {
@@ -13,7 +14,9 @@ public:
   Entity(const std::string &name, const Shader *shader, const Model *model);
 
   void update(double timeDelta);
-  void draw(const Viewport &viewport, const Camera &cam) const;
+  void draw(RenderQueue &queue, const Viewport &viewport, const Camera &cam) const; // Submits immediately
+  void enqueue(RenderQueue &queue, const Camera &cam) const; // Model only; see drawComponents()
+  void drawComponents(const Viewport &viewport, const Camera &cam) const; // Debug overlays; draw after the queue has been submitted
   void calcBbox();
   const Matrix44d& getTransform() const;
   void setTransform(const Matrix44d &mtxTransform);
@@ -42,6 +45,7 @@ public:
   ModelInstance modelInstance;
   Box bboxLocal;
   Sphere bsphereLocal;
+  bool occluder; // Rasterized into the OcclusionCuller depth buffer; should be large and simple
 
 private:
   Matrix44d mtxTransform;
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <husky/math/Vector3.hpp>
+#include <husky/render/Texture.hpp>
+#include <cstdint>
+#include <string>
+
+namespace husky {
+
+class Entity;
+
+class HUSKY_DLL ImpostorBaker // Renders an Entity from many directions into a MultidirTexture; each mesh is drawn once, instanced over all view cells
+{
+public:
+  static Vector3d getCellDirection(ImpostorLayout layout, int numCellsX, int numCellsY, int iCellX, int iCellY); // Unit vector from the entity toward the viewer of a cell, in world coordinates
+
+  ImpostorBaker();
+
+  MultidirTexture bake(const Entity &entity, int texWidth, int texHeight, ImpostorLayout layout, int numCellsX, int numCellsY); // Loads from the cache if possible; the entity transform is baked in
+  std::uint64_t getCacheKey(const Entity &entity, int texWidth, int texHeight, ImpostorLayout layout, int numCellsX, int numCellsY) const; // Vertex and index data, materials, transform and parameters
+
+  std::string cacheDirectory; // Empty => No disk cache
+  int numBaked;
+  int numLoaded; // From the disk cache
+
+private:
+  CompressedImage loadCached(std::uint64_t key, int texWidth, int texHeight) const; // Invalid if missing or stale
+  void saveCached(std::uint64_t key, const CompressedImage &image) const; // BC7 with mipmaps
+  std::string getCachePath(std::uint64_t key) const;
+};
+
+}
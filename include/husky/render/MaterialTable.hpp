@@ -0,0 +1,78 @@
+#pragma once
+
+#include <husky/math/Vector4.hpp>
+#include <husky/render/Texture.hpp>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+namespace husky {
+
+class Material;
+class Shader;
+
+class HUSKY_DLL MaterialTable // Material parameters in a shader storage buffer and textures in array layers, so RenderQueue can multi-draw meshes with different materials together
+{
+public:
+  static constexpr int materialsBinding = 5; // Shader storage binding of the material parameters
+  static constexpr int drawMaterialsBinding = 6; // Shader storage binding of the per-draw material indices; see RenderQueue
+  static constexpr int textureUnit = 2;
+
+  MaterialTable();
+  MaterialTable(const MaterialTable &other) = delete;
+  ~MaterialTable();
+
+  int add(const Material &material); // Index; the material must not move; call build() after the last add()
+  void build(); // Copies textures into arrays, one per size and format, and uploads the parameters; call again after materials change
+  int find(const Material &material) const; // -1 => Not in the table, or its texture could not be packed
+  unsigned int getBatchKey(const Material &material) const; // Equal for materials with the same texture array and pipeline state; 0 => Not in the table
+  bool canBatch(const Material &a, const Material &b) const;
+  void bind(const Shader &shader, const Material &material) const; // Parameters and the texture array of material
+  int size() const;
+  int numTextureArrays() const;
+
+private:
+  class Entry
+  {
+  public:
+    const Material *material;
+    int arrayIndex; // -1 => Untextured
+    int layer;
+    bool packed; // False => The texture was not resident in full when built
+  };
+
+  class TextureArray
+  {
+  public:
+    unsigned int handle;
+    int width;
+    int height;
+    int internalFormat;
+    int numLevels;
+    TexWrap wrap;
+    TexFilter filter;
+    std::vector<int> entries; // One layer each
+  };
+
+  class GpuMaterial // std430 layout of TableMaterial in the default shaders
+  {
+  public:
+    Vector4f ambient; // xyz used
+    Vector4f diffuse;
+    Vector4f specular;
+    Vector4f emissive;
+    float shininess;
+    float shininessStrength;
+    float opacity;
+    std::int32_t layer; // -1 => Untextured
+  };
+
+  void destroyArrays();
+
+  std::vector<Entry> entries;
+  std::unordered_map<const Material*, int> indices;
+  std::vector<TextureArray> textureArrays;
+  unsigned int buffer;
+};
+
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <husky/math/Box.hpp>
+#include <husky/math/Matrix44.hpp>
+#include <vector>
+
+namespace husky {
+
+class Mesh;
+class Model;
+class ThreadPool;
+
+class HUSKY_DLL OcclusionCuller // Rasterizes occluders into a low-resolution depth buffer on the CPU; each triangle is as far away as its farthest vertex, so depth is conservative
+{
+public:
+  OcclusionCuller(int width = 256, int height = 128); // Width is rounded up to a multiple of 4 (SIMD)
+
+  void beginFrame(const Matrix44d &viewProjection); // Clears occluders and depth; perspective projections only
+  void addOccluder(const Mesh &mesh, const Matrix44d &transform); // The mesh must outlive rasterize()
+  void addOccluder(const Model &model, const Matrix44d &transform); // Bind pose
+  void rasterize(ThreadPool &threadPool); // Call once after the last addOccluder()
+  bool isVisible(const Box &bboxLocal, const Matrix44d &transform) const; // Thread-safe after rasterize()
+
+  int width;
+  int height;
+  std::vector<float> depth; // Farthest occluder clip-space w per pixel, row-major from the bottom
+  int numOccluderTriangles; // Rasterized by the last rasterize()
+
+private:
+  class Occluder
+  {
+  public:
+    const Mesh *mesh;
+    Matrix44d mtxClip; // Object to clip space
+  };
+
+  class ScreenTriangle
+  {
+  public:
+    float x[3]; // Pixels
+    float y[3];
+    float farW; // Farthest vertex; the whole triangle is treated as this far away
+  };
+
+  void setupTriangles(const Occluder &occluder, std::vector<ScreenTriangle> &triangles) const;
+  void rasterizeRows(int rowBegin, int rowEnd);
+
+  Matrix44d viewProjection;
+  std::vector<Occluder> occluders;
+  std::vector<std::vector<ScreenTriangle>> occluderTriangles; // Per occluder
+};
+
+}
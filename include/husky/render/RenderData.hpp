@@ -8,6 +8,7 @@ namespace husky {
 
 class Shader;
 class Material;
+class SharedMeshBuffer;
 class Viewport;
 
 enum class VertexAttributeDataType
@@ -35,6 +36,10 @@ public:
   static constexpr char BONE_INDICES[]  = "vertBoneIndices";
   static constexpr char BONE_WEIGHTS[]  = "vertBoneWeights";
   static constexpr char TANGENTS[]      = "vertTangents";
+  static constexpr char DRAW_ID[]       = "vertDrawId"; // Instanced; index of the per-draw parameters of multi-draws (see RenderQueue)
+  static constexpr int LOCATION_COUNT  = 8;
+  static int getLocation(const std::string &name); // Fixed attribute location bound in every shader program; -1 => None
+  static const char* getLocationName(int location);
   // TODO: Pack vertex attributes according to http://www.humus.name/Articles/Persson_CreatingVastGameWorlds.pdf#page=22 / https://www.khronos.org/opengl/wiki/Vertex_Specification_Best_Practices
 
   VertexAttribute(const std::string &name, VertexAttributeDataType dataType, int elementCount, bool normalize, int byteOffset);
@@ -120,35 +125,64 @@ public:
 
 enum class PrimitiveType { UNDEFINED, POINTS, LINES, TRIANGLES, };
 
+class HUSKY_DLL IndexChunk // Range of 16-bit indices drawn with glDrawElementsBaseVertex()
+{
+public:
+  int firstIndex;
+  int indexCount;
+  int baseVertex; // Added to each index
+};
+
 class HUSKY_DLL IndexData
 {
 public:
+  static int getIndicesPerPrimitive(PrimitiveType primitiveType);
+
   IndexData(PrimitiveType primitiveType);
 
   void addPoint(int v0);
   void addLine(int v0, int v1);
   void addTriangle(int v0, int v1, int v2);
+  int getIndexCount() const;
+  std::vector<IndexChunk> buildChunks(std::vector<std::uint16_t> &chunkIndices) const; // Splits 32-bit indices into chunks that each fit in 16 bits; primitives are never split
 
   PrimitiveType primitiveType;
   std::vector<std::uint16_t> indices16;
-  std::vector<std::uint32_t> indices32; // TODO: Use multiple lists of 16-bit indices instead?
+  std::vector<std::uint32_t> indices32; // Split into 16-bit chunks on upload
 };
 
 class HUSKY_DLL RenderData
 {
 public:
+  static constexpr int pulledPointsBinding = 7; // Shader storage binding of the vertex buffer for shaders with Shader::hasPulledPoints()
+
   unsigned int vbo = 0; // TODO: Remove?
-  unsigned int vao = 0; // TODO: Remove?
+  unsigned int vao = 0; // Configured once by uploadToGpu()
+  unsigned int skinnedVao = 0; // Like vao, but position and normal are read from a SkinningPass buffer
+  unsigned int ebo = 0; // 16-bit indices; see indexChunks
+  std::vector<IndexChunk> indexChunks; // Set by uploadToGpu()
+  const SharedMeshBuffer *sharedBuffer = nullptr; // Non-null => vbo, vao, ebo and indexChunks refer to this shared buffer
 
   RenderData();
   RenderData(VertexData &&vertData, IndexData &&indexData);
   //~RenderData(); // TODO: Cleanup (VBO, VAO, ...) here?
 
-  void uploadToGpu(); // TODO: Remove?
-  void draw(const Shader &shader, const Material &mtl, const Viewport &viewport, const Matrix44f &view, const Matrix44f &modelView, const Matrix44f &projection, const std::vector<Matrix44f> &mtxBones = {}) const;
+  void uploadToGpu(); // Uploads vertices and configures the VAOs
+  void releaseCpuData(); // Frees the vertex and index data once uploaded; vertex count and chunks are kept for drawing
+  void releaseGpuData(); // Deletes buffers and VAOs, unless they belong to a shared buffer
+  static void releaseSharedGpuData(); // Deletes the quad indices that drawPulledPoints() shares between all instances; call before destroying the GL context
+  void draw(const Shader &shader, const Material &mtl, const Viewport &viewport, const Matrix44f &view, const Matrix44f &modelView, const Matrix44f &projection, const std::vector<Matrix44f> &mtxBones = {}, unsigned int skinnedVbo = 0) const; // skinnedVbo => Pre-skinned positions and normals from SkinningPass
+  bool bindVertexArray(unsigned int skinnedVbo = 0) const; // Binds the VAO; attributes use the fixed locations from VertexAttribute::getLocation()
+  static bool bindDrawState(const Shader &shader, const Material &mtl, const Viewport &viewport, const Matrix44f &view, const Matrix44f &modelView, const Matrix44f &projection, const std::vector<Matrix44f> &mtxBones = {}); // Pipeline state, program, uniforms and texture of a draw
+  static void configureVertexArray(unsigned int vertexArray, const VertexDescription &vertDesc, unsigned int vbo, unsigned int ebo, bool skinned);
   
   VertexData _vertData;
   IndexData _indexData;
+
+private:
+  void drawPulledPoints(const Shader &shader) const;
+
+  mutable unsigned int skinnedVaoVbo = 0; // Buffer currently attached to skinnedVao
 };
 
 }
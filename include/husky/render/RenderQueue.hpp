@@ -0,0 +1,117 @@
+#pragma once
+
+#include <husky/math/Matrix44.hpp>
+#include <husky/render/CullingPass.hpp>
+#include <husky/render/Viewport.hpp>
+#include <cstdint>
+#include <vector>
+
+namespace husky {
+
+class BakedAnimation;
+class Material;
+class MaterialTable;
+class RenderData;
+class RingBuffer;
+class Shader;
+
+enum class RenderPass // Most significant bits of the sort key
+{
+  SOLID, // Sorted by state, then front-to-back
+  TRANSLUCENT, // Material opacity < 1; sorted back-to-front
+};
+
+class HUSKY_DLL DrawItem
+{
+public:
+  std::uint64_t sortKey;
+  const Shader *shader;
+  const Material *material;
+  const RenderData *renderData;
+  const std::vector<Matrix44f> *mtxBones; // nullptr => No bone uniforms
+  const BakedAnimation *bakedAnimation; // nullptr => Not baked
+  float bakedTime; // Seconds
+  int boneOffset; // BonePaletteBuffer offset, or BakedAnimation mesh offset if baked
+  unsigned int skinnedVbo; // 0 => Not pre-skinned
+  Matrix44f modelView;
+  Vector4f boundingSphere; // Model space center and radius; radius < 0 => Never culled by CullingPass
+};
+
+class HUSKY_DLL RenderQueue // Collects draws during a frame, sorts them to minimize state changes and submits them in a separate phase
+{
+public:
+  static std::uint64_t makeSortKey(RenderPass pass, unsigned int shaderId, unsigned int textureId, unsigned int materialId, float depth);
+
+  static constexpr int drawParamsBinding = 1; // Shader storage binding of the per-draw model-view matrices; see Shader::hasDrawParams()
+
+  RenderQueue();
+  RenderQueue(const RenderQueue &other) = delete;
+  ~RenderQueue();
+
+  void begin(const Viewport &viewport, const Matrix44f &view, const Matrix44f &projection); // Clears the queue
+  void add(const Shader &shader, const Material &material, const RenderData &renderData, const Matrix44f &modelView);
+  DrawItem& addItem(const Shader &shader, const Material &material, const RenderData &renderData, const Matrix44f &modelView); // For draws with bones
+  void sort(); // Radix sort by sort key
+  void submit(); // Draws in sorted order (or insertion order if not sorted); consecutive SharedMeshBuffer draws with the same state become one multi-draw
+  int numBatches() const; // GL draw calls issued by the last submit(), counting each multi-draw once
+  int size() const;
+  const DrawItem& operator[](int i) const; // In sorted order
+
+  Viewport viewport;
+  Matrix44f view;
+  Matrix44f projection;
+  CullingPass *cullingPass; // Non-null => Multi-draws with bounds are culled on the GPU before submission
+  RingBuffer *ringBuffer; // Non-null => Draw commands and parameters are written to its current frame region instead of orphaned buffers
+  MaterialTable *materialTable; // Non-null => Draws with shaders that read the table are sorted and multi-drawn across its materials; set before add()
+
+private:
+  class SortEntry
+  {
+  public:
+    std::uint64_t key;
+    int itemIndex;
+  };
+
+  class DrawCommand // Layout of DrawElementsIndirectCommand
+  {
+  public:
+    std::uint32_t indexCount;
+    std::uint32_t instanceCount;
+    std::uint32_t firstIndex;
+    std::int32_t baseVertex;
+    std::uint32_t baseInstance; // Draw ID; see VertexAttribute::DRAW_ID
+  };
+
+  class DrawBatch // Consecutive items drawn with one GL call, or a single item
+  {
+  public:
+    int firstOrder; // Index into order
+    int firstDrawId; // -1 => Shader has no draw parameters; shaders see it relative to its segment of SharedMeshBuffer::maxDrawIds draws
+    int firstCommand;
+    int commandCount; // 0 => Not a multi-draw
+  };
+
+  void buildBatches();
+  void uploadDrawParams();
+  void bindDrawParamSegment(int segment); // Binds the draw parameters of draw IDs [segment * SharedMeshBuffer::maxDrawIds, ...)
+
+  std::vector<DrawItem> items;
+  std::vector<SortEntry> order;
+  std::vector<SortEntry> sortScratch;
+  std::vector<DrawBatch> batches;
+  std::vector<DrawCommand> drawCommands;
+  std::vector<Matrix44f> drawModelViews; // Indexed by draw ID
+  std::vector<std::int32_t> drawMaterials; // Indexed by draw ID; MaterialTable index, or -1
+  std::vector<CullingDraw> cullingDraws;
+  unsigned int commandBuffer;
+  unsigned int drawParamsBuffer;
+  unsigned int drawMaterialsBuffer;
+  unsigned int frameCommandBuffer; // commandBuffer or the ring buffer
+  std::size_t frameCommandOffset; // Bytes
+  unsigned int frameParamsBuffer; // drawParamsBuffer or the ring buffer
+  std::size_t frameParamsOffset; // Bytes
+  unsigned int frameMaterialsBuffer; // drawMaterialsBuffer or the ring buffer
+  std::size_t frameMaterialsOffset; // Bytes
+};
+
+}
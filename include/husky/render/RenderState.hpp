@@ -0,0 +1,67 @@
+#pragma once
+
+#include <husky/Common.hpp>
+#include <array>
+#include <cstddef>
+
+namespace husky {
+
+class HUSKY_DLL PipelineState // Fixed-function state of a draw
+{
+public:
+  PipelineState(bool cullFace = true, bool depthTest = true, bool blend = false);
+
+  bool operator==(const PipelineState &other) const;
+  bool operator!=(const PipelineState &other) const;
+
+  const bool cullFace;
+  const bool depthTest;
+  const bool blend; // Alpha blending (source alpha, one minus source alpha)
+};
+
+class HUSKY_DLL RenderState // Shadow copy of the current OpenGL state; only issues GL calls for actual state transitions
+{
+public:
+  static RenderState& global(); // For the current (single) GL context
+
+  RenderState();
+  RenderState(const RenderState &other) = delete;
+
+  void apply(const PipelineState &pipelineState);
+  void useProgram(unsigned int program);
+  void bindTexture(int unit, unsigned int texture); // GL_TEXTURE_2D
+  void bindBuffer(unsigned int target, unsigned int buffer);
+  void bindBufferBase(unsigned int target, int index, unsigned int buffer); // Also changes the generic binding of target
+  void bindBufferRange(unsigned int target, int index, unsigned int buffer, std::size_t offset, std::size_t size); // Not skipped; ranges usually change every frame
+  void bindVertexArray(unsigned int vao);
+  void deleteBuffer(unsigned int buffer); // Deletes and unbinds buffer, so a new buffer reusing its name is not mistaken for it
+  void deleteVertexArray(unsigned int vao); // Like deleteBuffer()
+  void invalidate(); // Forget the shadowed state; call after GL calls that bypass this class (e.g., GUI rendering)
+  void resetCounters();
+
+  int numStateChanges; // Since resetCounters()
+  int numSkippedChanges;
+
+private:
+  enum class BufferTarget { ARRAY, ELEMENT_ARRAY, UNIFORM, SHADER_STORAGE, TRANSFORM_FEEDBACK, DRAW_INDIRECT, COUNT, };
+
+  static constexpr int maxTextureUnits = 8;
+  static constexpr int maxIndexedBindings = 8;
+  static constexpr unsigned int unknown = 0xFFFFFFFF;
+
+  static int getBufferTarget(unsigned int target); // -1 => Not shadowed
+  void setCapability(unsigned int cap, int &current, bool enable);
+  bool skip(bool unchanged);
+
+  int cullFace; // -1 => Unknown
+  int depthTest;
+  int blend;
+  unsigned int program;
+  int activeTextureUnit;
+  std::array<unsigned int, maxTextureUnits> textures;
+  std::array<unsigned int, (size_t)BufferTarget::COUNT> buffers;
+  std::array<std::array<unsigned int, maxIndexedBindings>, (size_t)BufferTarget::COUNT> indexedBuffers;
+  unsigned int vertexArray;
+};
+
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <husky/Common.hpp>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace husky {
+
+class HUSKY_DLL RingAllocation // Transient memory valid until the end of the frame it was allocated in
+{
+public:
+  RingAllocation();
+
+  bool valid() const;
+
+  unsigned int buffer; // 0 => Allocation failed
+  std::size_t offset; // Bytes from the start of buffer; bind with RenderState::bindBufferRange() or use as an indirect offset
+  std::size_t size;
+  void *data; // Write-only; coherent, so no flush is needed
+};
+
+class HUSKY_DLL RingBuffer // Persistently mapped buffer split into one region per frame in flight; fences keep the CPU from overwriting a region the GPU still reads
+{
+public:
+  static constexpr int framesInFlight = 3;
+
+  RingBuffer(std::size_t frameSize = 4 << 20); // Bytes per frame; the GL buffer is created by the first beginFrame()
+  RingBuffer(const RingBuffer &other) = delete;
+  ~RingBuffer();
+
+  void beginFrame(); // Waits for the oldest region (normally already done) and grows the buffer if the previous frame ran out of space
+  void endFrame(); // Fences the current region; call after the last GL command reading it
+  RingAllocation allocate(std::size_t size, std::size_t alignment = 0); // Alignment 0 => Largest uniform/storage buffer offset alignment; fails if the frame region is full
+  RingAllocation upload(const void *data, std::size_t size, std::size_t alignment = 0); // allocate() and copy
+
+  std::size_t frameSize;
+  unsigned int buffer;
+  int numStalls; // beginFrame() calls that had to wait for the GPU
+  int numOverflows; // Failed allocations since the last resize
+
+private:
+  void create();
+  void destroy(); // Waits for all fences
+
+  std::array<void*, framesInFlight> fences; // GLsync
+  std::size_t offsetAlignment;
+  std::size_t frameOffset; // Used bytes of the current region
+  std::size_t requiredFrameSize; // Largest frame demand seen, including failed allocations
+  int frameIndex;
+  std::uint8_t *mappedData;
+};
+
+}
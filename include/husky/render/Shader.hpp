@@ -1,11 +1,14 @@
 #pragma once
 
-#include <husky/Common.hpp>
+#include <husky/render/UniformBuffer.hpp>
+#include <array>
 #include <string>
 #include <vector>
 
 namespace husky {
 
+class ShaderSource;
+
 class HUSKY_DLL ShaderUniform
 {
 public:
@@ -34,22 +37,75 @@ public:
   int size;
 };
 
-class HUSKY_DLL Shader
+enum class UniformSlot // Uniforms set per draw; resolved once per Shader so draws avoid name lookups
+{
+  MTX_MODEL_VIEW,
+  MTX_NORMAL,
+  MTX_PROJECTION,
+  MTX_BONES,
+  BONE_OFFSET,
+  BAKED_BONE_OFFSET,
+  BAKED_BONES,
+  BAKED_TIME,
+  BAKED_FRAMES_PER_SECOND,
+  BAKED_FRAME_COUNT,
+  TEX,
+  LIGHT_DIR,
+  MTL_AMBIENT,
+  MTL_DIFFUSE,
+  MTL_SPECULAR,
+  MTL_EMISSIVE,
+  MTL_SHININESS,
+  MTL_SHININESS_STRENGTH,
+  VIEWPORT_SIZE,
+  LINE_WIDTH,
+  MTL_TEXTURES,
+  POINT_LAYOUT,
+  COUNT,
+};
+
+enum class SkinningMode
+{
+  NONE,
+  UNIFORM_ARRAY, // mtxBones uniform; at most 100 bones per mesh, see Model::load()
+  BONE_BUFFER, // Shader storage buffer filled by BonePaletteBuffer; requires OpenGL 4.3
+  BAKED_TEXTURE, // BakedAnimation texture
+};
+
+class HUSKY_DLL Shader // The get*Shader() functions share their programs through ShaderRegistry::global()
 {
 public:
+  static constexpr int maxUniformBones = 100; // Size of the mtxBones uniform of SkinningMode::UNIFORM_ARRAY shaders
+
   static Shader getDefaultShader(bool texture, bool bones);
+  static Shader getDefaultShader(bool texture, SkinningMode skinning, bool multiDraw = false, bool materialTable = false); // multiDraw => Model-view matrix from RenderQueue draw parameters; requires OpenGL 4.3; materialTable => Also material parameters and texture from RenderQueue::materialTable, or from the material of the draw if it is not in the table
+  static ShaderSource getDefaultShaderSource(bool texture, SkinningMode skinning, bool multiDraw = false, bool materialTable = false); // For ShaderRegistry::precompile()
   static Shader getLineShader();
+  static Shader getSkinningShader(); // Vertex-only; captures skinned position and normal with transform feedback
+  static Shader getComputeShader(const std::string &compSrc); // Requires OpenGL 4.3
 
   Shader();
   Shader(unsigned int shaderProgramHandle);
-  Shader(const std::string &vertSrc, const std::string &geomSrc, const std::string &fragSrc);
+  Shader(const std::string &vertSrc, const std::string &geomSrc, const std::string &fragSrc); // Compiles immediately and is not shared
 
   const ShaderUniform& getUniform(const std::string &uniformName) const;
+  const ShaderUniform& getUniform(UniformSlot slot) const;
+  bool hasUniformBlock(UniformBlock block) const;
+  bool hasDrawParams() const; // Reads per-draw parameters through VertexAttribute::DRAW_ID
+  bool hasMaterialTable() const; // Reads material parameters from MaterialTable by draw ID
+  bool hasPulledPoints() const; // Reads points from the vertex buffer and expands each into a quad; see Billboard
   const ShaderAttribute& getAttribute(const std::string &attrName) const;
 
   unsigned int shaderProgramHandle;
   std::vector<ShaderUniform> uniforms;
   std::vector<ShaderAttribute> attrs;
+
+private:
+  std::array<ShaderUniform, (size_t)UniformSlot::COUNT> slotUniforms;
+  std::array<bool, (size_t)UniformBlock::COUNT> uniformBlocks;
+  bool drawParams;
+  bool materialTable;
+  bool pulledPoints;
 };
 
 }
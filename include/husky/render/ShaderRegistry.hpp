@@ -0,0 +1,67 @@
+#pragma once
+
+#include <husky/render/Shader.hpp>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace husky {
+
+class HUSKY_DLL ShaderSource // One program permutation; defines are part of the sources
+{
+public:
+  static ShaderSource graphics(const std::string &vertSrc, const std::string &geomSrc, const std::string &fragSrc, const std::vector<std::string> &feedbackVaryings = {});
+  static ShaderSource compute(const std::string &compSrc);
+
+  std::uint64_t hash() const;
+
+  std::string vertSrc;
+  std::string geomSrc; // Optional
+  std::string fragSrc; // Optional for transform feedback programs
+  std::string compSrc; // Non-empty => Compute program; the other sources are ignored
+  std::vector<std::string> feedbackVaryings; // Interleaved
+};
+
+class HUSKY_DLL ShaderRegistry // Shares one program per source permutation; compiles in parallel where supported and caches program binaries on disk
+{
+public:
+  static ShaderRegistry& global(); // For the current (single) GL context
+
+  ShaderRegistry();
+  ShaderRegistry(const ShaderRegistry &other) = delete;
+
+  void precompile(const ShaderSource &source); // Starts compiling without waiting; with GL_KHR_parallel_shader_compile, the driver compiles on its own threads
+  bool isReady(const ShaderSource &source); // Whether get() would return without waiting for the driver; always true without GL_KHR_parallel_shader_compile
+  const Shader& get(const ShaderSource &source); // Waits for the program if needed; shaderProgramHandle is 0 if it failed to build
+
+  std::string binaryCacheDirectory; // Empty => No disk cache; set before the first precompile() or get()
+  int numCompiled; // Programs built from source
+  int numLoaded; // Programs loaded from the disk cache
+
+private:
+  class Entry
+  {
+  public:
+    unsigned int program; // Until finished
+    std::vector<unsigned int> shaders; // Compiled from source; deleted when finished
+    bool fromBinary;
+    bool finished;
+    Shader shader;
+  };
+
+  Entry& start(const ShaderSource &source);
+  void compile(Entry &entry, const ShaderSource &source);
+  void finish(Entry &entry, const ShaderSource &source, std::uint64_t hash);
+  bool loadBinary(unsigned int program, std::uint64_t hash) const;
+  void saveBinary(unsigned int program, std::uint64_t hash) const;
+  std::string getBinaryPath(std::uint64_t hash) const;
+  void checkDriver();
+
+  std::map<std::uint64_t, Entry> entries; // By source hash
+  std::uint64_t driverHash; // Vendor, renderer and version; binaries of other drivers are ignored
+  bool parallelCompile;
+  bool driverChecked;
+};
+
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <husky/render/RenderData.hpp>
+#include <memory>
+#include <vector>
+
+namespace husky {
+
+class HUSKY_DLL SharedMeshBuffer // Static meshes with the same vertex layout, sub-allocated from one vertex buffer and one index buffer; drawn with one VAO
+{
+public:
+  static constexpr int maxDrawIds = 65536; // Draw IDs per segment of draw parameters; see RenderQueue::submit()
+
+  SharedMeshBuffer(const VertexDescription &vertDesc);
+  SharedMeshBuffer(const SharedMeshBuffer &other) = delete;
+  ~SharedMeshBuffer();
+
+  bool matches(const VertexDescription &vertDesc) const;
+  bool add(RenderData &renderData); // Copies the CPU data of an indexed triangle mesh; renderData is redirected here by upload() and must stay in place
+  void upload(); // (Re)creates the GPU buffers if meshes were added since the last upload
+
+  VertexDescription vertDesc;
+  unsigned int vbo;
+  unsigned int ebo; // 16-bit indices
+  unsigned int vao; // Also feeds VertexAttribute::DRAW_ID from the instance index
+  int vertCount;
+  int indexCount;
+
+private:
+  class Allocation
+  {
+  public:
+    RenderData *renderData;
+    std::vector<IndexChunk> indexChunks; // Offset into the shared buffers
+  };
+
+  std::vector<std::uint8_t> vertBytes; // CPU copy, so the buffers can grow
+  std::vector<std::uint16_t> indices;
+  std::vector<Allocation> allocations;
+  bool dirty;
+};
+
+class HUSKY_DLL SharedMeshBuffers // One SharedMeshBuffer per vertex layout
+{
+public:
+  SharedMeshBuffers();
+
+  SharedMeshBuffer* add(RenderData &renderData); // nullptr => Not added
+  void upload();
+
+  std::vector<std::unique_ptr<SharedMeshBuffer>> buffers;
+};
+
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <husky/render/BonePaletteBuffer.hpp>
+#include <husky/render/Shader.hpp>
+#include <map>
+#include <vector>
+
+namespace husky {
+
+class AnimationPose;
+class ModelInstance;
+class RenderData;
+
+class HUSKY_DLL SkinningPass // Skins meshes once per frame into GPU buffers with transform feedback, so later passes can draw them without skinning
+{
+public:
+  static constexpr int bonePalettesBinding = 3; // Shader storage binding of the palettes read by the skinning shader; shared with CullingPass, as both bind right before use
+
+  SkinningPass();
+  SkinningPass(const SkinningPass &other) = delete;
+  ~SkinningPass();
+
+  void beginFrame(); // Invalidates the buffers of the previous frame
+  void skin(ModelInstance &modelInstance); // Sets modelInstance.skinnedVbos; instances sharing a pose share the result
+  void execute(); // Uploads all bone palettes at once and fills the buffers queued by skin(); call before drawing
+
+  int numSkinnedMeshes; // Since beginFrame()
+
+private:
+  class SkinnedBuffer
+  {
+  public:
+    unsigned int vbo;
+    int byteCount;
+  };
+
+  class SkinningJob
+  {
+  public:
+    const RenderData *renderData;
+    int boneOffset;
+    unsigned int vbo;
+  };
+
+  unsigned int acquireBuffer(int byteCount);
+
+  Shader shader;
+  BonePaletteBuffer bonePalettes;
+  std::vector<SkinningJob> jobs;
+  std::vector<SkinnedBuffer> buffers; // Reused across frames
+  int numBuffersUsed;
+  std::map<const AnimationPose*, std::vector<unsigned int>> skinnedPoses;
+};
+
+}
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <husky/image/BlockCompression.hpp>
 #include <husky/image/Image.hpp>
 
 namespace husky {
@@ -32,6 +33,7 @@ public:
   Texture();
   Texture(ImageFormat imageFormat, int w, int h, TexWrap wrap, TexFilter filter, TexMipmaps mipmaps, const void *data = nullptr);
   Texture(const Image &image, TexWrap wrap, TexFilter filter, TexMipmaps mipmaps);
+  Texture(const CompressedImage &image, TexWrap wrap, TexFilter filter); // Uploads the precomputed mip chain; uploadImageData() and buildMipmaps() do not apply
   Texture(const std::string &imageFilePath, TexWrap wrap, TexFilter filter, TexMipmaps mipmaps);
 
   bool valid() const;
@@ -46,15 +48,23 @@ public:
   TexMipmaps mipmaps;
 };
 
+enum class ImpostorLayout // How the view cells of a MultidirTexture map to view directions; see Billboard::bindMultidirTexture()
+{
+  LON_LAT, // Rows of longitudes per latitude
+  OCTAHEDRAL, // Directions over the whole sphere folded onto an octahedron; even coverage, so far fewer cells are needed
+  HEMI_OCTAHEDRAL, // Upper hemisphere only, for objects that are never seen from below
+};
+
 class HUSKY_DLL MultidirTexture
 {
 public:
   MultidirTexture();
-  MultidirTexture(Texture &&tex, int numLon, int numLat);
+  MultidirTexture(Texture &&tex, int numLon, int numLat, ImpostorLayout layout = ImpostorLayout::LON_LAT);
 
   Texture tex;
-  int numLon;
-  int numLat;
+  int numLon; // Cells across
+  int numLat; // Cells down
+  ImpostorLayout layout;
 };
 
 }
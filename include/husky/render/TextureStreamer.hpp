@@ -0,0 +1,78 @@
+#pragma once
+
+#include <husky/math/Matrix44.hpp>
+#include <husky/render/RingBuffer.hpp>
+#include <husky/render/Texture.hpp>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace husky {
+
+class Camera;
+class ModelInstance;
+class Viewport;
+
+class HUSKY_DLL TextureStreamer // Loads textures progressively: images are decoded on worker threads, a small tail of the mip chain becomes resident first, and finer levels follow as their texels become visible on screen
+{
+public:
+  TextureStreamer(int numThreads = 2, std::size_t uploadBudget = 8 << 20);
+  TextureStreamer(const TextureStreamer &other) = delete;
+  ~TextureStreamer();
+
+  Texture add(const std::string &imageFilePath, TexWrap wrap, TexFilter filter); // Returns at once; samples as white until the tail arrives; the handle never changes, so the texture can be copied into materials
+  void request(const Texture &texture, double screenSize); // Pixels covered by the whole texture along its larger side; call every frame while the texture is visible
+  void request(const ModelInstance &modelInstance, const Matrix44d &mtxTransform, const Camera &cam, const Viewport &viewport); // All materials, assuming each texture spans the model bounds once
+  void update(); // Once per frame on the GL thread; uploads decoded levels through pixel buffers and drops levels that were not requested recently
+
+  std::size_t uploadBudget; // Bytes per update(); larger levels are uploaded in strips over several frames
+  int tailSize; // Levels at most this many texels wide and high are uploaded together as soon as the image is decoded
+  double lodBias; // Added to the desired level; negative => Sharper
+  int evictionDelay; // Frames a finer level stays resident after it was last requested
+
+  // Statistics from the last update
+  std::size_t numBytesUploaded;
+  int numPending; // Textures still decoding or below their desired level
+
+private:
+  class Entry
+  {
+  public:
+    std::string imageFilePath;
+    std::vector<Image> levels; // Decoded mip chain; empty until the worker is done
+    int tailLevel; // Coarsest level uploaded on arrival
+    int residentLevel; // Finest level the GPU may sample; levels.size() => Only the placeholder
+    int uploadRow; // Rows of level residentLevel - 1 uploaded so far
+    int framesSinceNeeded; // Frames since residentLevel was last requested
+    double screenSize; // Largest request this frame
+    bool decoding;
+  };
+
+  class Decoded
+  {
+  public:
+    unsigned int handle;
+    std::vector<Image> levels;
+  };
+
+  void workerMain();
+  bool uploadRows(unsigned int handle, Entry &entry, int level, std::size_t &budget); // Continues at entry.uploadRow; true when the level is complete
+  int getDesiredLevel(const Entry &entry) const; // Decoded entries only
+
+  std::map<unsigned int, Entry> entries; // By texture handle
+  std::map<std::string, Texture> textures; // By image file path
+  RingBuffer stagingBuffer; // Pixel unpack buffer; fenced like per-frame GPU data
+
+  std::vector<std::thread> threads;
+  std::mutex mutex;
+  std::condition_variable wakeCondition;
+  std::deque<std::pair<unsigned int, std::string>> decodeQueue; // Texture handle and image file path
+  std::deque<Decoded> decoded;
+  bool stopping;
+};
+
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <husky/math/Matrix44.hpp>
+#include <husky/math/Vector4.hpp>
+#include <cstdint>
+#include <vector>
+
+namespace husky {
+
+enum class UniformBlock // Binding points of the uniform blocks in the default shaders
+{
+  FRAME, // FrameUniforms
+  MATERIAL, // MaterialUniforms
+  COUNT,
+};
+
+class HUSKY_DLL FrameUniforms // std140 layout of the FrameUniforms block; constant for all draws with the same camera
+{
+public:
+  FrameUniforms();
+  FrameUniforms(const Matrix44f &view, const Matrix44f &projection, int viewportWidth, int viewportHeight);
+
+  Matrix44f mtxProjection;
+  Vector4f lightDir; // View space
+  Vector4f lightAmbient;
+  Vector4f lightDiffuse;
+  Vector4f lightSpecular;
+  Vector4f viewportSize; // Pixels; xy used
+};
+
+class HUSKY_DLL MaterialUniforms // std140 layout of the MaterialUniforms block
+{
+public:
+  Vector4f mtlAmbient; // xyz used
+  Vector4f mtlDiffuse;
+  Vector4f mtlSpecular;
+  Vector4f mtlEmissive;
+  float mtlShininess;
+  float mtlShininessStrength;
+  float lineWidth;
+  float opacity;
+};
+
+class HUSKY_DLL UniformBuffer // Uniform buffer object that is only re-uploaded when its contents change
+{
+public:
+  UniformBuffer();
+  UniformBuffer(const UniformBuffer &other); // The copy gets its own GPU buffer on first update()
+  UniformBuffer& operator=(const UniformBuffer &other);
+  ~UniformBuffer();
+
+  void update(const void *data, int byteCount);
+  void bind(UniformBlock block) const;
+
+  unsigned int handle;
+
+private:
+  std::vector<std::uint8_t> bytes; // Last uploaded contents
+};
+
+}
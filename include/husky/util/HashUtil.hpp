@@ -0,0 +1,25 @@
+#pragma once
+
+#include <husky/Common.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace husky {
+
+class HUSKY_DLL HashUtil // 64-bit FNV-1a; stable between runs and builds, so usable for disk cache keys
+{
+public:
+  static constexpr std::uint64_t initialHash = 14695981039346656037ull;
+
+  static std::uint64_t hashBytes(const void *data, std::size_t size, std::uint64_t hash = initialHash);
+  static std::uint64_t hashString(const std::string &s, std::uint64_t hash = initialHash); // With terminator, so moving text between strings changes the hash
+
+  template<typename T>
+  static std::uint64_t hashValue(const T &value, std::uint64_t hash = initialHash) // Plain data only; padding bytes would make the hash unstable
+  {
+    return hashBytes(&value, sizeof(T), hash);
+  }
+};
+
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <husky/Common.hpp>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace husky {
+
+class HUSKY_DLL ThreadPool // Work-stealing thread pool
+{
+public:
+  static ThreadPool& global();
+
+  ThreadPool(int numThreads = -1); // -1 => One thread less than the number of hardware threads
+  ThreadPool(const ThreadPool &other) = delete;
+  ~ThreadPool();
+
+  int numThreads() const;
+  void parallelFor(int begin, int end, int grainSize, const std::function<void(int begin, int end)> &func); // Blocks until done; the calling thread participates
+
+private:
+  class Task
+  {
+  public:
+    const std::function<void(int, int)> *func;
+    int begin;
+    int end;
+    std::atomic<int> *remaining;
+  };
+
+  class TaskQueue
+  {
+  public:
+    std::mutex mutex;
+    std::deque<Task> tasks;
+  };
+
+  void workerMain(int iQueue);
+  void pushTask(int iQueue, const Task &task);
+  bool popTask(int iQueue, Task &task); // Newest task from own queue
+  bool stealTask(int iQueue, Task &task); // Oldest task from any other queue
+  void runTask(const Task &task);
+
+  std::vector<std::unique_ptr<TaskQueue>> queues; // Index 0 is shared by non-worker threads
+  std::vector<std::thread> threads;
+  std::mutex wakeMutex;
+  std::condition_variable wakeCondition;
+  std::atomic<int> pendingTaskCount;
+  bool stopping;
+};
+
+}
@@ -0,0 +1,410 @@
+#include <husky/image/BlockCompression.hpp>
+#include <husky/util/ThreadPool.hpp>
+#include <husky/Log.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <emmintrin.h> // SSE2; always available on x64
+
+namespace husky {
+
+static constexpr int blockTexels = 16;
+
+class BlockTexels // Structure of arrays, so four texels fit in one SSE register
+{
+public:
+  float c[4][blockTexels]; // Channel, texel
+};
+
+class BitWriter // Least significant bit first, as in BC7
+{
+public:
+  BitWriter(std::uint8_t *block, int numBytes) : block(block), pos(0) { std::memset(block, 0, numBytes); }
+
+  void write(std::uint32_t value, int numBits)
+  {
+    for (int i = 0; i < numBits; i++, pos++) {
+      block[pos >> 3] |= (std::uint8_t)(((value >> i) & 1) << (pos & 7));
+    }
+  }
+
+  std::uint8_t *block;
+  int pos;
+};
+
+static BlockTexels loadTexels(const std::uint8_t *rgba)
+{
+  BlockTexels texels;
+  for (int i = 0; i < blockTexels; i++) {
+    for (int c = 0; c < 4; c++) {
+      texels.c[c][i] = rgba[i * 4 + c];
+    }
+  }
+  return texels;
+}
+
+static void computePrincipalAxis(const BlockTexels &texels, int numChannels, float mean[4], float axis[4])
+{
+  for (int c = 0; c < 4; c++) {
+    mean[c] = 0.f;
+    axis[c] = 0.f;
+    if (c < numChannels) {
+      for (int i = 0; i < blockTexels; i++) {
+        mean[c] += texels.c[c][i];
+      }
+      mean[c] /= blockTexels;
+    }
+  }
+
+  float covariance[4][4] = {};
+  for (int i = 0; i < blockTexels; i++) {
+    for (int a = 0; a < numChannels; a++) {
+      for (int b = a; b < numChannels; b++) {
+        covariance[a][b] += (texels.c[a][i] - mean[a]) * (texels.c[b][i] - mean[b]);
+      }
+    }
+  }
+  for (int a = 0; a < numChannels; a++) {
+    for (int b = 0; b < a; b++) {
+      covariance[a][b] = covariance[b][a];
+    }
+  }
+
+  // Power iteration from the diagonal, which already points roughly along the spread
+  for (int c = 0; c < numChannels; c++) {
+    axis[c] = 1.f;
+  }
+  for (int iter = 0; iter < 8; iter++) {
+    float next[4] = {};
+    float len2 = 0.f;
+    for (int a = 0; a < numChannels; a++) {
+      for (int b = 0; b < numChannels; b++) {
+        next[a] += covariance[a][b] * axis[b];
+      }
+      len2 += next[a] * next[a];
+    }
+    if (len2 < 1e-12f) { // Uniform block
+      std::fill(axis, axis + 4, 0.f);
+      return;
+    }
+    const float invLen = 1.f / std::sqrt(len2);
+    for (int c = 0; c < numChannels; c++) {
+      axis[c] = next[c] * invLen;
+    }
+  }
+}
+
+static void projectTexels(const BlockTexels &texels, int numChannels, const float origin[4], const float dir[4], float proj[blockTexels])
+{
+  for (int i = 0; i < blockTexels; i += 4) {
+    __m128 dot = _mm_setzero_ps();
+    for (int c = 0; c < numChannels; c++) {
+      const __m128 d = _mm_sub_ps(_mm_loadu_ps(&texels.c[c][i]), _mm_set1_ps(origin[c]));
+      dot = _mm_add_ps(dot, _mm_mul_ps(d, _mm_set1_ps(dir[c])));
+    }
+    _mm_storeu_ps(&proj[i], dot);
+  }
+}
+
+static void fitEndpoints(const BlockTexels &texels, int numChannels, float e0[4], float e1[4]) // Extremes along the principal axis
+{
+  float mean[4], axis[4], proj[blockTexels];
+  computePrincipalAxis(texels, numChannels, mean, axis);
+  projectTexels(texels, numChannels, mean, axis, proj);
+
+  const float minProj = *std::min_element(proj, proj + blockTexels);
+  const float maxProj = *std::max_element(proj, proj + blockTexels);
+  for (int c = 0; c < 4; c++) {
+    e0[c] = std::min(std::max(mean[c] + axis[c] * minProj, 0.f), 255.f);
+    e1[c] = std::min(std::max(mean[c] + axis[c] * maxProj, 0.f), 255.f);
+  }
+}
+
+static void fitLevels(const BlockTexels &texels, int numChannels, const float e0[4], const float e1[4], int numLevels, int levels[blockTexels]) // Nearest of numLevels evenly spaced points from e0 to e1
+{
+  float dir[4] = {};
+  float len2 = 0.f;
+  for (int c = 0; c < numChannels; c++) {
+    dir[c] = e1[c] - e0[c];
+    len2 += dir[c] * dir[c];
+  }
+  if (len2 < 1e-6f) {
+    std::fill(levels, levels + blockTexels, 0);
+    return;
+  }
+
+  float proj[blockTexels];
+  projectTexels(texels, numChannels, e0, dir, proj);
+
+  const __m128 scale = _mm_set1_ps((numLevels - 1) / len2);
+  const __m128 maxLevel = _mm_set1_ps((float)(numLevels - 1));
+  for (int i = 0; i < blockTexels; i += 4) {
+    const __m128 level = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(&proj[i]), scale), _mm_setzero_ps()), maxLevel);
+    _mm_storeu_si128((__m128i*)&levels[i], _mm_cvtps_epi32(level)); // Rounds to nearest
+  }
+}
+
+static std::uint16_t packRgb565(const float rgb[3])
+{
+  const int r = (int)std::lround(rgb[0] * 31.f / 255.f);
+  const int g = (int)std::lround(rgb[1] * 63.f / 255.f);
+  const int b = (int)std::lround(rgb[2] * 31.f / 255.f);
+  return (std::uint16_t)((r << 11) | (g << 5) | b);
+}
+
+static void unpackRgb565(std::uint16_t c, float rgb[4])
+{
+  const int r = (c >> 11) & 31;
+  const int g = (c >> 5) & 63;
+  const int b = c & 31;
+  rgb[0] = (float)((r << 3) | (r >> 2));
+  rgb[1] = (float)((g << 2) | (g >> 4));
+  rgb[2] = (float)((b << 3) | (b >> 2));
+  rgb[3] = 0.f;
+}
+
+void BlockEncoder::encodeBC1(const std::uint8_t *rgba, std::uint8_t *block)
+{
+  const BlockTexels texels = loadTexels(rgba);
+  float e0[4], e1[4];
+  fitEndpoints(texels, 3, e0, e1);
+
+  std::uint16_t c0 = packRgb565(e1);
+  std::uint16_t c1 = packRgb565(e0);
+  if (c0 < c1) { // c0 > c1 selects the four-color mode
+    std::swap(c0, c1);
+  }
+
+  std::uint32_t indices = 0;
+  if (c0 != c1) {
+    float q0[4], q1[4];
+    unpackRgb565(c0, q0);
+    unpackRgb565(c1, q1);
+    int levels[blockTexels];
+    fitLevels(texels, 3, q0, q1, 4, levels);
+    static const std::uint32_t levelToIndex[4] = { 0, 2, 3, 1 }; // Palette order is c0, c1, 2/3 c0 + 1/3 c1, 1/3 c0 + 2/3 c1
+    for (int i = 0; i < blockTexels; i++) {
+      indices |= levelToIndex[levels[i]] << (i * 2);
+    }
+  }
+
+  block[0] = (std::uint8_t)(c0 & 0xFF);
+  block[1] = (std::uint8_t)(c0 >> 8);
+  block[2] = (std::uint8_t)(c1 & 0xFF);
+  block[3] = (std::uint8_t)(c1 >> 8);
+  for (int i = 0; i < 4; i++) {
+    block[4 + i] = (std::uint8_t)(indices >> (i * 8));
+  }
+}
+
+void BlockEncoder::encodeBC4(const std::uint8_t *rgba, int channel, std::uint8_t *block)
+{
+  int minValue = 255;
+  int maxValue = 0;
+  for (int i = 0; i < blockTexels; i++) {
+    minValue = std::min(minValue, (int)rgba[i * 4 + channel]);
+    maxValue = std::max(maxValue, (int)rgba[i * 4 + channel]);
+  }
+
+  BitWriter writer(block, 8);
+  writer.write(maxValue, 8); // a0 > a1 selects eight interpolated values
+  writer.write(minValue, 8);
+
+  if (maxValue == minValue) { // All indices 0
+    return;
+  }
+
+  static const std::uint32_t levelToIndex[8] = { 0, 2, 3, 4, 5, 6, 7, 1 }; // Palette order is a0, a1, then from a0 towards a1
+  const float scale = 7.f / (maxValue - minValue);
+  for (int i = 0; i < blockTexels; i++) {
+    const int level = (int)std::lround((maxValue - rgba[i * 4 + channel]) * scale);
+    writer.write(levelToIndex[level], 3);
+  }
+}
+
+void BlockEncoder::encodeBC3(const std::uint8_t *rgba, std::uint8_t *block)
+{
+  encodeBC4(rgba, 3, block);
+  encodeBC1(rgba, block + 8);
+}
+
+void BlockEncoder::encodeBC5(const std::uint8_t *rgba, std::uint8_t *block)
+{
+  encodeBC4(rgba, 0, block);
+  encodeBC4(rgba, 1, block + 8);
+}
+
+static void quantizeBC7Mode6(const float e[4], int q[4], int &pBit) // 7 bits per channel and a shared least significant bit
+{
+  float bestError = 1e30f;
+  for (int p = 0; p < 2; p++) {
+    int candidate[4];
+    float error = 0.f;
+    for (int c = 0; c < 4; c++) {
+      candidate[c] = std::min(std::max((int)std::lround((e[c] - p) * 0.5f), 0), 127);
+      const float diff = (float)(candidate[c] * 2 + p) - e[c];
+      error += diff * diff;
+    }
+    if (error < bestError) {
+      bestError = error;
+      pBit = p;
+      std::copy(candidate, candidate + 4, q);
+    }
+  }
+}
+
+void BlockEncoder::encodeBC7(const std::uint8_t *rgba, std::uint8_t *block)
+{
+  static const int nearestWeight[65] = { // Index of the nearest mode 6 weight (0, 4, 9, 13, ..., 64) to 0..64
+    0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 6, 6, 6, 6, 6, 7, 7, 7, 7,
+    8, 8, 8, 8, 9, 9, 9, 9, 10, 10, 10, 10, 10, 11, 11, 11, 11, 12, 12, 12, 12, 13, 13, 13, 13, 14, 14, 14, 14, 14, 15, 15,
+  };
+
+  const BlockTexels texels = loadTexels(rgba);
+  float e0[4], e1[4];
+  fitEndpoints(texels, 4, e0, e1);
+
+  int q0[4], q1[4];
+  int p0 = 0, p1 = 0;
+  quantizeBC7Mode6(e0, q0, p0);
+  quantizeBC7Mode6(e1, q1, p1);
+
+  float d0[4], d1[4];
+  for (int c = 0; c < 4; c++) {
+    d0[c] = (float)(q0[c] * 2 + p0);
+    d1[c] = (float)(q1[c] * 2 + p1);
+  }
+
+  int levels[blockTexels];
+  fitLevels(texels, 4, d0, d1, 65, levels); // Weight units, then the nearest actual weight
+  int indices[blockTexels];
+  for (int i = 0; i < blockTexels; i++) {
+    indices[i] = nearestWeight[levels[i]];
+  }
+
+  if (indices[0] & 8) { // The anchor index has an implicit 0 in its most significant bit
+    std::swap(q0, q1);
+    std::swap(p0, p1);
+    for (int &index : indices) {
+      index = 15 - index;
+    }
+  }
+
+  BitWriter writer(block, 16);
+  writer.write(1 << 6, 7); // Mode 6
+  for (int c = 0; c < 4; c++) {
+    writer.write(q0[c], 7);
+    writer.write(q1[c], 7);
+  }
+  writer.write(p0, 1);
+  writer.write(p1, 1);
+  writer.write(indices[0], 3);
+  for (int i = 1; i < blockTexels; i++) {
+    writer.write(indices[i], 4);
+  }
+}
+
+static void encodeBlock(BlockFormat format, const std::uint8_t *rgba, std::uint8_t *block)
+{
+  switch (format) {
+  case BlockFormat::BC1: { BlockEncoder::encodeBC1(rgba, block); break; }
+  case BlockFormat::BC3: { BlockEncoder::encodeBC3(rgba, block); break; }
+  case BlockFormat::BC4: { BlockEncoder::encodeBC4(rgba, 0, block); break; }
+  case BlockFormat::BC5: { BlockEncoder::encodeBC5(rgba, block); break; }
+  case BlockFormat::BC7: { BlockEncoder::encodeBC7(rgba, block); break; }
+  }
+}
+
+CompressedImage CompressedImage::compress(const Image &image, BlockFormat format, bool mipmaps, ThreadPool &threadPool)
+{
+  CompressedImage compressed;
+  if (!image.valid() || (image.format != ImageFormat::RGB8 && image.format != ImageFormat::RGBA8)) {
+    Log::warning("Unsupported image format for block compression: %d", (int)image.format);
+    return compressed;
+  }
+
+  compressed.format = format;
+  compressed.width = image.width;
+  compressed.height = image.height;
+
+  std::vector<Image> mipmapImages;
+  if (mipmaps) { // Gamma-correct for color formats; BC4 and BC5 usually hold linear data such as masks and normals
+    const bool srgb = (format == BlockFormat::BC1 || format == BlockFormat::BC3 || format == BlockFormat::BC7);
+    mipmapImages = image.generateMipmaps(ResampleFilter::KAISER, srgb, threadPool);
+  }
+
+  const int blockBytes = getBlockBytes(format);
+  std::vector<std::uint8_t> rgba;
+
+  for (int level = 0; level <= (int)mipmapImages.size(); level++) {
+    const Image &levelImage = (level == 0 ? image : mipmapImages[level - 1]);
+    const int levelWidth = levelImage.width;
+    const int levelHeight = levelImage.height;
+    rgba.resize(std::size_t(levelWidth) * levelHeight * 4);
+    for (int i = 0; i < levelWidth * levelHeight; i++) {
+      for (int c = 0; c < 4; c++) {
+        rgba[i * 4 + c] = (c < levelImage.numBytesPerPixel ? levelImage.data()[i * levelImage.numBytesPerPixel + c] : 255);
+      }
+    }
+
+    const int blocksX = (levelWidth + 3) / 4;
+    const int blocksY = (levelHeight + 3) / 4;
+    compressed.levels.emplace_back(blocksX * blocksY * blockBytes);
+    std::uint8_t *levelBlocks = compressed.levels.back().data();
+
+    threadPool.parallelFor(0, blocksY, 1, [&](int begin, int end) {
+      std::uint8_t texels[blockTexels * 4];
+      for (int by = begin; by < end; by++) {
+        for (int bx = 0; bx < blocksX; bx++) {
+          for (int i = 0; i < blockTexels; i++) { // Edge blocks repeat the last row and column
+            const int x = std::min(bx * 4 + (i & 3), levelWidth - 1);
+            const int y = std::min(by * 4 + (i >> 2), levelHeight - 1);
+            std::memcpy(&texels[i * 4], &rgba[(y * levelWidth + x) * 4], 4);
+          }
+          encodeBlock(format, texels, levelBlocks + (by * blocksX + bx) * blockBytes);
+        }
+      }
+    });
+  }
+
+  return compressed;
+}
+
+int CompressedImage::getBlockBytes(BlockFormat format)
+{
+  return ((format == BlockFormat::BC1 || format == BlockFormat::BC4) ? 8 : 16);
+}
+
+CompressedImage::CompressedImage()
+  : format(BlockFormat::BC1)
+  , width(0)
+  , height(0)
+  , levels()
+{
+}
+
+bool CompressedImage::valid() const
+{
+  return !levels.empty();
+}
+
+int CompressedImage::getLevelWidth(int level) const
+{
+  return std::max(width >> level, 1);
+}
+
+int CompressedImage::getLevelHeight(int level) const
+{
+  return std::max(height >> level, 1);
+}
+
+std::size_t CompressedImage::numBytesTotal() const
+{
+  std::size_t numBytes = 0;
+  for (const std::vector<std::uint8_t> &level : levels) {
+    numBytes += level.size();
+  }
+  return numBytes;
+}
+
+}
@@ -1,6 +1,11 @@
 #include <husky/image/Image.hpp>
 #include <husky/Log.hpp>
+#include <husky/math/Math.hpp>
 #include <husky/util/StringUtil.hpp>
+#include <husky/util/ThreadPool.hpp>
+#include <algorithm>
+#include <cmath>
+#include <emmintrin.h>
 #include <filesystem>
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
@@ -53,6 +58,7 @@ static constexpr int getBytesPerPixel(ImageFormat format)
   switch (format) {
   case ImageFormat::RGB8      : return 3;
   case ImageFormat::RGBA8     : return 4;
+  case ImageFormat::RGBA32F   : return 16;
   case ImageFormat::UNDEFINED : return 0;
   default                     : return 0;
   }
@@ -73,6 +79,11 @@ Image::Image(int width, int height, ImageFormat format, std::uint8_t *stbBytes)
 
 bool Image::save(const std::string &filePath) const
 {
+  if (format != ImageFormat::RGB8 && format != ImageFormat::RGBA8) {
+    Log::warning("Unsupported image format for saving: %d", (int)format);
+    return false;
+  }
+
   const auto f = fs::u8path(filePath);
   const auto p = f.parent_path();
   if (!fs::is_directory(p) && !fs::create_directories(p)) {
@@ -113,6 +124,277 @@ bool Image::valid() const
   return (width > 0 && height > 0 && format != ImageFormat::UNDEFINED && numBytesPerPixel > 0 && numBytesTotal > 0 && bytes != nullptr);
 }
 
+Image Image::downsample() const
+{
+  if (format != ImageFormat::RGB8 && format != ImageFormat::RGBA8) {
+    Log::warning("Unsupported image format for downsampling: %d", (int)format);
+    return {};
+  }
+
+  Image dst(std::max(width / 2, 1), std::max(height / 2, 1), format);
+  for (int y = 0; y < dst.height; y++) {
+    const int y0 = std::min(y * 2, height - 1);
+    const int y1 = std::min(y * 2 + 1, height - 1); // Odd sizes repeat the last row and column
+    for (int x = 0; x < dst.width; x++) {
+      const int x0 = std::min(x * 2, width - 1);
+      const int x1 = std::min(x * 2 + 1, width - 1);
+      for (int c = 0; c < numBytesPerPixel; c++) {
+        const int sum
+          = bytes[(size_t(y0) * width + x0) * numBytesPerPixel + c]
+          + bytes[(size_t(y0) * width + x1) * numBytesPerPixel + c]
+          + bytes[(size_t(y1) * width + x0) * numBytesPerPixel + c]
+          + bytes[(size_t(y1) * width + x1) * numBytesPerPixel + c];
+        dst.bytes[(size_t(y) * dst.width + x) * numBytesPerPixel + c] = (std::uint8_t)((sum + 2) / 4);
+      }
+    }
+  }
+  return dst;
+}
+
+static double bessel0(double x) // Modified Bessel function of the first kind, order 0
+{
+  double sum = 1.0, term = 1.0;
+  for (int k = 1; k < 32 && term > sum * 1e-12; k++) {
+    term *= (x * x) / (4.0 * k * k);
+    sum += term;
+  }
+  return sum;
+}
+
+static double kaiser(double x) // Width 3, alpha 4, like common texture tools
+{
+  static constexpr double radius = 3.0;
+  static constexpr double alpha = 4.0;
+  if (std::abs(x) >= radius) {
+    return 0.0;
+  }
+  const double sinc = (x == 0.0 ? 1.0 : std::sin(Math::pi * x) / (Math::pi * x));
+  const double t = x / radius;
+  return sinc * bessel0(alpha * std::sqrt(1.0 - t * t)) / bessel0(alpha);
+}
+
+class ResampleWeights // Contributions of source texels to each destination texel along one axis
+{
+public:
+  ResampleWeights(int srcSize, int dstSize, ResampleFilter filter)
+    : first(dstSize)
+    , count(dstSize)
+    , maxTaps(0)
+    , weights()
+  {
+    const double scale = double(srcSize) / dstSize;
+    const double filterScale = std::max(scale, 1.0); // Widened when downsampling, so it also removes frequencies the destination cannot hold
+    const double radius = (filter == ResampleFilter::BOX ? 0.5 : 3.0) * filterScale;
+    maxTaps = (int)std::ceil(radius * 2.0) + 2;
+    weights.resize(std::size_t(dstSize) * maxTaps, 0.f);
+
+    for (int i = 0; i < dstSize; i++) {
+      const double center = (i + 0.5) * scale; // Texel j spans [j, j + 1)
+      const int lo = (int)std::floor(center - radius);
+      const int hi = (int)std::ceil(center + radius);
+      first[i] = std::min(std::max(lo, 0), srcSize - 1);
+      count[i] = std::min(std::max(hi - 1, 0), srcSize - 1) - first[i] + 1;
+
+      float *w = &weights[std::size_t(i) * maxTaps];
+      double sum = 0.0;
+      for (int j = lo; j < hi; j++) {
+        const double weight = (filter == ResampleFilter::BOX
+          ? std::max(std::min(j + 1.0, center + radius) - std::max(double(j), center - radius), 0.0) // Overlap with the filter box
+          : kaiser((j + 0.5 - center) / filterScale));
+        w[std::min(std::max(j, 0), srcSize - 1) - first[i]] += (float)weight; // Clamp to edge
+        sum += weight;
+      }
+      for (int k = 0; k < count[i]; k++) {
+        w[k] = (float)(w[k] / sum);
+      }
+    }
+  }
+
+  std::vector<int> first;
+  std::vector<int> count;
+  int maxTaps;
+  std::vector<float> weights; // maxTaps per destination texel
+};
+
+static const float* getDecodeTable(bool srgb) // Byte => Linear value
+{
+  static const std::vector<float> tables = []() {
+    std::vector<float> t(512);
+    for (int i = 0; i < 256; i++) {
+      const double v = i / 255.0;
+      t[i] = (float)v;
+      t[256 + i] = (float)(v <= 0.04045 ? v / 12.92 : std::pow((v + 0.055) / 1.055, 2.4));
+    }
+    return t;
+  }();
+  return &tables[srgb ? 256 : 0];
+}
+
+static constexpr int encodeTableSize = 1 << 14; // Fine enough to round dark sRGB values correctly
+
+static const std::uint8_t* getEncodeTable() // Linear value * (encodeTableSize - 1) => sRGB byte
+{
+  static const std::vector<std::uint8_t> table = []() {
+    std::vector<std::uint8_t> t(encodeTableSize);
+    for (int i = 0; i < encodeTableSize; i++) {
+      const double v = double(i) / (encodeTableSize - 1);
+      const double s = (v <= 0.0031308 ? v * 12.92 : 1.055 * std::pow(v, 1.0 / 2.4) - 0.055);
+      t[i] = (std::uint8_t)std::lround(s * 255.0);
+    }
+    return t;
+  }();
+  return table.data();
+}
+
+static void decodeRow(const Image &image, int y, bool srgb, float *dst) // Four floats per texel; RGB8 gets alpha 1
+{
+  const float *color = getDecodeTable(srgb);
+  const float *linear = getDecodeTable(false);
+  const std::uint8_t *src = image.data() + std::size_t(y) * image.width * image.numBytesPerPixel;
+  if (image.numBytesPerPixel == 4) {
+    for (int x = 0; x < image.width; x++, src += 4, dst += 4) {
+      _mm_storeu_ps(dst, _mm_setr_ps(color[src[0]], color[src[1]], color[src[2]], linear[src[3]]));
+    }
+  }
+  else {
+    for (int x = 0; x < image.width; x++, src += 3, dst += 4) {
+      _mm_storeu_ps(dst, _mm_setr_ps(color[src[0]], color[src[1]], color[src[2]], 1.f));
+    }
+  }
+}
+
+static void encodeRow(const float *src, bool srgb, Image &image, int y)
+{
+  const std::uint8_t *encodeTable = getEncodeTable();
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 one = _mm_set1_ps(1.f);
+  const __m128 scale = (srgb ? _mm_setr_ps(encodeTableSize - 1.f, encodeTableSize - 1.f, encodeTableSize - 1.f, 255.f) : _mm_set1_ps(255.f));
+  const int numBytesPerPixel = image.numBytesPerPixel;
+  std::uint8_t *dst = image.data() + std::size_t(y) * image.width * numBytesPerPixel;
+  alignas(16) std::int32_t q[4];
+  for (int x = 0; x < image.width; x++, src += 4, dst += numBytesPerPixel) {
+    const __m128 v = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(src), zero), one); // The Kaiser filter can overshoot
+    _mm_store_si128(reinterpret_cast<__m128i*>(q), _mm_cvtps_epi32(_mm_mul_ps(v, scale)));
+    if (srgb) {
+      dst[0] = encodeTable[q[0]];
+      dst[1] = encodeTable[q[1]];
+      dst[2] = encodeTable[q[2]];
+    }
+    else {
+      dst[0] = (std::uint8_t)q[0];
+      dst[1] = (std::uint8_t)q[1];
+      dst[2] = (std::uint8_t)q[2];
+    }
+    if (numBytesPerPixel == 4) {
+      dst[3] = (std::uint8_t)q[3];
+    }
+  }
+}
+
+Image Image::resize(int newWidth, int newHeight, ResampleFilter filter, bool srgb, ThreadPool &threadPool) const
+{
+  if (format != ImageFormat::RGB8 && format != ImageFormat::RGBA8) {
+    Log::warning("Unsupported image format for resizing: %d", (int)format);
+    return {};
+  }
+  if (!valid() || newWidth <= 0 || newHeight <= 0) {
+    return {};
+  }
+
+  Image dst(newWidth, newHeight, format);
+  const ResampleWeights weightsX(width, newWidth, filter);
+  const ResampleWeights weightsY(height, newHeight, filter);
+
+  // Tasks are bands of destination rows; source rows are filtered horizontally into a small ring as the band's vertical filter reaches them
+  const int grainSize = std::max(16, (1 << 16) / newWidth);
+  threadPool.parallelFor(0, newHeight, grainSize, [&](int begin, int end) {
+    const std::size_t dstRowFloats = std::size_t(newWidth) * 4;
+    std::vector<float> srcRow(std::size_t(width) * 4);
+    std::vector<float> rows(weightsY.maxTaps * dstRowFloats);
+    std::vector<float> dstRow(dstRowFloats);
+    int nextSrcRow = weightsY.first[begin];
+
+    for (int y = begin; y < end; y++) {
+      for (; nextSrcRow < weightsY.first[y] + weightsY.count[y]; nextSrcRow++) {
+        decodeRow(*this, nextSrcRow, srgb, srcRow.data());
+        float *row = &rows[(nextSrcRow % weightsY.maxTaps) * dstRowFloats];
+        for (int x = 0; x < newWidth; x++) {
+          const float *w = &weightsX.weights[std::size_t(x) * weightsX.maxTaps];
+          const float *src = &srcRow[std::size_t(weightsX.first[x]) * 4];
+          __m128 acc = _mm_mul_ps(_mm_set1_ps(w[0]), _mm_loadu_ps(src));
+          for (int k = 1; k < weightsX.count[x]; k++) {
+            acc = _mm_add_ps(acc, _mm_mul_ps(_mm_set1_ps(w[k]), _mm_loadu_ps(src + k * 4)));
+          }
+          _mm_storeu_ps(row + x * 4, acc);
+        }
+      }
+
+      const float *w = &weightsY.weights[std::size_t(y) * weightsY.maxTaps];
+      for (int k = 0; k < weightsY.count[y]; k++) {
+        const __m128 weight = _mm_set1_ps(w[k]);
+        const float *row = &rows[((weightsY.first[y] + k) % weightsY.maxTaps) * dstRowFloats];
+        if (k == 0) {
+          for (std::size_t i = 0; i < dstRowFloats; i += 4) {
+            _mm_storeu_ps(&dstRow[i], _mm_mul_ps(weight, _mm_loadu_ps(row + i)));
+          }
+        }
+        else {
+          for (std::size_t i = 0; i < dstRowFloats; i += 4) {
+            _mm_storeu_ps(&dstRow[i], _mm_add_ps(_mm_loadu_ps(&dstRow[i]), _mm_mul_ps(weight, _mm_loadu_ps(row + i))));
+          }
+        }
+      }
+      encodeRow(dstRow.data(), srgb, dst, y);
+    }
+  });
+
+  return dst;
+}
+
+std::vector<Image> Image::generateMipmaps(ResampleFilter filter, bool srgb, ThreadPool &threadPool) const
+{
+  std::vector<Image> levels;
+  if (format != ImageFormat::RGB8 && format != ImageFormat::RGBA8) {
+    Log::warning("Unsupported image format for mipmaps: %d", (int)format);
+    return levels;
+  }
+
+  int numLevels = 0;
+  while ((std::max(width, height) >> numLevels) > 1) {
+    numLevels++;
+  }
+  levels.reserve(numLevels);
+
+  // From the previous level rather than level 0; rounding to bytes in between costs far less than filtering 8k texels per level
+  for (int level = 1; level <= numLevels; level++) {
+    const Image &prev = (level == 1 ? *this : levels.back());
+    Image next = prev.resize(std::max(width >> level, 1), std::max(height >> level, 1), filter, srgb, threadPool);
+    levels.emplace_back(std::move(next));
+  }
+
+  return levels;
+}
+
+void Image::premultiplyAlpha(bool srgb, ThreadPool &threadPool)
+{
+  if (format != ImageFormat::RGBA8) {
+    Log::warning("Unsupported image format for premultiplying alpha: %d", (int)format);
+    return;
+  }
+
+  threadPool.parallelFor(0, height, std::max(1, (1 << 16) / std::max(width, 1)), [&](int begin, int end) {
+    std::vector<float> row(std::size_t(width) * 4);
+    for (int y = begin; y < end; y++) {
+      decodeRow(*this, y, srgb, row.data());
+      for (int x = 0; x < width; x++) {
+        const float a = row[x * 4 + 3];
+        _mm_storeu_ps(&row[x * 4], _mm_mul_ps(_mm_loadu_ps(&row[x * 4]), _mm_setr_ps(a, a, a, 1.f)));
+      }
+      encodeRow(row.data(), srgb, *this, y);
+    }
+  });
+}
+
 const std::uint8_t* Image::data() const
 {
   return bytes;
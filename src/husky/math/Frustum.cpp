@@ -31,6 +31,11 @@ Frustum::Frustum(const Matrix44d &mtxProjection, const Matrix44d &mtxModelView)
 {
 }
 
+const Vector4d& Frustum::getClippingPlane(int i) const
+{
+  return clippingPlanes[i];
+}
+
 double Frustum::getPointDistToPlane(const Vector3d &pt, const Vector4d &plane)
 {
   return (plane.xyz.dot(pt) + plane.w);
@@ -1,6 +1,9 @@
 #include <husky/mesh/Animation.hpp>
 #include <husky/mesh/Model.hpp>
+#include <husky/math/Math.hpp>
 #include <husky/Log.hpp>
+#include <algorithm>
+#include <cmath>
 
 namespace husky {
 
@@ -9,6 +12,337 @@ AnimationChannel::AnimationChannel(const std::string &nodeName)
 {
 }
 
+AnimationCompressionSettings::AnimationCompressionSettings()
+  : AnimationCompressionSettings(1e-4, 1e-4, 1e-4)
+{
+}
+
+AnimationCompressionSettings::AnimationCompressionSettings(double maxPositionError, double maxRotationError, double maxScaleError)
+  : maxPositionError(maxPositionError)
+  , maxRotationError(maxRotationError)
+  , maxScaleError(maxScaleError)
+{
+}
+
+static double getRotationError(const Quaterniond &a, const Quaterniond &b)
+{
+  const double d = std::min(std::abs(a.dot(b)), 1.0); // Note: q and -q represent the same rotation
+  return 2.0 * std::acos(d);
+}
+
+// Returns the indices of the keyframes that have to be kept to reproduce all keyframes within maxError.
+// Kept keyframes are interpolated as quantizedValues, so quantization error counts against maxError too.
+template<typename T, typename InterpFunc, typename ErrorFunc>
+static std::vector<int> reduceKeyframes(const std::vector<double> &ticks, const std::vector<T> &values, const std::vector<T> &quantizedValues, double maxError, InterpFunc interp, ErrorFunc error)
+{
+  const int numKeys = (int)ticks.size();
+  std::vector<int> keep;
+
+  if (numKeys <= 2) {
+    for (int iKey = 0; iKey < numKeys; iKey++) {
+      keep.emplace_back(iKey);
+    }
+    return keep;
+  }
+
+  int iAnchor = 0;
+  keep.emplace_back(iAnchor);
+
+  for (int iEnd = 2; iEnd < numKeys; iEnd++) {
+    // Check if all keyframes between anchor and end can be interpolated
+    bool ok = true;
+    for (int iKey = iAnchor + 1; iKey < iEnd && ok; iKey++) {
+      const double t = (ticks[iKey] - ticks[iAnchor]) / (ticks[iEnd] - ticks[iAnchor]);
+      ok = (error(interp(quantizedValues[iAnchor], quantizedValues[iEnd], t), values[iKey]) <= maxError);
+    }
+
+    if (!ok) {
+      iAnchor = (iEnd - 1);
+      keep.emplace_back(iAnchor);
+    }
+  }
+
+  keep.emplace_back(numKeys - 1);
+  return keep;
+}
+
+static CompressedVector3Track compressVector3Track(const std::map<double, Vector3d> &keyframes, double maxError)
+{
+  CompressedVector3Track track;
+
+  if (keyframes.empty()) {
+    return track;
+  }
+
+  std::vector<double> ticks;
+  std::vector<Vector3d> values;
+  ticks.reserve(keyframes.size());
+  values.reserve(keyframes.size());
+  for (const auto &pair : keyframes) {
+    ticks.emplace_back(pair.first);
+    values.emplace_back(pair.second);
+  }
+
+  const auto error = [](const Vector3d &a, const Vector3d &b) { return (a - b).length(); };
+
+  // Constant track?
+  const bool constant = std::all_of(values.begin(), values.end(), [&](const Vector3d &v) { return error(v, values.front()) <= maxError; });
+  if (constant) {
+    track.constant = true;
+    track.constValue = (Vector3f)values.front();
+    return track;
+  }
+
+  // Quantize relative to the range of all keyframes, which contains the range of the kept ones
+  Vector3d rangeMin = values.front();
+  Vector3d rangeMax = rangeMin;
+  for (const Vector3d &value : values) {
+    for (int i = 0; i < 3; i++) {
+      rangeMin[i] = std::min(rangeMin[i], value[i]);
+      rangeMax[i] = std::max(rangeMax[i], value[i]);
+    }
+  }
+
+  track.rangeMin = (Vector3f)rangeMin;
+  track.rangeExtent = (Vector3f)(rangeMax - rangeMin);
+
+  const auto quantize = [&](const Vector3d &value, std::uint16_t *words) {
+    for (int i = 0; i < 3; i++) {
+      const double extent = track.rangeExtent[i];
+      const double n = (extent > 0.0 ? ((value[i] - track.rangeMin[i]) / extent) : 0.0); // [0,1]
+      words[i] = (std::uint16_t)std::lround(Math::clamp(n, 0.0, 1.0) * 65535.0);
+    }
+  };
+
+  std::vector<Vector3d> quantizedValues;
+  quantizedValues.reserve(values.size());
+  for (const Vector3d &value : values) {
+    std::uint16_t q[3];
+    quantize(value, q);
+    quantizedValues.emplace_back((Vector3d)track.rangeMin + (Vector3d)track.rangeExtent * (Vector3d(q[0], q[1], q[2]) * (1.0 / 65535.0))); // As getKeyValue()
+  }
+
+  const std::vector<int> keep = reduceKeyframes(ticks, values, quantizedValues, maxError,
+    [](const Vector3d &a, const Vector3d &b, double t) { return a.lerp(b, t); }, error);
+
+  track.keyTicks.reserve(keep.size());
+  track.keyValues.resize(keep.size() * 3);
+  for (int i = 0; i < (int)keep.size(); i++) {
+    track.keyTicks.emplace_back((float)ticks[keep[i]]);
+    quantize(values[keep[i]], &track.keyValues[i * 3]);
+  }
+
+  return track;
+}
+
+static constexpr double quatComponentMax = 0.70710678118654752440; // 1/sqrt(2); max abs value of the three smallest components
+
+static void encodeQuaternion(Quaterniond q, std::uint16_t *words)
+{
+  q.normalize();
+  double c[4] = { q.x, q.y, q.z, q.w };
+
+  int iLargest = 0;
+  for (int i = 1; i < 4; i++) {
+    if (std::abs(c[i]) > std::abs(c[iLargest])) {
+      iLargest = i;
+    }
+  }
+
+  const double sign = (c[iLargest] < 0.0 ? -1.0 : 1.0); // Make largest component positive, so it can be reconstructed
+
+  int iWord = 0;
+  for (int i = 0; i < 4; i++) {
+    if (i != iLargest) {
+      const double n = Math::clamp(sign * c[i] / quatComponentMax * 0.5 + 0.5, 0.0, 1.0); // [0,1]
+      words[iWord++] = (std::uint16_t)std::lround(n * 32767.0); // 15 bits
+    }
+  }
+
+  // Store largest component index in the two spare high bits
+  words[0] |= (std::uint16_t)((iLargest >> 1) << 15);
+  words[1] |= (std::uint16_t)((iLargest & 1) << 15);
+}
+
+static Quaterniond decodeQuaternion(const std::uint16_t *words)
+{
+  const int iLargest = ((words[0] >> 15) << 1) | (words[1] >> 15);
+
+  double c[4];
+  double sum2 = 0.0;
+  int iWord = 0;
+  for (int i = 0; i < 4; i++) {
+    if (i != iLargest) {
+      const double n = (words[iWord++] & 0x7FFF) / 32767.0; // [0,1]
+      c[i] = (n * 2.0 - 1.0) * quatComponentMax;
+      sum2 += c[i] * c[i];
+    }
+  }
+  c[iLargest] = std::sqrt(std::max(0.0, 1.0 - sum2));
+
+  return { c[0], c[1], c[2], c[3] };
+}
+
+static CompressedQuaternionTrack compressQuaternionTrack(const std::map<double, Quaterniond> &keyframes, double maxError)
+{
+  CompressedQuaternionTrack track;
+
+  if (keyframes.empty()) {
+    return track;
+  }
+
+  std::vector<double> ticks;
+  std::vector<Quaterniond> values;
+  ticks.reserve(keyframes.size());
+  values.reserve(keyframes.size());
+  for (const auto &pair : keyframes) {
+    ticks.emplace_back(pair.first);
+    values.emplace_back(pair.second.normalized());
+  }
+
+  // Constant track?
+  const bool constant = std::all_of(values.begin(), values.end(), [&](const Quaterniond &q) { return getRotationError(q, values.front()) <= maxError; });
+  if (constant) {
+    track.constant = true;
+    track.constValue = (Quaternionf)values.front();
+    return track;
+  }
+
+  std::vector<Quaterniond> quantizedValues;
+  quantizedValues.reserve(values.size());
+  for (const Quaterniond &q : values) {
+    std::uint16_t words[3];
+    encodeQuaternion(q, words);
+    quantizedValues.emplace_back(decodeQuaternion(words));
+  }
+
+  const std::vector<int> keep = reduceKeyframes(ticks, values, quantizedValues, maxError,
+    [](const Quaterniond &a, const Quaterniond &b, double t) { return a.slerp(b, t); }, getRotationError);
+
+  track.keyTicks.reserve(keep.size());
+  track.keyValues.resize(keep.size() * 3);
+
+  for (int i = 0; i < (int)keep.size(); i++) {
+    track.keyTicks.emplace_back((float)ticks[keep[i]]);
+    encodeQuaternion(values[keep[i]], &track.keyValues[i * 3]);
+  }
+
+  return track;
+}
+
+// Finds the keyframe pair surrounding ticks; same semantics as the uncompressed std::map::upper_bound() lookup
+static void findKeyframes(const std::vector<float> &keyTicks, double ticks, int &iKey0, int &iKey1, double &t)
+{
+  const auto it = std::upper_bound(keyTicks.begin(), keyTicks.end(), (float)ticks);
+  iKey1 = (int)(it - keyTicks.begin());
+
+  if (iKey1 == 0) {
+    iKey0 = iKey1;
+    t = 0.0;
+  }
+  else if (iKey1 == (int)keyTicks.size()) {
+    iKey0 = iKey1 = (iKey1 - 1);
+    t = 0.0;
+  }
+  else {
+    iKey0 = (iKey1 - 1);
+    t = (ticks - keyTicks[iKey0]) / (keyTicks[iKey1] - keyTicks[iKey0]);
+  }
+}
+
+CompressedVector3Track::CompressedVector3Track()
+  : keyTicks()
+  , keyValues()
+  , rangeMin(0, 0, 0)
+  , rangeExtent(0, 0, 0)
+  , constValue(0, 0, 0)
+  , constant(false)
+{
+}
+
+bool CompressedVector3Track::empty() const
+{
+  return (!constant && keyTicks.empty());
+}
+
+Vector3d CompressedVector3Track::sample(double ticks, const Vector3d &defaultValue) const
+{
+  if (constant) {
+    return (Vector3d)constValue;
+  }
+
+  if (keyTicks.empty()) {
+    return defaultValue;
+  }
+
+  int iKey0, iKey1;
+  double t;
+  findKeyframes(keyTicks, ticks, iKey0, iKey1, t);
+  return (iKey0 == iKey1 ? getKeyValue(iKey0) : getKeyValue(iKey0).lerp(getKeyValue(iKey1), t));
+}
+
+size_t CompressedVector3Track::getByteCount() const
+{
+  return (keyTicks.size() * sizeof(float) + keyValues.size() * sizeof(std::uint16_t));
+}
+
+Vector3d CompressedVector3Track::getKeyValue(int iKey) const
+{
+  const std::uint16_t *q = &keyValues[iKey * 3];
+  return {
+    rangeMin.x + rangeExtent.x * (q[0] / 65535.0),
+    rangeMin.y + rangeExtent.y * (q[1] / 65535.0),
+    rangeMin.z + rangeExtent.z * (q[2] / 65535.0)
+  };
+}
+
+CompressedQuaternionTrack::CompressedQuaternionTrack()
+  : keyTicks()
+  , keyValues()
+  , constValue(0, 0, 0, 1)
+  , constant(false)
+{
+}
+
+bool CompressedQuaternionTrack::empty() const
+{
+  return (!constant && keyTicks.empty());
+}
+
+Quaterniond CompressedQuaternionTrack::sample(double ticks) const
+{
+  if (constant) {
+    return (Quaterniond)constValue;
+  }
+
+  if (keyTicks.empty()) {
+    return {};
+  }
+
+  int iKey0, iKey1;
+  double t;
+  findKeyframes(keyTicks, ticks, iKey0, iKey1, t);
+  return (iKey0 == iKey1 ? getKeyValue(iKey0) : getKeyValue(iKey0).slerp(getKeyValue(iKey1), t));
+}
+
+size_t CompressedQuaternionTrack::getByteCount() const
+{
+  return (keyTicks.size() * sizeof(float) + keyValues.size() * sizeof(std::uint16_t));
+}
+
+Quaterniond CompressedQuaternionTrack::getKeyValue(int iKey) const
+{
+  return decodeQuaternion(&keyValues[iKey * 3]);
+}
+
+CompressedAnimationChannel::CompressedAnimationChannel(const AnimationChannel &ch, const AnimationCompressionSettings &settings)
+  : nodeName(ch.nodeName)
+  , position(compressVector3Track(ch.keyframePosition, settings.maxPositionError))
+  , rotation(compressQuaternionTrack(ch.keyframeRotation, settings.maxRotationError))
+  , scale(compressVector3Track(ch.keyframeScale, settings.maxScaleError))
+{
+}
+
 AnimatedNode::AnimatedNode(const std::string &name)
   : name(name)
   , animated(false)
@@ -21,6 +355,11 @@ Animation::Animation(const std::string &name, double durationTicks, double ticks
   : name(name)
   , durationTicks(durationTicks)
   , ticksPerSecond(ticksPerSecond)
+  , channels()
+  , compressedChannels()
+  , compressionSettings()
+  , segmentBounds()
+  , segmentDurationTicks(0)
 {
 }
 
@@ -31,11 +370,24 @@ double Animation::getTicks(double seconds) const
 
 bool Animation::getAnimatedNodeTransform(const std::string &nodeName, double ticks, Matrix44d &mtxAnimNode) const
 {
+  if (isCompressed()) {
+    const auto &it = compressedChannels.find(nodeName);
+    if (it == compressedChannels.end()) {
+      return false;
+    }
+
+    const CompressedAnimationChannel &ch = it->second;
+    const Vector3d trans = ch.position.sample(ticks, Vector3d(0.0));
+    const Quaterniond rot = ch.rotation.sample(ticks);
+    const Vector3d scale = ch.scale.sample(ticks, Vector3d(1.0));
+    mtxAnimNode = Matrix44d::compose(scale, rot.toMatrix(), trans);
+    return true;
+  }
+
   const auto &it = channels.find(nodeName);
   if (it == channels.end()) {
     return false;
   }
-
   const AnimationChannel &ch = it->second;
 
   Vector3d trans(0.0);
@@ -93,4 +445,55 @@ bool Animation::getAnimatedNodeTransform(const std::string &nodeName, double tic
   return true;
 }
 
+void Animation::compress()
+{
+  if (isCompressed()) {
+    Log::warning("Animation already compressed: %s", name.c_str());
+    return;
+  }
+
+  const size_t byteCountBefore = getKeyframeByteCount();
+
+  for (const auto &pair : channels) {
+    compressedChannels.emplace(pair.first, CompressedAnimationChannel(pair.second, compressionSettings));
+  }
+  channels.clear();
+
+  Log::debug("Compressed animation %s: %d -> %d bytes", name.c_str(), (int)byteCountBefore, (int)getKeyframeByteCount());
+}
+
+bool Animation::isCompressed() const
+{
+  return !compressedChannels.empty();
+}
+
+size_t Animation::getKeyframeByteCount() const
+{
+  size_t byteCount = 0;
+
+  for (const auto &pair : channels) {
+    const AnimationChannel &ch = pair.second;
+    byteCount += ch.keyframePosition.size() * (sizeof(double) + sizeof(Vector3d));
+    byteCount += ch.keyframeRotation.size() * (sizeof(double) + sizeof(Quaterniond));
+    byteCount += ch.keyframeScale.size() * (sizeof(double) + sizeof(Vector3d));
+  }
+
+  for (const auto &pair : compressedChannels) {
+    const CompressedAnimationChannel &ch = pair.second;
+    byteCount += ch.position.getByteCount() + ch.rotation.getByteCount() + ch.scale.getByteCount();
+  }
+
+  return byteCount;
+}
+
+const Box* Animation::getSegmentBounds(double ticks) const
+{
+  if (segmentBounds.empty() || segmentDurationTicks <= 0.0) {
+    return nullptr;
+  }
+
+  const int iSegment = Math::clamp((int)(ticks / segmentDurationTicks), 0, (int)segmentBounds.size() - 1);
+  return &segmentBounds[iSegment];
+}
+
 }
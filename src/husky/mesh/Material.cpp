@@ -26,7 +26,22 @@ Material::Material(const Vector3f &diffuse, const Texture &tex)
   , twoSided(false)
   , depthTest(true)
   , tex(tex)
+  , uniformBuffer()
 {
 }
 
+MaterialUniforms Material::getUniforms() const
+{
+  MaterialUniforms uniforms;
+  uniforms.mtlAmbient = Vector4f(ambient, 0.f);
+  uniforms.mtlDiffuse = Vector4f(diffuse, 0.f);
+  uniforms.mtlSpecular = Vector4f(specular, 0.f);
+  uniforms.mtlEmissive = Vector4f(emissive, 0.f);
+  uniforms.mtlShininess = shininess;
+  uniforms.mtlShininessStrength = shininessStrength;
+  uniforms.lineWidth = lineWidth;
+  uniforms.opacity = opacity;
+  return uniforms;
+}
+
 }
@@ -1,6 +1,8 @@
 #include <husky/mesh/Mesh.hpp>
 #include <husky/math/Math.hpp>
+#include <husky/util/HashUtil.hpp>
 #include <husky/Log.hpp>
+#include <array>
 #include <set>
 
 namespace husky {
@@ -305,6 +307,7 @@ Mesh::Normal Mesh::getNormal(int iVert) const { return vertNormal[iVert]; }
 Mesh::Tangent Mesh::getTangent(int iVert) const { return vertTangent[iVert]; }
 Mesh::TexCoord Mesh::getTexCoord(int iVert) const { return vertTexCoord[iVert]; }
 Mesh::Color Mesh::getColor(int iVert) const { return vertColor[iVert]; }
+const std::vector<BoneWeight>& Mesh::getBoneWeights(int iVert) const { return vertBoneWeights[iVert]; }
 void Mesh::setPosition(int iVert, const Position &pos) { vertPosition[iVert] = pos; }
 void Mesh::setNormal(int iVert, const Normal &nor) { vertNormal.resize(vertPosition.size()); vertNormal[iVert] = nor; }
 void Mesh::setTangent(int iVert, const Tangent &tangent) { vertTangent.resize(vertPosition.size()); vertTangent[iVert] = tangent; }
@@ -495,7 +498,7 @@ void Mesh::convertFacesToWireframeLines()
   }
 }
 
-RenderData Mesh::getRenderData() const
+RenderData Mesh::getRenderData(bool upload) const
 {
   if (hasFaces()) {
     if (hasLines()) {
@@ -509,8 +512,9 @@ RenderData Mesh::getRenderData() const
     int iColor = vertDesc.addAttr(VertexAttribute::COLOR, VertexAttributeDataType::UINT8, 4, true);
     int iBoneIndices = -1;
     int iBoneWeights = -1;
+    const bool wideBoneIndices = (numBones() > 256); // Only meshes with very large palettes pay for 16-bit indices
     if (hasBoneWeights()) {
-      iBoneIndices = vertDesc.addAttr(VertexAttribute::BONE_INDICES, VertexAttributeDataType::UINT8, 4);
+      iBoneIndices = vertDesc.addAttr(VertexAttribute::BONE_INDICES, wideBoneIndices ? VertexAttributeDataType::UINT16 : VertexAttributeDataType::UINT8, 4);
       iBoneWeights = vertDesc.addAttr(VertexAttribute::BONE_WEIGHTS, VertexAttributeDataType::UINT8, 4, true);
     }
 
@@ -528,7 +532,7 @@ RenderData Mesh::getRenderData() const
 
         if (iBoneIndices >= 0 && iBoneWeights >= 0) {
           const auto &boneWeights = vertBoneWeights[i];
-          Vector4b indices; // = { 0, 1, 2, 3 };
+          std::array<std::uint16_t, 4> indices = { 0, 0, 0, 0 };
           Vector4b weights; // = { 255, 0, 0, 0 };
 
           for (int j = 0; j < boneWeights.size(); j++) {
@@ -537,11 +541,16 @@ RenderData Mesh::getRenderData() const
               break;
             }
 
-            indices[j] = (std::uint8_t)boneWeights[j].boneIndex;
+            indices[j] = (std::uint16_t)boneWeights[j].boneIndex;
             weights[j] = (std::uint8_t)(boneWeights[j].weight * 255); // Check/clamp value?
           }
 
-          vertData.setValue(i, iBoneIndices, indices);
+          if (wideBoneIndices) {
+            vertData.setValue(i, iBoneIndices, indices);
+          }
+          else {
+            vertData.setValue(i, iBoneIndices, Vector4b((std::uint8_t)indices[0], (std::uint8_t)indices[1], (std::uint8_t)indices[2], (std::uint8_t)indices[3]));
+          }
           vertData.setValue(i, iBoneWeights, weights);
         }
       }
@@ -557,7 +566,7 @@ RenderData Mesh::getRenderData() const
     }
 
     RenderData r(std::move(vertData), std::move(indexData));
-    r.uploadToGpu();
+    if (upload) { r.uploadToGpu(); }
     return r;
   }
   else if (hasLines()) {
@@ -595,7 +604,7 @@ RenderData Mesh::getRenderData() const
     }
 
     RenderData r(std::move(vertData), std::move(indexData));
-    r.uploadToGpu();
+    if (upload) { r.uploadToGpu(); }
     return r;
   }
   else { // Neither faces nor lines => Assume points
@@ -619,9 +628,43 @@ RenderData Mesh::getRenderData() const
     }
 
     RenderData r(std::move(vertData), std::move(indexData));
-    r.uploadToGpu();
+    if (upload) { r.uploadToGpu(); }
     return r;
   }
 }
 
+template<typename T>
+static std::uint64_t hashArray(const std::vector<T> &values, std::uint64_t hash)
+{
+  hash = HashUtil::hashValue((std::uint64_t)values.size(), hash); // Keeps neighboring arrays apart
+  return HashUtil::hashBytes(values.data(), values.size() * sizeof(T), hash);
+}
+
+std::uint64_t Mesh::hash() const
+{
+  std::uint64_t hash = HashUtil::initialHash;
+  hash = hashArray(vertPosition, hash);
+  hash = hashArray(vertNormal, hash);
+  hash = hashArray(vertTangent, hash);
+  hash = hashArray(vertTexCoord, hash);
+  hash = hashArray(vertColor, hash);
+  hash = HashUtil::hashValue((std::uint64_t)vertBoneWeights.size(), hash);
+  for (const std::vector<BoneWeight> &weights : vertBoneWeights) {
+    hash = HashUtil::hashValue((std::uint64_t)weights.size(), hash);
+    for (const BoneWeight &weight : weights) { // Field by field; BoneWeight has padding
+      hash = HashUtil::hashValue(weight.boneIndex, hash);
+      hash = HashUtil::hashValue(weight.weight, hash);
+    }
+  }
+  hash = hashArray(lines, hash);
+  hash = hashArray(tris, hash);
+  hash = hashArray(quads, hash);
+  hash = HashUtil::hashValue((std::uint64_t)bones.size(), hash);
+  for (const Bone &bone : bones) {
+    hash = HashUtil::hashString(bone.name, hash);
+    hash = HashUtil::hashValue(bone.mtxMeshToBone, hash);
+  }
+  return hash;
+}
+
 }
@@ -0,0 +1,219 @@
+#include <husky/mesh/MeshSkinner.hpp>
+#include <husky/util/ThreadPool.hpp>
+#include <husky/Log.hpp>
+#include <algorithm>
+#include <xmmintrin.h>
+
+namespace husky {
+
+SkinnedVertices::SkinnedVertices()
+  : vertCount(0)
+  , posX(), posY(), posZ()
+  , norX(), norY(), norZ()
+{
+}
+
+Vector3d SkinnedVertices::getPosition(int iVert) const
+{
+  return { posX[iVert], posY[iVert], posZ[iVert] };
+}
+
+Vector3d SkinnedVertices::getNormal(int iVert) const
+{
+  return { norX[iVert], norY[iVert], norZ[iVert] };
+}
+
+Box SkinnedVertices::getBbox() const
+{
+  if (vertCount == 0) {
+    return {};
+  }
+
+  Vector3f min(posX[0], posY[0], posZ[0]);
+  Vector3f max(min);
+
+  for (int iVert = 1; iVert < vertCount; iVert++) {
+    min.x = std::min(min.x, posX[iVert]);
+    min.y = std::min(min.y, posY[iVert]);
+    min.z = std::min(min.z, posZ[iVert]);
+    max.x = std::max(max.x, posX[iVert]);
+    max.y = std::max(max.y, posY[iVert]);
+    max.z = std::max(max.z, posZ[iVert]);
+  }
+
+  return { (Vector3d)min, (Vector3d)max };
+}
+
+MeshSkinner::MeshSkinner()
+  : verticesPerTask(1024)
+  , vertCount(0)
+  , paddedVertCount(0)
+  , maxBoneIndex(-1)
+{
+}
+
+MeshSkinner::MeshSkinner(const Mesh &mesh)
+  : MeshSkinner()
+{
+  if (!mesh.hasBoneWeights()) {
+    Log::warning("Cannot skin mesh without bone weights");
+    return;
+  }
+
+  vertCount = mesh.numVerts();
+  paddedVertCount = (vertCount + 3) & ~3;
+
+  posX.assign(paddedVertCount, 0.f);
+  posY.assign(paddedVertCount, 0.f);
+  posZ.assign(paddedVertCount, 0.f);
+
+  if (mesh.hasNormals()) {
+    norX.assign(paddedVertCount, 0.f);
+    norY.assign(paddedVertCount, 0.f);
+    norZ.assign(paddedVertCount, 0.f);
+  }
+
+  for (int k = 0; k < 4; k++) {
+    boneIndices[k].assign(paddedVertCount, 0);
+    boneWeights[k].assign(paddedVertCount, 0.f);
+  }
+
+  std::vector<BoneWeight> weights;
+
+  for (int iVert = 0; iVert < vertCount; iVert++) {
+    const Mesh::Position pos = mesh.getPosition(iVert);
+    posX[iVert] = (float)pos.x;
+    posY[iVert] = (float)pos.y;
+    posZ[iVert] = (float)pos.z;
+
+    if (mesh.hasNormals()) {
+      const Mesh::Normal nor = mesh.getNormal(iVert);
+      norX[iVert] = (float)nor.x;
+      norY[iVert] = (float)nor.y;
+      norZ[iVert] = (float)nor.z;
+    }
+
+    weights = mesh.getBoneWeights(iVert);
+    if (weights.size() > 4) {
+      std::partial_sort(weights.begin(), weights.begin() + 4, weights.end(), [](const BoneWeight &a, const BoneWeight &b) { return a.weight > b.weight; });
+      weights.resize(4);
+    }
+
+    double weightSum = 0;
+    for (const BoneWeight &weight : weights) {
+      weightSum += weight.weight;
+    }
+
+    for (int k = 0; k < (int)weights.size(); k++) {
+      boneIndices[k][iVert] = (std::uint16_t)weights[k].boneIndex;
+      boneWeights[k][iVert] = (float)(weightSum > 0.0 ? weights[k].weight / weightSum : 0.0);
+      maxBoneIndex = std::max(maxBoneIndex, weights[k].boneIndex);
+    }
+  }
+}
+
+bool MeshSkinner::valid() const
+{
+  return (vertCount > 0);
+}
+
+int MeshSkinner::numVerts() const
+{
+  return vertCount;
+}
+
+bool MeshSkinner::skin(const std::vector<Matrix44f> &mtxBones, SkinnedVertices &result, ThreadPool *threadPool) const
+{
+  if (!valid()) {
+    return false;
+  }
+
+  if (maxBoneIndex >= (int)mtxBones.size()) {
+    Log::warning("Bone palette too small: %d < %d", (int)mtxBones.size(), maxBoneIndex + 1);
+    return false;
+  }
+
+  result.vertCount = vertCount;
+  result.posX.resize(paddedVertCount);
+  result.posY.resize(paddedVertCount);
+  result.posZ.resize(paddedVertCount);
+  result.norX.resize(norX.size());
+  result.norY.resize(norY.size());
+  result.norZ.resize(norZ.size());
+
+  if (threadPool == nullptr) {
+    threadPool = &ThreadPool::global();
+  }
+
+  // Each task handles whole groups of four vertices
+  const int groupsPerTask = std::max(verticesPerTask / 4, 1);
+  threadPool->parallelFor(0, paddedVertCount / 4, groupsPerTask, [&](int begin, int end) {
+    skinRange(mtxBones.data(), begin * 4, end * 4, result);
+  });
+
+  return true;
+}
+
+void MeshSkinner::skinRange(const Matrix44f *mtxBones, int begin, int end, SkinnedVertices &result) const
+{
+  const bool normals = !norX.empty();
+
+  for (int iVert = begin; iVert < end; iVert += 4) {
+    // Blend the upper 3x4 part of the bone matrices; lane i of m[row][col] belongs to vertex iVert+i
+    __m128 m[3][4];
+    for (int row = 0; row < 3; row++) {
+      for (int col = 0; col < 4; col++) {
+        m[row][col] = _mm_setzero_ps();
+      }
+    }
+
+    for (int k = 0; k < 4; k++) {
+      const __m128 w = _mm_loadu_ps(&boneWeights[k][iVert]);
+      const float *b0 = mtxBones[boneIndices[k][iVert + 0]].m;
+      const float *b1 = mtxBones[boneIndices[k][iVert + 1]].m;
+      const float *b2 = mtxBones[boneIndices[k][iVert + 2]].m;
+      const float *b3 = mtxBones[boneIndices[k][iVert + 3]].m;
+
+      for (int col = 0; col < 4; col++) { // Matrices are column-major
+        __m128 r0 = _mm_loadu_ps(b0 + col * 4);
+        __m128 r1 = _mm_loadu_ps(b1 + col * 4);
+        __m128 r2 = _mm_loadu_ps(b2 + col * 4);
+        __m128 r3 = _mm_loadu_ps(b3 + col * 4);
+        _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+        m[0][col] = _mm_add_ps(m[0][col], _mm_mul_ps(w, r0));
+        m[1][col] = _mm_add_ps(m[1][col], _mm_mul_ps(w, r1));
+        m[2][col] = _mm_add_ps(m[2][col], _mm_mul_ps(w, r2));
+      }
+    }
+
+    const __m128 x = _mm_loadu_ps(&posX[iVert]);
+    const __m128 y = _mm_loadu_ps(&posY[iVert]);
+    const __m128 z = _mm_loadu_ps(&posZ[iVert]);
+
+    float *const dstPos[3] = { &result.posX[iVert], &result.posY[iVert], &result.posZ[iVert] };
+    for (int row = 0; row < 3; row++) {
+      const __m128 p = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m[row][0], x), _mm_mul_ps(m[row][1], y)), _mm_add_ps(_mm_mul_ps(m[row][2], z), m[row][3]));
+      _mm_storeu_ps(dstPos[row], p);
+    }
+
+    if (normals) {
+      const __m128 nx = _mm_loadu_ps(&norX[iVert]);
+      const __m128 ny = _mm_loadu_ps(&norY[iVert]);
+      const __m128 nz = _mm_loadu_ps(&norZ[iVert]);
+
+      __m128 n[3];
+      for (int row = 0; row < 3; row++) {
+        n[row] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m[row][0], nx), _mm_mul_ps(m[row][1], ny)), _mm_mul_ps(m[row][2], nz));
+      }
+
+      const __m128 lengthSq = _mm_add_ps(_mm_add_ps(_mm_mul_ps(n[0], n[0]), _mm_mul_ps(n[1], n[1])), _mm_mul_ps(n[2], n[2]));
+      const __m128 invLength = _mm_div_ps(_mm_set1_ps(1.f), _mm_sqrt_ps(_mm_max_ps(lengthSq, _mm_set1_ps(1e-20f))));
+
+      _mm_storeu_ps(&result.norX[iVert], _mm_mul_ps(n[0], invLength));
+      _mm_storeu_ps(&result.norY[iVert], _mm_mul_ps(n[1], invLength));
+      _mm_storeu_ps(&result.norZ[iVert], _mm_mul_ps(n[2], invLength));
+    }
+  }
+}
+
+}
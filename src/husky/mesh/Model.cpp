@@ -1,12 +1,23 @@
 #include <husky/mesh/Model.hpp>
+#include <husky/mesh/MeshSkinner.hpp>
+#include <husky/mesh/PoseCache.hpp>
+#include <husky/render/BakedAnimation.hpp>
+#include <husky/render/RenderQueue.hpp>
+#include <husky/render/SharedMeshBuffer.hpp>
 #include <husky/render/Texture.hpp>
+#include <husky/render/TextureStreamer.hpp>
 #include <husky/util/SharedResource.hpp>
+#include <husky/util/ThreadPool.hpp>
 #include <husky/Log.hpp>
 #include <glad/glad.h>
+#include <assimp/config.h>
 #include <assimp/Importer.hpp>
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
+#include <algorithm>
+#include <cmath>
 #include <filesystem>
+#include <unordered_map>
 
 namespace fs = std::experimental::filesystem;
 
@@ -36,6 +47,13 @@ ModelMesh::ModelMesh(const std::string &name, int materialIndex, Mesh &&mesh)
   , renderData(mesh.getRenderData())
   , bboxLocal(mesh.getPositions())
   , bsphereLocal(bboxLocal.center(), mesh.getPositions())
+{
+  renderData.releaseCpuData(); // The mesh keeps the CPU copy
+}
+
+AnimationPose::AnimationPose()
+  : nodes()
+  , mtxBones()
 {
 }
 
@@ -81,7 +99,7 @@ static ModelNode* getAiNodesRecursive(const aiNode *node, ModelNode *parent)
   return n.release();
 }
 
-static Material getAiMaterial(const fs::path &folderPath, const aiMaterial *material)
+static Material getAiMaterial(const fs::path &folderPath, const aiMaterial *material, bool compressTextures, TextureStreamer *textureStreamer)
 {
   Material mtl;
 
@@ -163,8 +181,18 @@ static Material getAiMaterial(const fs::path &folderPath, const aiMaterial *mate
         if (!p.is_absolute()) {
           p = folderPath / p;
         }
-        auto img = SharedResource::loadImage(p.u8string());
-        mtl.tex = Texture(*img, TexWrap::REPEAT, TexFilter::LINEAR, TexMipmaps::STANDARD);
+        if (textureStreamer != nullptr) { // Decoded in the background
+          mtl.tex = textureStreamer->add(p.u8string(), TexWrap::REPEAT, TexFilter::LINEAR);
+        }
+        else if (compressTextures) {
+          auto img = SharedResource::loadImage(p.u8string());
+          const BlockFormat format = (img->format == ImageFormat::RGBA8 ? BlockFormat::BC7 : BlockFormat::BC1);
+          mtl.tex = Texture(CompressedImage::compress(*img, format, true, ThreadPool::global()), TexWrap::REPEAT, TexFilter::LINEAR);
+        }
+        else {
+          auto img = SharedResource::loadImage(p.u8string());
+          mtl.tex = Texture(*img, TexWrap::REPEAT, TexFilter::LINEAR, TexMipmaps::STANDARD);
+        }
       }
     }
     else {
@@ -253,7 +281,7 @@ static Animation getAiAnimation(const aiAnimation *anim)
   return animation;
 }
 
-Model Model::load(const std::string &filePath)
+Model Model::load(const std::string &filePath, int maxBonesPerMesh, bool compressTextures, TextureStreamer *textureStreamer)
 {
   const fs::path fPath = fs::u8path(filePath);
   const fs::path folderPath = fPath.parent_path();
@@ -277,12 +305,16 @@ Model Model::load(const std::string &filePath)
     | aiProcess_LimitBoneWeights // Limit bone weights to 4 per vertex
     //| aiProcess_OptimizeMeshes
     //| aiProcess_PreTransformVertices
-    //| aiProcess_SplitByBoneCount // TODO
     //| aiProcess_OptimizeGraph
     //| aiProcess_FlipUVs
     | aiProcess_FixInfacingNormals
     | aiProcess_GenSmoothNormals;
 
+  if (maxBonesPerMesh > 0) {
+    importer.SetPropertyInteger(AI_CONFIG_PP_SBBC_MAX_BONES, maxBonesPerMesh);
+    importFlags |= aiProcess_SplitByBoneCount; // Split meshes with more than maxBonesPerMesh bones
+  }
+
   const aiScene *scene = importer.ReadFile(filePath, importFlags);
 
   Model mdl(fPath.stem().u8string());
@@ -300,7 +332,7 @@ Model Model::load(const std::string &filePath)
   // Get materials
   mdl.materials.reserve(scene->mNumMaterials);
   for (unsigned int iMtl = 0; iMtl < scene->mNumMaterials; iMtl++) {
-    mdl.materials.emplace_back(getAiMaterial(folderPath, scene->mMaterials[iMtl]));
+    mdl.materials.emplace_back(getAiMaterial(folderPath, scene->mMaterials[iMtl], compressTextures, textureStreamer));
   }
 
   // Get meshes
@@ -316,7 +348,9 @@ Model Model::load(const std::string &filePath)
   }
 
   mdl.root = getAiNodesRecursive(scene->mRootNode, nullptr);
+  mdl.indexNodes();
   mdl.calcBbox();
+  mdl.calcAnimationBounds();
 
   return mdl;
 }
@@ -334,6 +368,7 @@ Model::Model(Mesh &&mesh, const Material &mtl)
   int iMtl  = addMaterial(mtl);
   int iMesh = addMesh({ "", iMtl, std::move(mesh) });
   root->meshIndices.emplace_back(iMesh);
+  indexNodes();
   calcBbox();
 }
 
@@ -346,6 +381,9 @@ int Model::addMaterial(const Material &mtl)
 int Model::addMesh(ModelMesh &&mm)
 {
   meshes.emplace_back(mm);
+  if (!nodes.empty()) { // Keep meshBoneNodeIndices in step; loading indexes once at the end
+    indexNodes();
+  }
   return (int)meshes.size() - 1;
 }
 
@@ -360,75 +398,100 @@ const Material& Model::getMaterial(int mtlIndex) const
   return fallbackMtl;
 }
 
-static std::vector<Matrix44f> getBoneMatrices(const std::vector<Bone> &bones, const std::map<std::string, AnimatedNode> &animNodes)
+void Model::draw(RenderQueue &queue, const Shader &shader, const Viewport &viewport, const Matrix44f &view, const Matrix44f &modelView, const Matrix44f &projection, const AnimationPose &pose, const std::vector<unsigned int> &skinnedVbos, const std::vector<int> &boneOffsets) const
 {
-  std::vector<Matrix44f> mtxBones;
-  mtxBones.reserve(bones.size());
-
-  for (const Bone &bone : bones) {
-    const auto it = animNodes.find(bone.name);
-    if (it != animNodes.end()) {
-      mtxBones.emplace_back((Matrix44f)(it->second.mtxRelToModel * bone.mtxMeshToBone));
-    }
-    else {
-      mtxBones.emplace_back(Matrix44f::identity());
-    }
-  }
-
-  return mtxBones;
+  queue.begin(viewport, view, projection);
+  enqueue(queue, shader, modelView, pose, skinnedVbos, boneOffsets);
+  queue.sort();
+  queue.submit();
 }
 
-// TODO: Move to Animation.hpp?
-static void getAnimatedNodesRecursive(const Animation *anim, const ModelNode *node, double ticks, std::map<std::string, AnimatedNode> &animNodes, const AnimatedNode *parent)
+void Model::drawBaked(RenderQueue &queue, const Shader &shader, const Viewport &viewport, const Matrix44f &view, const Matrix44f &modelView, const Matrix44f &projection, const BakedAnimation &baked, double time) const
 {
-  AnimatedNode animNode(node->name);
-
-  // Try getting animated local transform
-  if (anim != nullptr && anim->getAnimatedNodeTransform(node->name, ticks, animNode.mtxRelToParent)) {
-    animNode.animated = true;
-  }
-  else { // Node not animated; use local transform from bind pose
-    animNode.animated = false;
-    animNode.mtxRelToParent = node->mtxRelToParent;
-  }
-
-  // Calculate animated global transform
-  animNode.mtxRelToModel = (parent ? (parent->mtxRelToModel * animNode.mtxRelToParent) : animNode.mtxRelToParent);
-
-  for (const ModelNode *child : node->children) {
-    getAnimatedNodesRecursive(anim, child, ticks, animNodes, &animNode);
-  }
-
-  animNodes.insert({ animNode.name, animNode });
+  queue.begin(viewport, view, projection);
+  enqueueBaked(queue, shader, modelView, baked, time);
+  queue.sort();
+  queue.submit();
 }
 
-void Model::draw(const Shader &shader, const Viewport &viewport, const Matrix44f &view, const Matrix44f &modelView, const Matrix44f &projection, const std::map<std::string, AnimatedNode> &animNodes) const
+void Model::enqueue(RenderQueue &queue, const Shader &shader, const Matrix44f &modelView, const AnimationPose &pose, const std::vector<unsigned int> &skinnedVbos, const std::vector<int> &boneOffsets) const
 {
   // TODO: "m_GlobalInverseTransform"? http://ogldev.atspace.co.uk/www/tutorial38/tutorial38.html
   //const Matrix44f mtxGlobalInv = (Matrix44f)root->mtxRelToModel.inverted();
 
-  for (const ModelNode *node : getNodesFlatList()) {
+  if (nodes.empty() && !meshes.empty()) {
+    Log::warning("Model %s has no indexed nodes; attach its meshes to a node and call indexNodes()", name.c_str());
+    return;
+  }
+
+  const bool boneBuffer = (bool)shader.getUniform(UniformSlot::BONE_OFFSET); // Only in SkinningMode::BONE_BUFFER shaders
+
+  for (int iNode = 0; iNode < (int)nodes.size(); iNode++) {
+    const ModelNode *node = nodes[iNode];
+
     for (int iMesh : node->meshIndices) {
       const ModelMesh &mesh = meshes[iMesh];
       const Material &mtl = getMaterial(mesh.materialIndex);
+      const int boneOffset = ((boneBuffer && iMesh < (int)boneOffsets.size()) ? boneOffsets[iMesh] : -1);
+      const bool skinned = (iMesh < (int)pose.mtxBones.size() && !pose.mtxBones[iMesh].empty());
 
-      if (mesh.mesh.hasBones() && mesh.mesh.hasBoneWeights()) {
-        const std::vector<Matrix44f> mtxBones = getBoneMatrices(mesh.mesh.getBones(), animNodes);
-        mesh.renderData.draw(shader, mtl, viewport, view, modelView, projection, mtxBones);
+      if (iMesh < (int)skinnedVbos.size() && skinnedVbos[iMesh] != 0) { // Skinned by SkinningPass
+        queue.addItem(shader, mtl, mesh.renderData, modelView).skinnedVbo = skinnedVbos[iMesh];
+      }
+      else if (boneOffset >= 0) { // Palette is in the bone buffer
+        queue.addItem(shader, mtl, mesh.renderData, modelView).boneOffset = boneOffset;
+      }
+      else if (skinned && boneBuffer) { // The shader has no mtxBones uniform to fall back to
+        Log::warning("Skinned mesh %s has no palette in the bone buffer; see BonePaletteBuffer::add()", mesh.name.c_str());
+      }
+      else if (skinned) {
+        queue.addItem(shader, mtl, mesh.renderData, modelView).mtxBones = &pose.mtxBones[iMesh];
       }
       else { // TODO: Can we avoid this branch?
         Matrix44f nodeModelView = modelView;
-        const auto it = animNodes.find(node->name);
-        if (it != animNodes.end()) {
-          Matrix44f mtxAnimNodeToModel = (Matrix44f)it->second.mtxRelToModel;
+        if (iNode < (int)pose.nodes.size()) {
+          Matrix44f mtxAnimNodeToModel = (Matrix44f)pose.nodes[iNode].mtxRelToModel;
           nodeModelView *= mtxAnimNodeToModel;
         }
-        mesh.renderData.draw(shader, mtl, viewport, view, nodeModelView, projection, {});
+        queue.addItem(shader, mtl, mesh.renderData, nodeModelView).boundingSphere = Vector4f((Vector3f)mesh.bsphereLocal.center, (float)mesh.bsphereLocal.radius);
       }
     }
   }
 }
 
+void Model::enqueueBaked(RenderQueue &queue, const Shader &shader, const Matrix44f &modelView, const BakedAnimation &baked, double time) const
+{
+  if (!baked.valid() || baked.meshBoneOffsets.size() != meshes.size()) {
+    Log::warning("Invalid baked animation");
+    return;
+  }
+
+  if (nodes.empty() && !meshes.empty()) {
+    Log::warning("Model %s has no indexed nodes; attach its meshes to a node and call indexNodes()", name.c_str());
+    return;
+  }
+
+  const float bakedTime = (float)std::fmod(time, baked.getDuration()); // Keep float precision for long running times
+
+  for (int iNode = 0; iNode < (int)nodes.size(); iNode++) {
+    const ModelNode *node = nodes[iNode];
+
+    for (int iMesh : node->meshIndices) {
+      const ModelMesh &mesh = meshes[iMesh];
+      const Material &mtl = getMaterial(mesh.materialIndex);
+      const int boneOffset = baked.meshBoneOffsets[iMesh];
+
+      // Rigid meshes stay in bind pose
+      const Matrix44f meshModelView = (boneOffset != -1 ? modelView : modelView * (Matrix44f)node->mtxRelToModel);
+
+      DrawItem &item = queue.addItem(shader, mtl, mesh.renderData, meshModelView);
+      item.bakedAnimation = &baked;
+      item.bakedTime = bakedTime;
+      item.boneOffset = boneOffset;
+    }
+  }
+}
+
 void Model::calcBbox()
 {
   bboxLocal = {};
@@ -447,6 +510,209 @@ void Model::calcBbox()
   }
 }
 
+void Model::calcAnimationBounds(double segmentSeconds, int samplesPerSegment)
+{
+  samplesPerSegment = std::max(samplesPerSegment, 1);
+
+  std::vector<MeshSkinner> skinners(meshes.size());
+  for (int iMesh = 0; iMesh < (int)meshes.size(); iMesh++) {
+    const Mesh &mesh = meshes[iMesh].mesh;
+    if (mesh.hasBones() && mesh.hasBoneWeights()) {
+      skinners[iMesh] = MeshSkinner(mesh);
+    }
+  }
+
+  AnimationPose pose;
+  SkinnedVertices skinned;
+  std::vector<std::vector<Vector3d>> prevPositions; // Per node mesh, of the previous sample
+  std::vector<Vector3d> positions;
+
+  for (Animation &anim : animations) {
+    anim.segmentBounds.clear();
+    anim.segmentDurationTicks = 0;
+
+    if (anim.durationTicks <= 0.0 || anim.ticksPerSecond <= 0.0 || segmentSeconds <= 0.0) {
+      continue;
+    }
+
+    const int numSegments = std::max((int)std::ceil(anim.durationTicks / (segmentSeconds * anim.ticksPerSecond)), 1);
+    anim.segmentDurationTicks = anim.durationTicks / numSegments;
+    anim.segmentBounds.resize(numSegments);
+
+    for (int iSegment = 0; iSegment < numSegments; iSegment++) {
+      Box &bbox = anim.segmentBounds[iSegment];
+      double maxStep = 0.0; // Largest distance a vertex moves between two samples
+
+      for (int iSample = 0; iSample <= samplesPerSegment; iSample++) { // Include both segment ends
+        const double ticks = (iSegment + (double)iSample / samplesPerSegment) * anim.segmentDurationTicks;
+        getAnimationPose(&anim, std::min(ticks, anim.durationTicks), pose);
+
+        int iNodeMesh = 0;
+        for (int iNode = 0; iNode < (int)nodes.size(); iNode++) {
+          for (const int iMesh : nodes[iNode]->meshIndices) {
+            const Mesh &mesh = meshes[iMesh].mesh;
+            const std::vector<Matrix44f> &mtxBones = pose.mtxBones[iMesh];
+
+            positions.clear();
+            if (!mtxBones.empty() && skinners[iMesh].skin(mtxBones, skinned)) {
+              for (int iVert = 0; iVert < skinned.vertCount; iVert++) {
+                positions.emplace_back(skinned.getPosition(iVert));
+              }
+            }
+            else {
+              for (const Mesh::Position &pos : mesh.getPositions()) {
+                positions.emplace_back((pose.nodes[iNode].mtxRelToModel * Vector4d(pos, 1.0)).xyz);
+              }
+            }
+
+            if (iNodeMesh >= (int)prevPositions.size()) {
+              prevPositions.resize(iNodeMesh + 1);
+            }
+            std::vector<Vector3d> &prev = prevPositions[iNodeMesh++];
+            for (int iVert = 0; iVert < (int)positions.size(); iVert++) {
+              bbox.expand(positions[iVert]);
+              if (prev.size() == positions.size()) {
+                maxStep = std::max(maxStep, (positions[iVert] - prev[iVert]).length());
+              }
+            }
+            std::swap(prev, positions);
+          }
+        }
+      }
+
+      // In-between poses can leave the sampled bounds, e.g., along the arc of a rotating bone; the arc between two samples bulges less than half their distance for turns up to 180 degrees
+      if (bbox.initialized) {
+        bbox.min -= Vector3d(maxStep * 0.5);
+        bbox.max += Vector3d(maxStep * 0.5);
+      }
+    }
+  }
+}
+
+void Model::compressAnimations(const AnimationCompressionSettings &settings)
+{
+  for (Animation &anim : animations) {
+    if (!anim.isCompressed()) {
+      anim.compressionSettings = settings;
+      anim.compress();
+    }
+  }
+}
+
+void Model::useSharedBuffers(SharedMeshBuffers &sharedBuffers)
+{
+  for (ModelMesh &mesh : meshes) {
+    if (mesh.renderData.sharedBuffer != nullptr || mesh.mesh.hasBoneWeights() || !mesh.mesh.hasFaces()) {
+      continue;
+    }
+
+    RenderData renderData = mesh.mesh.getRenderData(false);
+    if (renderData._indexData.getIndexCount() == 0) {
+      continue;
+    }
+
+    // The private buffers are released by SharedMeshBuffer::upload()
+    std::swap(mesh.renderData._vertData, renderData._vertData);
+    std::swap(mesh.renderData._indexData, renderData._indexData);
+    sharedBuffers.add(mesh.renderData);
+  }
+}
+
+void Model::indexNodes()
+{
+  nodes = getNodesFlatList();
+
+  std::unordered_map<const ModelNode*, int> nodeIndices;
+  nodeIndices.reserve(nodes.size());
+  for (int iNode = 0; iNode < (int)nodes.size(); iNode++) {
+    nodeIndices.emplace(nodes[iNode], iNode);
+  }
+
+  nodeParentIndices.assign(nodes.size(), -1);
+  for (int iNode = 0; iNode < (int)nodes.size(); iNode++) {
+    for (const ModelNode *child : nodes[iNode]->children) {
+      const auto it = nodeIndices.find(child);
+      if (it != nodeIndices.end()) {
+        nodeParentIndices[it->second] = iNode;
+      }
+    }
+  }
+
+  meshBoneNodeIndices.clear();
+  meshBoneNodeIndices.reserve(meshes.size());
+  for (const ModelMesh &mesh : meshes) {
+    std::vector<int> boneNodeIndices;
+    for (const Bone &bone : mesh.mesh.getBones()) {
+      boneNodeIndices.emplace_back(getNodeIndex(bone.name));
+    }
+    meshBoneNodeIndices.emplace_back(std::move(boneNodeIndices));
+  }
+}
+
+int Model::getNodeIndex(const std::string &nodeName) const
+{
+  for (int iNode = 0; iNode < (int)nodes.size(); iNode++) {
+    if (nodes[iNode]->name == nodeName) {
+      return iNode;
+    }
+  }
+  return -1;
+}
+
+void Model::getAnimationPose(const Animation *anim, double ticks, AnimationPose &pose) const
+{
+  if (pose.nodes.size() != nodes.size()) {
+    pose.nodes.clear();
+    pose.nodes.reserve(nodes.size());
+    for (const ModelNode *node : nodes) {
+      pose.nodes.emplace_back(node->name);
+    }
+  }
+
+  // Nodes are sorted so that parents precede children
+  for (int iNode = 0; iNode < (int)nodes.size(); iNode++) {
+    const ModelNode *node = nodes[iNode];
+    AnimatedNode &animNode = pose.nodes[iNode];
+
+    // Try getting animated local transform
+    if (anim != nullptr && anim->getAnimatedNodeTransform(node->name, ticks, animNode.mtxRelToParent)) {
+      animNode.animated = true;
+    }
+    else { // Node not animated; use local transform from bind pose
+      animNode.animated = false;
+      animNode.mtxRelToParent = node->mtxRelToParent;
+    }
+
+    // Calculate animated global transform
+    const int iParent = nodeParentIndices[iNode];
+    animNode.mtxRelToModel = (iParent != -1 ? (pose.nodes[iParent].mtxRelToModel * animNode.mtxRelToParent) : animNode.mtxRelToParent);
+  }
+
+  // Build bone palettes
+  pose.mtxBones.resize(meshes.size());
+  for (int iMesh = 0; iMesh < (int)meshes.size(); iMesh++) {
+    const Mesh &mesh = meshes[iMesh].mesh;
+    std::vector<Matrix44f> &mtxBones = pose.mtxBones[iMesh];
+    mtxBones.clear();
+
+    if (mesh.hasBones() && mesh.hasBoneWeights() && iMesh < (int)meshBoneNodeIndices.size()) {
+      const std::vector<Bone> &bones = mesh.getBones();
+      const std::vector<int> &boneNodeIndices = meshBoneNodeIndices[iMesh];
+      mtxBones.reserve(bones.size());
+
+      for (int iBone = 0; iBone < (int)bones.size(); iBone++) {
+        const int iNode = boneNodeIndices[iBone];
+        if (iNode != -1) {
+          mtxBones.emplace_back((Matrix44f)(pose.nodes[iNode].mtxRelToModel * bones[iBone].mtxMeshToBone));
+        }
+        else {
+          mtxBones.emplace_back(Matrix44f::identity());
+        }
+      }
+    }
+  }
+}
+
 std::vector<const ModelNode*> Model::getNodesFlatList() const
 {
   std::vector<const ModelNode*> nodes;
@@ -469,32 +735,175 @@ ModelInstance::ModelInstance(const Model *model)
   : model(model)
   , animationIndex(-1)
   , animationTime(0)
-  , animNodes()
+  , pose()
+  , sharedPose(nullptr)
+  , bakedAnimation(nullptr)
+  , skinnedVbos()
+  , boneOffsets()
   , mtxTransform(Matrix44d::identity())
+  , poseFrom()
+  , poseTo()
+  , poseTimeFrom(0)
+  , poseTimeTo(0)
+  , poseAnimationIndex(-2)
+  , poseInterpolated(false)
 {
   assert(model != nullptr);
   animate(0); // Initialize node transforms
 }
 
-void ModelInstance::animate(double timeDelta)
+template<typename T>
+static Matrix44<T> lerpTransform(const Matrix44<T> &m0, const Matrix44<T> &m1, T t)
+{
+  // Scale, rotation and translation separately, so rotating bones stay rigid instead of shearing and shrinking
+  Vector3<T> scale0, scale1, trans0, trans1;
+  Matrix33<T> rot0, rot1;
+  m0.decompose(scale0, rot0, trans0);
+  m1.decompose(scale1, rot1, trans1);
+  if (rot0.determinant() < T(0)) { // Mirrored; keep the rotation proper
+    scale0[0] = -scale0[0];
+    rot0.col[0] = -rot0.col[0];
+  }
+  if (rot1.determinant() < T(0)) {
+    scale1[0] = -scale1[0];
+    rot1.col[0] = -rot1.col[0];
+  }
+
+  const Quaternion<T> rot = Quaternion<T>::fromRotationMatrix(rot0).normalized().slerp(Quaternion<T>::fromRotationMatrix(rot1).normalized(), t);
+  return Matrix44<T>::compose(scale0.lerp(scale1, t), rot.toMatrix(), trans0.lerp(trans1, t));
+}
+
+static void lerpPose(const AnimationPose &pose0, const AnimationPose &pose1, double t, AnimationPose &pose)
+{
+  if (pose.nodes.size() != pose1.nodes.size()) {
+    pose.nodes = pose1.nodes;
+  }
+
+  for (int iNode = 0; iNode < (int)pose1.nodes.size(); iNode++) {
+    const AnimatedNode &node0 = pose0.nodes[iNode];
+    const AnimatedNode &node1 = pose1.nodes[iNode];
+    AnimatedNode &node = pose.nodes[iNode];
+    node.animated = node1.animated;
+    node.mtxRelToParent = lerpTransform(node0.mtxRelToParent, node1.mtxRelToParent, t);
+    node.mtxRelToModel = lerpTransform(node0.mtxRelToModel, node1.mtxRelToModel, t);
+  }
+
+  pose.mtxBones.resize(pose1.mtxBones.size());
+  for (int iMesh = 0; iMesh < (int)pose1.mtxBones.size(); iMesh++) {
+    const std::vector<Matrix44f> &mtxBones0 = pose0.mtxBones[iMesh];
+    const std::vector<Matrix44f> &mtxBones1 = pose1.mtxBones[iMesh];
+    std::vector<Matrix44f> &mtxBones = pose.mtxBones[iMesh];
+    mtxBones.resize(mtxBones1.size());
+    for (int iBone = 0; iBone < (int)mtxBones1.size(); iBone++) {
+      mtxBones[iBone] = lerpTransform(mtxBones0[iBone], mtxBones1[iBone], (float)t);
+    }
+  }
+}
+
+void ModelInstance::advance(double timeDelta)
+{
+  animationTime += timeDelta;
+  skinnedVbos.clear();
+  boneOffsets.clear();
+
+  if (sharedPose != nullptr) { // The shared pose may be released while we are not using the cache
+    pose = *sharedPose;
+    sharedPose = nullptr;
+    poseAnimationIndex = -2;
+    poseInterpolated = false;
+  }
+}
+
+void ModelInstance::animate(double timeDelta, double updateInterval)
 {
   animationTime += timeDelta;
-  animNodes.clear();
+  sharedPose = nullptr;
+  skinnedVbos.clear();
+  boneOffsets.clear();
 
-  if (model->root == nullptr) {
+  if (bakedAnimation != nullptr) { // Nothing to evaluate on the CPU
     return;
   }
 
   const Animation* anim = getActiveAnimation();
-  double ticks = anim ? anim->getTicks(animationTime) : 0;
-  getAnimatedNodesRecursive(anim, model->root, ticks, animNodes, nullptr);
+
+  if (anim == nullptr) { // Bind pose never changes; evaluate it only once
+    if (poseAnimationIndex != -1) {
+      model->getAnimationPose(nullptr, 0, pose);
+      poseAnimationIndex = -1;
+      poseInterpolated = false;
+    }
+    return;
+  }
+
+  if (updateInterval <= 0.0) { // Full rate
+    model->getAnimationPose(anim, anim->getTicks(animationTime), pose);
+    poseAnimationIndex = animationIndex;
+    poseInterpolated = false;
+    return;
+  }
+
+  const bool valid = (poseInterpolated && poseAnimationIndex == animationIndex);
+
+  if (!valid || animationTime < poseTimeFrom || animationTime >= poseTimeTo + updateInterval) { // Start over
+    model->getAnimationPose(anim, anim->getTicks(animationTime), poseFrom);
+    poseTimeFrom = animationTime;
+    poseTimeTo = animationTime + updateInterval;
+    model->getAnimationPose(anim, anim->getTicks(poseTimeTo), poseTo);
+  }
+  else if (animationTime >= poseTimeTo) { // Step forward; the previous target becomes the new source
+    std::swap(poseFrom, poseTo);
+    poseTimeFrom = poseTimeTo;
+    poseTimeTo = poseTimeFrom + updateInterval;
+    model->getAnimationPose(anim, anim->getTicks(poseTimeTo), poseTo);
+  }
+
+  poseAnimationIndex = animationIndex;
+  poseInterpolated = true;
+
+  const double t = (animationTime - poseTimeFrom) / (poseTimeTo - poseTimeFrom);
+  lerpPose(poseFrom, poseTo, t, pose);
+}
+
+void ModelInstance::animate(double timeDelta, PoseCache &poseCache)
+{
+  if (bakedAnimation != nullptr) {
+    animate(timeDelta);
+    return;
+  }
+
+  animationTime += timeDelta;
+  skinnedVbos.clear();
+  boneOffsets.clear();
+
+  const Animation* anim = getActiveAnimation();
+  const double ticks = (anim ? anim->getTicks(animationTime) : 0);
+  sharedPose = poseCache.getPose(model, animationIndex, ticks);
 }
 
-void ModelInstance::draw(const Shader &shader, const Viewport &viewport, const Matrix44f &view, const Matrix44f &modelView, const Matrix44f &projection) const
+void ModelInstance::draw(RenderQueue &queue, const Shader &shader, const Viewport &viewport, const Matrix44f &view, const Matrix44f &modelView, const Matrix44f &projection) const
 {
   if (model != nullptr) {
     const Matrix44f instanceModelView(modelView * (Matrix44f)mtxTransform);
-    model->draw(shader, viewport, view, instanceModelView, projection, animNodes);
+    if (bakedAnimation != nullptr) {
+      model->drawBaked(queue, shader, viewport, view, instanceModelView, projection, *bakedAnimation, animationTime);
+    }
+    else {
+      model->draw(queue, shader, viewport, view, instanceModelView, projection, getPose(), skinnedVbos, boneOffsets);
+    }
+  }
+}
+
+void ModelInstance::enqueue(RenderQueue &queue, const Shader &shader, const Matrix44f &modelView) const
+{
+  if (model != nullptr) {
+    const Matrix44f instanceModelView(modelView * (Matrix44f)mtxTransform);
+    if (bakedAnimation != nullptr) {
+      model->enqueueBaked(queue, shader, instanceModelView, *bakedAnimation, animationTime);
+    }
+    else {
+      model->enqueue(queue, shader, instanceModelView, getPose(), skinnedVbos, boneOffsets);
+    }
   }
 }
 
@@ -513,4 +922,19 @@ const Animation* ModelInstance::getActiveAnimation() const
   return (animationIndex != -1 ? &model->animations[animationIndex] : nullptr);
 }
 
+const AnimationPose& ModelInstance::getPose() const
+{
+  return (sharedPose != nullptr ? *sharedPose : pose);
+}
+
+Box ModelInstance::getBbox() const
+{
+  if (const Animation *anim = getActiveAnimation()) {
+    if (const Box *bbox = anim->getSegmentBounds(anim->getTicks(animationTime))) {
+      return *bbox;
+    }
+  }
+  return model->bboxLocal;
+}
+
 }
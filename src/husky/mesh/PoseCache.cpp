@@ -0,0 +1,78 @@
+#include <husky/mesh/PoseCache.hpp>
+#include <cmath>
+#include <tuple>
+
+namespace husky {
+
+bool PoseCache::Key::operator<(const Key &other) const
+{
+  return std::tie(model, animationIndex, ticks) < std::tie(other.model, other.animationIndex, other.ticks);
+}
+
+PoseCache::Entry::Entry()
+  : pose()
+  , evaluated()
+  , lastUsedFrame(0)
+{
+}
+
+PoseCache::PoseCache(double timeStep)
+  : timeStep(timeStep)
+  , mutex()
+  , entries()
+  , frame(0)
+{
+}
+
+void PoseCache::beginFrame()
+{
+  std::lock_guard<std::mutex> lock(mutex);
+
+  for (auto it = entries.begin(); it != entries.end();) {
+    if (it->second->lastUsedFrame < frame) {
+      it = entries.erase(it);
+    }
+    else {
+      ++it;
+    }
+  }
+
+  frame++;
+}
+
+const AnimationPose* PoseCache::getPose(const Model *model, int animationIndex, double ticks)
+{
+  const Animation *anim = (animationIndex != -1 ? &model->animations[animationIndex] : nullptr);
+
+  if (anim == nullptr) { // Bind pose
+    ticks = 0;
+  }
+  else if (timeStep > 0.0 && anim->ticksPerSecond > 0.0) {
+    const double ticksPerStep = timeStep * anim->ticksPerSecond;
+    ticks = std::floor(ticks / ticksPerStep) * ticksPerStep;
+  }
+
+  Entry *entry;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::unique_ptr<Entry> &entryPtr = entries[{ model, animationIndex, ticks }];
+    if (!entryPtr) {
+      entryPtr = std::make_unique<Entry>();
+    }
+    entry = entryPtr.get();
+    entry->lastUsedFrame = frame;
+  }
+
+  // Evaluate outside the lock so that distinct poses are built in parallel
+  std::call_once(entry->evaluated, [&]() { model->getAnimationPose(anim, ticks, entry->pose); });
+
+  return &entry->pose;
+}
+
+int PoseCache::size() const
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  return (int)entries.size();
+}
+
+}
@@ -0,0 +1,117 @@
+#include <husky/render/Animator.hpp>
+#include <husky/mesh/PoseCache.hpp>
+#include <husky/render/Camera.hpp>
+#include <husky/render/Viewport.hpp>
+#include <husky/util/ThreadPool.hpp>
+#include <algorithm>
+#include <atomic>
+
+namespace husky {
+
+Animator::Animator(ThreadPool *threadPool)
+  : grainSize(4)
+  , fullRateScreenSize(200)
+  , maxUpdateInterval(0.25)
+  , poseCache(nullptr)
+  , numFullRate(0)
+  , numReducedRate(0)
+  , numOffscreen(0)
+  , threadPool(threadPool ? threadPool : &ThreadPool::global())
+{
+}
+
+void Animator::update(const std::vector<Entity*> &entities, double timeDelta)
+{
+  if (poseCache != nullptr) {
+    poseCache->beginFrame();
+  }
+
+  // Each entity only writes to its own ModelInstance, so the result is identical to updating serially
+  threadPool->parallelFor(0, (int)entities.size(), grainSize, [&](int begin, int end) {
+    for (int i = begin; i < end; i++) {
+      if (poseCache != nullptr) {
+        entities[i]->modelInstance.animate(timeDelta, *poseCache);
+      }
+      else {
+        entities[i]->update(timeDelta);
+      }
+    }
+  });
+
+  numFullRate = (int)entities.size();
+  numReducedRate = 0;
+  numOffscreen = 0;
+}
+
+void Animator::update(const std::vector<Entity*> &entities, double timeDelta, const Camera &cam, const Viewport &viewport)
+{
+  if (poseCache != nullptr) {
+    poseCache->beginFrame();
+  }
+
+  const Frustum frustum = cam.frustum();
+  std::atomic<int> fullRateCount(0);
+  std::atomic<int> reducedRateCount(0);
+  std::atomic<int> offscreenCount(0);
+
+  threadPool->parallelFor(0, (int)entities.size(), grainSize, [&](int begin, int end) {
+    for (int i = begin; i < end; i++) {
+      ModelInstance &modelInstance = entities[i]->modelInstance;
+      const double updateInterval = getUpdateInterval(*entities[i], timeDelta, cam, frustum, viewport);
+
+      if (updateInterval < 0.0) { // Keep time running so the animation is in sync when it comes into view
+        modelInstance.advance(timeDelta);
+        offscreenCount++;
+      }
+      else if (poseCache != nullptr) { // Shared poses are cheap regardless of screen size
+        modelInstance.animate(timeDelta, *poseCache);
+        fullRateCount++;
+      }
+      else if (updateInterval > 0.0) {
+        modelInstance.animate(timeDelta, updateInterval);
+        reducedRateCount++;
+      }
+      else {
+        modelInstance.animate(timeDelta);
+        fullRateCount++;
+      }
+    }
+  });
+
+  numFullRate = fullRateCount;
+  numReducedRate = reducedRateCount;
+  numOffscreen = offscreenCount;
+}
+
+double Animator::getUpdateInterval(const Entity &entity, double timeDelta, const Camera &cam, const Frustum &frustum, const Viewport &viewport) const
+{
+  const Matrix44d mtxTransform = entity.getTransform() * entity.modelInstance.mtxTransform;
+  const Box bboxLocal = entity.modelInstance.getBbox();
+
+  const double scale = std::max({ mtxTransform.col[0].xyz.length(), mtxTransform.col[1].xyz.length(), mtxTransform.col[2].xyz.length() });
+  const Sphere bsphere((mtxTransform * Vector4d(bboxLocal.center(), 1.0)).xyz, bboxLocal.radius() * scale);
+
+  if (frustum.touches(bsphere) == Frustum::IntersectionResult::OUTSIDE) {
+    return -1.0;
+  }
+
+  // Approximate projected diameter in pixels
+  double screenSize;
+  if (cam.isOrtho()) {
+    screenSize = (2.0 * bsphere.radius / cam.orthoHeight) * viewport.height;
+  }
+  else {
+    const double dist = std::max((bsphere.center - cam.pos).length() - bsphere.radius, cam.nearDist);
+    screenSize = (bsphere.radius / (dist * std::tan(cam.vfovRad * 0.5))) * viewport.height;
+  }
+
+  if (screenSize >= fullRateScreenSize) {
+    return 0.0;
+  }
+
+  // Skip proportionally more frames the smaller the entity gets
+  const double frameSkip = fullRateScreenSize / std::max(screenSize, 1.0);
+  return std::min(timeDelta * frameSkip, maxUpdateInterval);
+}
+
+}
@@ -0,0 +1,121 @@
+#include <husky/render/BakedAnimation.hpp>
+#include <husky/mesh/Model.hpp>
+#include <husky/math/Vector4.hpp>
+#include <husky/render/RenderState.hpp>
+#include <husky/render/Shader.hpp>
+#include <husky/Log.hpp>
+#include <glad/glad.h>
+#include <algorithm>
+#include <cmath>
+
+namespace husky {
+
+BakedAnimation BakedAnimation::bake(const Model &model, int animationIndex, double framesPerSecond)
+{
+  if (animationIndex < 0 || animationIndex >= (int)model.animations.size()) {
+    Log::warning("Invalid animation index: %d", animationIndex);
+    return {};
+  }
+
+  const Animation &anim = model.animations[animationIndex];
+  if (anim.ticksPerSecond <= 0.0 || anim.durationTicks <= 0.0 || framesPerSecond <= 0.0) {
+    Log::warning("Cannot bake animation: %s", anim.name.c_str());
+    return {};
+  }
+
+  BakedAnimation baked;
+
+  // Assign each skinned mesh a range of bones within a row
+  baked.meshBoneOffsets.resize(model.meshes.size(), -1);
+  for (int iMesh = 0; iMesh < (int)model.meshes.size(); iMesh++) {
+    const Mesh &mesh = model.meshes[iMesh].mesh;
+    if (mesh.hasBones() && mesh.hasBoneWeights()) {
+      baked.meshBoneOffsets[iMesh] = baked.boneCount;
+      baked.boneCount += (int)mesh.getBones().size();
+    }
+  }
+
+  if (baked.boneCount == 0) {
+    Log::warning("Model has no skinned meshes: %s", model.name.c_str());
+    return {};
+  }
+
+  const double durationSeconds = anim.durationTicks / anim.ticksPerSecond;
+  baked.frameCount = std::max((int)std::round(durationSeconds * framesPerSecond), 1);
+  baked.framesPerSecond = baked.frameCount / durationSeconds;
+
+  Image image(baked.boneCount * 4, baked.frameCount, ImageFormat::RGBA32F);
+  AnimationPose pose;
+
+  for (int iFrame = 0; iFrame < baked.frameCount; iFrame++) {
+    model.getAnimationPose(&anim, anim.getTicks(iFrame / baked.framesPerSecond), pose);
+
+    for (int iMesh = 0; iMesh < (int)model.meshes.size(); iMesh++) {
+      const int boneOffset = baked.meshBoneOffsets[iMesh];
+      if (boneOffset == -1) {
+        continue;
+      }
+
+      const int meshBoneCount = (int)model.meshes[iMesh].mesh.getBones().size();
+      const std::vector<Matrix44f> &mtxBones = pose.mtxBones[iMesh];
+
+      for (int iBone = 0; iBone < meshBoneCount; iBone++) {
+        const Matrix44f mtxBone = (iBone < (int)mtxBones.size() ? mtxBones[iBone] : Matrix44f::identity());
+        for (int iCol = 0; iCol < 4; iCol++) {
+          image.setPixel((boneOffset + iBone) * 4 + iCol, iFrame, mtxBone.col[iCol]);
+        }
+      }
+    }
+  }
+
+  baked.texture = Texture(image, TexWrap::CLAMP, TexFilter::NEAREST, TexMipmaps::NONE);
+  return baked;
+}
+
+BakedAnimation::BakedAnimation()
+  : texture()
+  , meshBoneOffsets()
+  , boneCount(0)
+  , frameCount(0)
+  , framesPerSecond(0)
+{
+}
+
+bool BakedAnimation::valid() const
+{
+  return (texture.valid() && frameCount > 0);
+}
+
+double BakedAnimation::getDuration() const
+{
+  return (framesPerSecond > 0.0 ? frameCount / framesPerSecond : 0.0);
+}
+
+void BakedAnimation::bind(const Shader &shader, double time, int meshBoneOffset) const
+{
+  RenderState &renderState = RenderState::global();
+  renderState.useProgram(shader.shaderProgramHandle);
+
+  if (const ShaderUniform &uniform = shader.getUniform(UniformSlot::BAKED_BONES)) {
+    renderState.bindTexture(1, texture.handle);
+    glUniform1i(uniform.location, 1);
+  }
+
+  if (const ShaderUniform &uniform = shader.getUniform(UniformSlot::BAKED_TIME)) {
+    glUniform1f(uniform.location, (float)std::fmod(time, getDuration())); // Keep float precision for long running times
+  }
+
+  if (const ShaderUniform &uniform = shader.getUniform(UniformSlot::BAKED_FRAMES_PER_SECOND)) {
+    glUniform1f(uniform.location, (float)framesPerSecond);
+  }
+
+  if (const ShaderUniform &uniform = shader.getUniform(UniformSlot::BAKED_FRAME_COUNT)) {
+    glUniform1i(uniform.location, frameCount);
+  }
+
+  if (const ShaderUniform &uniform = shader.getUniform(UniformSlot::BAKED_BONE_OFFSET)) {
+    glUniform1i(uniform.location, meshBoneOffset);
+  }
+}
+
+}
@@ -0,0 +1,105 @@
+#include <husky/render/BonePaletteBuffer.hpp>
+#include <husky/mesh/Model.hpp>
+#include <husky/render/RenderState.hpp>
+#include <husky/render/RingBuffer.hpp>
+#include <glad/glad.h>
+
+namespace husky {
+
+BonePaletteBuffer::BonePaletteBuffer(int binding)
+  : binding(binding)
+  , ringBuffer(nullptr)
+  , mtxBones(1, Matrix44f::identity())
+  , poseOffsets()
+  , buffer(0)
+  , bufferBoneCount(0)
+{
+}
+
+BonePaletteBuffer::~BonePaletteBuffer()
+{
+  if (buffer != 0) {
+    RenderState::global().deleteBuffer(buffer);
+  }
+}
+
+void BonePaletteBuffer::beginFrame()
+{
+  mtxBones.resize(1);
+  poseOffsets.clear();
+}
+
+int BonePaletteBuffer::add(const std::vector<Matrix44f> &palette)
+{
+  if (palette.empty()) {
+    return 0;
+  }
+
+  const int offset = (int)mtxBones.size();
+  mtxBones.insert(mtxBones.end(), palette.begin(), palette.end());
+  return offset;
+}
+
+void BonePaletteBuffer::add(ModelInstance &modelInstance)
+{
+  modelInstance.boneOffsets.clear();
+
+  if (modelInstance.bakedAnimation != nullptr) {
+    return;
+  }
+
+  const AnimationPose &pose = modelInstance.getPose();
+
+  auto it = poseOffsets.find(&pose);
+  if (it != poseOffsets.end()) { // Already added this frame
+    modelInstance.boneOffsets = it->second;
+    return;
+  }
+
+  std::vector<int> offsets(pose.mtxBones.size(), -1); // Unskinned meshes keep -1
+  for (int iMesh = 0; iMesh < (int)pose.mtxBones.size(); iMesh++) {
+    if (!pose.mtxBones[iMesh].empty()) {
+      offsets[iMesh] = add(pose.mtxBones[iMesh]);
+    }
+  }
+
+  poseOffsets[&pose] = offsets;
+  modelInstance.boneOffsets = std::move(offsets);
+}
+
+void BonePaletteBuffer::upload()
+{
+  RenderState &renderState = RenderState::global();
+  const int boneCount = (int)mtxBones.size();
+
+  if (ringBuffer != nullptr) {
+    const RingAllocation palettes = ringBuffer->upload(mtxBones.data(), boneCount * sizeof(Matrix44f));
+    if (palettes.valid()) {
+      renderState.bindBufferRange(GL_SHADER_STORAGE_BUFFER, binding, palettes.buffer, palettes.offset, palettes.size);
+      return;
+    }
+  }
+
+  if (buffer == 0) {
+    glGenBuffers(1, &buffer);
+  }
+
+  renderState.bindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+
+  if (bufferBoneCount < boneCount) { // Grow with some headroom to avoid reallocating every frame
+    bufferBoneCount = boneCount + boneCount / 2;
+  }
+
+  // Orphan the previous contents so the driver does not stall on draws still reading them
+  glBufferData(GL_SHADER_STORAGE_BUFFER, bufferBoneCount * sizeof(Matrix44f), nullptr, GL_STREAM_DRAW);
+  glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, boneCount * sizeof(Matrix44f), mtxBones.data());
+
+  renderState.bindBufferBase(GL_SHADER_STORAGE_BUFFER, binding, buffer);
+}
+
+int BonePaletteBuffer::numBones() const
+{
+  return (int)mtxBones.size();
+}
+
+}
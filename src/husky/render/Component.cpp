@@ -100,8 +100,7 @@ void DebugDrawComponent::draw(const Viewport &viewport, const Matrix44f &view, c
     //Matrix44f sphereModelView(instanceModelView * Matrix44f::translate(Vector3f(model->bsphereLocal.center)) * Matrix44f::scale(Vector3f((float)model->bsphereLocal.radius)));
     //sphereRenderData.draw(lineShader, sphereMaterial, viewport, view, sphereModelView, projection);
 
-    for (const auto &pair : modelInstance.animNodes) {
-      const AnimatedNode &animNode = pair.second;
+    for (const AnimatedNode &animNode : modelInstance.getPose().nodes) {
       const Material &mtl = (animNode.animated ? boneMaterialAnimated : boneMaterial);
       Matrix44f boneModelView(instanceModelView * (Matrix44f)animNode.mtxRelToModel);
       boneRenderData.draw(defaultShader, mtl, viewport, view, boneModelView, projection);
@@ -0,0 +1,190 @@
+#include <husky/render/CullingPass.hpp>
+#include <husky/math/Frustum.hpp>
+#include <husky/render/DepthPyramid.hpp>
+#include <husky/render/RenderState.hpp>
+#include <husky/render/RingBuffer.hpp>
+#include <husky/render/Shader.hpp>
+#include <glad/glad.h>
+#include <algorithm>
+
+namespace husky {
+
+static constexpr int cullingDrawsBinding = 2;
+static constexpr int drawCommandsBinding = 3; // Also used by SkinningPass
+static constexpr int visibleDrawsBinding = 4; // Also used by ImpostorBaker; every binding here is rebound before each dispatch
+
+static const Shader& getCullingShader()
+{
+  static const Shader cullingShader = Shader::getComputeShader(
+R"(#version 430 core
+layout(local_size_x = 64) in;
+struct DrawCommand { uint indexCount; uint instanceCount; uint firstIndex; int baseVertex; uint baseInstance; };
+struct CullingDraw { vec4 boundingSphere; uint firstCommand; uint commandCount; uint drawId; uint padding; };
+layout(std430, binding = 1) readonly buffer DrawParams { mat4 drawModelViews[]; };
+layout(std430, binding = 2) readonly buffer CullingDraws { CullingDraw cullingDraws[]; };
+layout(std430, binding = 3) buffer DrawCommands { DrawCommand drawCommands[]; };
+layout(std430, binding = 4) buffer VisibleDraws { uint visibleCount; uint visibleDrawIds[]; };
+uniform int drawCount = 0;
+uniform vec4 frustumPlanes[6]; // View space; see Frustum
+uniform bool occlusion = false;
+uniform sampler2D depthPyramid;
+uniform int pyramidLevelCount = 1;
+uniform mat4 mtxViewToPrevClip; // Current view space to the clip space of the depth pyramid frame
+uniform bool reversedZ = false;
+bool isOccluded(vec3 center, float radius) {
+  vec2 uvMin = vec2(1.0);
+  vec2 uvMax = vec2(0.0);
+  float nearest = (reversedZ ? 0.0 : 1.0);
+  for (int i = 0; i < 8; i++) {
+    vec3 corner = center + radius * vec3((i & 1) != 0 ? 1.0 : -1.0, (i & 2) != 0 ? 1.0 : -1.0, (i & 4) != 0 ? 1.0 : -1.0);
+    vec4 clip = mtxViewToPrevClip * vec4(corner, 1.0);
+    if (clip.w <= 0.0) {
+      return false; // Crosses the camera plane
+    }
+    vec3 ndc = clip.xyz / clip.w;
+    uvMin = min(uvMin, ndc.xy * 0.5 + 0.5);
+    uvMax = max(uvMax, ndc.xy * 0.5 + 0.5);
+    float depth = (reversedZ ? ndc.z : ndc.z * 0.5 + 0.5);
+    nearest = (reversedZ ? max(nearest, depth) : min(nearest, depth));
+  }
+  if (any(greaterThan(uvMin, vec2(1.0))) || any(lessThan(uvMax, vec2(0.0)))) {
+    return false; // Outside the previous view; no depth to test against
+  }
+  uvMin = clamp(uvMin, 0.0, 1.0);
+  uvMax = clamp(uvMax, 0.0, 1.0);
+  // The level where the bounds span at most two texels in each direction
+  vec2 extent = (uvMax - uvMin) * vec2(textureSize(depthPyramid, 0));
+  int lod = clamp(int(ceil(log2(max(max(extent.x, extent.y), 1.0)))), 0, pyramidLevelCount - 1);
+  ivec2 levelSize = textureSize(depthPyramid, lod);
+  ivec2 p0 = clamp(ivec2(uvMin * vec2(levelSize)), ivec2(0), levelSize - 1);
+  ivec2 p1 = clamp(ivec2(uvMax * vec2(levelSize)), ivec2(0), levelSize - 1);
+  vec4 depths = vec4(texelFetch(depthPyramid, p0, lod).r, texelFetch(depthPyramid, ivec2(p1.x, p0.y), lod).r,
+                     texelFetch(depthPyramid, ivec2(p0.x, p1.y), lod).r, texelFetch(depthPyramid, p1, lod).r);
+  if (reversedZ) {
+    return (nearest < min(min(depths.x, depths.y), min(depths.z, depths.w)));
+  }
+  return (nearest > max(max(depths.x, depths.y), max(depths.z, depths.w)));
+}
+void main() {
+  uint iDraw = gl_GlobalInvocationID.x;
+  if (iDraw >= uint(drawCount)) {
+    return;
+  }
+  CullingDraw draw = cullingDraws[iDraw];
+  mat4 mtxModelView = drawModelViews[draw.drawId];
+  vec3 center = (mtxModelView * vec4(draw.boundingSphere.xyz, 1.0)).xyz;
+  float scale = max(length(mtxModelView[0].xyz), max(length(mtxModelView[1].xyz), length(mtxModelView[2].xyz)));
+  float radius = draw.boundingSphere.w * scale;
+  bool visible = true;
+  for (int i = 0; i < 6 && visible; i++) {
+    visible = (dot(frustumPlanes[i].xyz, center) + frustumPlanes[i].w > -radius);
+  }
+  if (visible && occlusion) {
+    visible = !isOccluded(center, radius);
+  }
+  for (uint i = 0; i < draw.commandCount; i++) {
+    drawCommands[draw.firstCommand + i].instanceCount = (visible ? 1 : 0);
+  }
+  if (visible) {
+    visibleDrawIds[atomicAdd(visibleCount, 1)] = draw.drawId;
+  }
+})");
+
+  return cullingShader;
+}
+
+CullingPass::CullingPass()
+  : depthPyramid(nullptr)
+  , ringBuffer(nullptr)
+  , numCandidates(0)
+  , drawBuffer(0)
+  , visibleBuffer(0)
+  , visibleBufferSize(0)
+{
+}
+
+CullingPass::~CullingPass()
+{
+  if (drawBuffer != 0) {
+    RenderState::global().deleteBuffer(drawBuffer);
+    RenderState::global().deleteBuffer(visibleBuffer);
+  }
+}
+
+void CullingPass::cull(unsigned int commandBuffer, std::size_t commandOffset, const std::vector<CullingDraw> &draws, const Matrix44f &view, const Matrix44f &projection)
+{
+  numCandidates = (int)draws.size();
+  if (draws.empty()) {
+    return;
+  }
+
+  if (drawBuffer == 0) {
+    glCreateBuffers(1, &drawBuffer);
+    glCreateBuffers(1, &visibleBuffer);
+  }
+
+  RenderState &renderState = RenderState::global();
+  const std::size_t drawBytes = draws.size() * sizeof(CullingDraw);
+  const RingAllocation ringDraws = (ringBuffer != nullptr ? ringBuffer->upload(draws.data(), drawBytes) : RingAllocation());
+  if (ringDraws.valid()) {
+    renderState.bindBufferRange(GL_SHADER_STORAGE_BUFFER, cullingDrawsBinding, ringDraws.buffer, ringDraws.offset, ringDraws.size);
+  }
+  else { // Orphan the previous contents so the driver does not stall on dispatches still reading them
+    glNamedBufferData(drawBuffer, drawBytes, draws.data(), GL_STREAM_DRAW);
+    renderState.bindBufferBase(GL_SHADER_STORAGE_BUFFER, cullingDrawsBinding, drawBuffer);
+  }
+
+  if (visibleBufferSize < numCandidates) {
+    visibleBufferSize = numCandidates + numCandidates / 2;
+    glNamedBufferData(visibleBuffer, (visibleBufferSize + 1) * sizeof(std::uint32_t), nullptr, GL_DYNAMIC_COPY);
+  }
+  const std::uint32_t zero = 0;
+  glClearNamedBufferSubData(visibleBuffer, GL_R32UI, 0, sizeof(std::uint32_t), GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+
+  std::uint32_t commandCount = 0;
+  for (const CullingDraw &draw : draws) {
+    commandCount = std::max(commandCount, draw.firstCommand + draw.commandCount);
+  }
+  renderState.bindBufferRange(GL_SHADER_STORAGE_BUFFER, drawCommandsBinding, commandBuffer, commandOffset, commandCount * 5 * sizeof(std::uint32_t)); // DrawCommand
+  renderState.bindBufferBase(GL_SHADER_STORAGE_BUFFER, visibleDrawsBinding, visibleBuffer);
+
+  const Shader &shader = getCullingShader();
+  renderState.useProgram(shader.shaderProgramHandle);
+  glUniform1i(shader.getUniform("drawCount").location, numCandidates);
+
+  // Same planes as the CPU-side frustum tests, but in view space, where the draw parameters are
+  const Frustum frustum((Matrix44d)projection);
+  float planes[Frustum::NUM_CLIPPING_PLANES * 4];
+  for (int i = 0; i < (int)Frustum::NUM_CLIPPING_PLANES; i++) {
+    const Vector4f plane = (Vector4f)frustum.getClippingPlane(i);
+    std::copy(plane.val, plane.val + 4, planes + i * 4);
+  }
+  glUniform4fv(shader.getUniform("frustumPlanes").location, Frustum::NUM_CLIPPING_PLANES, planes);
+
+  const bool occlusion = (depthPyramid != nullptr && depthPyramid->valid());
+  glUniform1i(shader.getUniform("occlusion").location, occlusion ? 1 : 0);
+  if (occlusion) {
+    const Matrix44f mtxViewToPrevClip = depthPyramid->viewProjection * view.inverted();
+    glUniformMatrix4fv(shader.getUniform("mtxViewToPrevClip").location, 1, GL_FALSE, mtxViewToPrevClip.m);
+    glUniform1i(shader.getUniform("pyramidLevelCount").location, depthPyramid->levelCount);
+    glUniform1i(shader.getUniform("reversedZ").location, depthPyramid->reversedZ ? 1 : 0);
+    glUniform1i(shader.getUniform("depthPyramid").location, 0);
+    renderState.bindTexture(0, depthPyramid->texture);
+  }
+
+  glDispatchCompute((numCandidates + 63) / 64, 1, 1);
+  glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+}
+
+int CullingPass::readVisibleCount() const
+{
+  if (visibleBuffer == 0 || numCandidates == 0) {
+    return 0;
+  }
+
+  std::uint32_t visibleCount = 0;
+  glGetNamedBufferSubData(visibleBuffer, 0, sizeof(visibleCount), &visibleCount);
+  return (int)visibleCount;
+}
+
+}
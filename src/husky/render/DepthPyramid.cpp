@@ -0,0 +1,104 @@
+#include <husky/render/DepthPyramid.hpp>
+#include <husky/render/RenderState.hpp>
+#include <husky/render/Shader.hpp>
+#include <glad/glad.h>
+#include <algorithm>
+
+namespace husky {
+
+static const Shader& getReduceShader()
+{
+  static const Shader reduceShader = Shader::getComputeShader(
+R"(#version 430 core
+layout(local_size_x = 8, local_size_y = 8) in;
+layout(r32f) writeonly uniform image2D dstLevel;
+uniform sampler2D srcDepth;
+uniform int srcLod = 0;
+uniform bool reversedZ = false;
+void main() {
+  ivec2 dstSize = imageSize(dstLevel);
+  ivec2 dst = ivec2(gl_GlobalInvocationID.xy);
+  if (dst.x >= dstSize.x || dst.y >= dstSize.y) {
+    return;
+  }
+  ivec2 srcSize = textureSize(srcDepth, srcLod);
+  ivec2 srcBegin = dst * 2;
+  ivec2 srcEnd = min(srcBegin + 2, srcSize);
+  if (dst.x == dstSize.x - 1) { srcEnd.x = srcSize.x; } // Odd source sizes; the last texel also covers the remainder
+  if (dst.y == dstSize.y - 1) { srcEnd.y = srcSize.y; }
+  float farthest = (reversedZ ? 1.0 : 0.0);
+  for (int y = srcBegin.y; y < srcEnd.y; y++) {
+    for (int x = srcBegin.x; x < srcEnd.x; x++) {
+      float depth = texelFetch(srcDepth, ivec2(x, y), srcLod).r;
+      farthest = (reversedZ ? min(farthest, depth) : max(farthest, depth));
+    }
+  }
+  imageStore(dstLevel, dst, vec4(farthest));
+})");
+
+  return reduceShader;
+}
+
+DepthPyramid::DepthPyramid()
+  : texture(0)
+  , width(0)
+  , height(0)
+  , levelCount(0)
+  , viewProjection(Matrix44f::identity())
+  , reversedZ(false)
+{
+}
+
+DepthPyramid::~DepthPyramid()
+{
+  if (texture != 0) {
+    glDeleteTextures(1, &texture);
+  }
+}
+
+void DepthPyramid::build(unsigned int depthTexture, int depthWidth, int depthHeight, const Matrix44f &viewProjection, bool reversedZ)
+{
+  const int newWidth = std::max(depthWidth / 2, 1);
+  const int newHeight = std::max(depthHeight / 2, 1);
+
+  if (texture == 0 || newWidth != width || newHeight != height) {
+    glDeleteTextures(1, &texture);
+    width = newWidth;
+    height = newHeight;
+    levelCount = 1;
+    while ((std::max(width, height) >> levelCount) > 0) {
+      levelCount++;
+    }
+    glCreateTextures(GL_TEXTURE_2D, 1, &texture);
+    glTextureStorage2D(texture, levelCount, GL_R32F, width, height);
+    glTextureParameteri(texture, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+    glTextureParameteri(texture, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  }
+
+  this->viewProjection = viewProjection;
+  this->reversedZ = reversedZ;
+
+  const Shader &shader = getReduceShader();
+  RenderState &renderState = RenderState::global();
+  renderState.useProgram(shader.shaderProgramHandle);
+  glUniform1i(shader.getUniform("srcDepth").location, 0);
+  glUniform1i(shader.getUniform("reversedZ").location, reversedZ ? 1 : 0);
+
+  // Level 0 reads the depth texture; each further level reads the one above it
+  for (int level = 0; level < levelCount; level++) {
+    const int levelWidth = std::max(width >> level, 1);
+    const int levelHeight = std::max(height >> level, 1);
+    renderState.bindTexture(0, level == 0 ? depthTexture : texture);
+    glUniform1i(shader.getUniform("srcLod").location, level == 0 ? 0 : level - 1);
+    glBindImageTexture(0, texture, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+    glDispatchCompute((levelWidth + 7) / 8, (levelHeight + 7) / 8, 1);
+    glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+  }
+}
+
+bool DepthPyramid::valid() const
+{
+  return (texture != 0);
+}
+
+}
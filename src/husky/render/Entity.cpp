@@ -1,5 +1,6 @@
 #include <husky/render/Entity.hpp>
 #include <husky/render/Component.hpp>
+#include <husky/render/RenderQueue.hpp>
 #include <husky/mesh/Mesh.hpp>
 #include <husky/Log.hpp>
 
@@ -12,6 +13,7 @@ Entity::Entity(const std::string &name, const Shader *shader, const Model *model
   , modelInstance(model)
   , bboxLocal()
   , bsphereLocal()
+  , occluder(false)
   , components()
 {
   calcBbox();
@@ -22,13 +24,27 @@ void Entity::update(double timeDelta)
   modelInstance.animate(timeDelta);
 }
 
-void Entity::draw(const Viewport &viewport, const Camera &cam) const
+void Entity::draw(RenderQueue &queue, const Viewport &viewport, const Camera &cam) const
 {
   const Matrix44f view(cam.view);
   const Matrix44f modelView(cam.view * mtxTransform);
   const Matrix44f projection(cam.proj);
 
-  modelInstance.draw(*shader, viewport, view, modelView, projection);
+  modelInstance.draw(queue, *shader, viewport, view, modelView, projection);
+  drawComponents(viewport, cam);
+}
+
+void Entity::enqueue(RenderQueue &queue, const Camera &cam) const
+{
+  const Matrix44f modelView(cam.view * mtxTransform);
+  modelInstance.enqueue(queue, *shader, modelView);
+}
+
+void Entity::drawComponents(const Viewport &viewport, const Camera &cam) const
+{
+  const Matrix44f view(cam.view);
+  const Matrix44f modelView(cam.view * mtxTransform);
+  const Matrix44f projection(cam.proj);
 
   for (const IComponent *component : components) {
     component->draw(viewport, view, modelView, projection);
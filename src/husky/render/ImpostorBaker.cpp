@@ -0,0 +1,420 @@
+#include <husky/render/ImpostorBaker.hpp>
+#include <husky/image/BlockCompression.hpp>
+#include <husky/math/EulerAngles.hpp>
+#include <husky/math/Math.hpp>
+#include <husky/render/Camera.hpp>
+#include <husky/render/Entity.hpp>
+#include <husky/render/RenderState.hpp>
+#include <husky/render/ShaderRegistry.hpp>
+#include <husky/render/Viewport.hpp>
+#include <husky/util/HashUtil.hpp>
+#include <husky/util/ThreadPool.hpp>
+#include <husky/Log.hpp>
+#include <glad/glad.h>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+namespace fs = std::experimental::filesystem;
+
+namespace husky {
+
+static constexpr std::uint32_t cacheMagic = 0x49504d48; // "HMPI"
+static constexpr std::uint32_t cacheVersion = 2; // Bump when baking changes what a cell looks like
+static constexpr int cellsBinding = 4; // Shader storage binding of the view cells; shared with CullingPass, as both bind right before use
+
+class CacheHeader // Precedes the BC3 mip levels in cache files
+{
+public:
+  std::uint32_t magic;
+  std::uint32_t version;
+  std::uint64_t key;
+  std::int32_t width;
+  std::int32_t height;
+  std::int32_t numLevels;
+  std::int32_t reserved; // Keeps the size a multiple of 8
+};
+
+class GpuCell // std430 layout of ImpostorCell in the bake shader
+{
+public:
+  Matrix44f mtxView; // Cell view times entity transform
+  Vector4f lightDir; // Cell view space
+  Vector4f rect; // Normalized device coordinates of the cell in the whole texture; x0, y0, x1, y1
+};
+
+static Vector3d octahedralToDirection(double u, double v, bool hemi) // u, v in [0,1]
+{
+  double x = u * 2.0 - 1.0;
+  double y = v * 2.0 - 1.0;
+  if (hemi) { // Rotated by 45 degrees, so the square covers the upper half only
+    const double rx = (x + y) * 0.5;
+    const double ry = (x - y) * 0.5;
+    x = rx;
+    y = ry;
+  }
+
+  double z = 1.0 - std::abs(x) - std::abs(y);
+  if (z < 0.0) { // Lower half of the full octahedron; fold the corners under
+    const double fx = (1.0 - std::abs(y)) * (x < 0.0 ? -1.0 : 1.0);
+    const double fy = (1.0 - std::abs(x)) * (y < 0.0 ? -1.0 : 1.0);
+    x = fx;
+    y = fy;
+  }
+  return Vector3d(x, y, z).normalized();
+}
+
+static Camera getCellCamera(ImpostorLayout layout, int numCellsX, int numCellsY, int iCellX, int iCellY)
+{
+  Camera cam;
+  if (layout == ImpostorLayout::LON_LAT) { // Same angles as the SPHERICAL billboard shader expects
+    const double u = (iCellX / (double)numCellsX);
+    const double v = (iCellY / (double)std::max(numCellsY - 1, 1));
+    const double lonRad = -(Math::pi + u * Math::twoPi);
+    const double latRad = (-v * Math::twoPi);
+    cam.rot = EulerAnglesd(RotationOrder::ZXY, lonRad, latRad, 0).toQuaternion();
+  }
+  else {
+    const Vector3d dir = octahedralToDirection((iCellX + 0.5) / numCellsX, (iCellY + 0.5) / numCellsY, layout == ImpostorLayout::HEMI_OCTAHEDRAL);
+    cam.pos = dir;
+    cam.lookAt({ 0, 0, 0 }, (std::abs(dir.z) < 0.999 ? Vector3d(0, 0, 1) : Vector3d(0, 1, 0))); // Z up, except looking straight up or down
+  }
+  return cam;
+}
+
+Vector3d ImpostorBaker::getCellDirection(ImpostorLayout layout, int numCellsX, int numCellsY, int iCellX, int iCellY)
+{
+  return -getCellCamera(layout, numCellsX, numCellsY, iCellX, iCellY).forward();
+}
+
+static const Shader& getBakeShader()
+{
+  static const char *bakeVertSrc =
+R"(#version 430 core
+struct ImpostorCell {
+  mat4 mtxView;
+  vec4 lightDir;
+  vec4 rect;
+};
+layout(std430, binding = 4) readonly buffer ImpostorCells { ImpostorCell cells[]; }; // See ImpostorBaker::bake()
+uniform mat4 mtxModelView; // Node to model; the cell supplies the view
+uniform mat4 mtxProjection; // Same for all cells
+in vec3 vertPosition;
+in vec3 vertNormal;
+in vec2 vertTexCoord;
+in vec4 vertColor;
+out vec3 varNormal;
+out vec2 varTexCoord;
+out vec4 varColor;
+flat out vec3 varLightDir;
+void main() {
+  ImpostorCell cell = cells[gl_InstanceID];
+  mat4 mtxCellModelView = cell.mtxView * mtxModelView;
+  varNormal = normalize(mat3(mtxCellModelView) * vertNormal); // Uniform scaling only
+  varTexCoord = vec2(vertTexCoord.x, 1.0 - vertTexCoord.y); // Flip V
+  varColor = vertColor;
+  varLightDir = cell.lightDir.xyz;
+
+  // Squeeze the cell's view into its rectangle, and clip what falls outside
+  vec4 pos = mtxProjection * (mtxCellModelView * vec4(vertPosition, 1.0));
+  pos.xy = mix(cell.rect.xy, cell.rect.zw, pos.xy / pos.w * 0.5 + 0.5) * pos.w;
+  gl_ClipDistance[0] = pos.x - cell.rect.x * pos.w;
+  gl_ClipDistance[1] = cell.rect.z * pos.w - pos.x;
+  gl_ClipDistance[2] = pos.y - cell.rect.y * pos.w;
+  gl_ClipDistance[3] = cell.rect.w * pos.w - pos.y;
+  gl_Position = pos;
+})";
+
+  static const char *bakeFragSrc =
+R"(#version 430 core
+layout(std140) uniform FrameUniforms {
+  mat4 mtxProjectionFrame;
+  vec4 lightDir;
+  vec4 lightAmbient;
+  vec4 lightDiffuse;
+  vec4 lightSpecular;
+  vec4 viewportSize;
+};
+layout(std140) uniform MaterialUniforms {
+  vec4 mtlAmbient;
+  vec4 mtlDiffuse;
+  vec4 mtlSpecular;
+  vec4 mtlEmissive;
+  float mtlShininess;
+  float mtlShininessStrength;
+  float lineWidth;
+  float opacity;
+};
+uniform sampler2D tex;
+in vec3 varNormal;
+in vec2 varTexCoord;
+in vec4 varColor;
+flat in vec3 varLightDir;
+out vec4 fragColor;
+void main() {
+  // Like the default shader, but lit from a fixed world direction in every cell and viewed orthographically
+  vec3 N = normalize(varNormal);
+  vec3 L = varLightDir;
+  vec3 E = vec3(0.0, 0.0, 1.0);
+  vec3 R = normalize(-reflect(L, N));
+  vec3 ambientColor = (lightAmbient.rgb * mtlAmbient.rgb);
+  vec3 diffuseColor = clamp(dot(N, L), 0.0, 1.0) * lightDiffuse.rgb * mtlDiffuse.rgb;
+  vec3 specularColor = clamp(pow(max(dot(R, E), 0.0), mtlShininess) * mtlShininessStrength, 0.0, 1.0) * lightSpecular.rgb * mtlSpecular.rgb;
+  vec4 texColor = texture(tex, varTexCoord);
+  fragColor.rgb = ambientColor + (diffuseColor * varColor.rgb * texColor.rgb) + specularColor + mtlEmissive.rgb;
+  fragColor.a = varColor.a * texColor.a * opacity;
+})";
+
+  static const Shader bakeShader = ShaderRegistry::global().get(ShaderSource::graphics(bakeVertSrc, "", bakeFragSrc));
+  return bakeShader;
+}
+
+ImpostorBaker::ImpostorBaker()
+  : cacheDirectory()
+  , numBaked(0)
+  , numLoaded(0)
+{
+}
+
+MultidirTexture ImpostorBaker::bake(const Entity &entity, int texWidth, int texHeight, ImpostorLayout layout, int numCellsX, int numCellsY)
+{
+  if (texWidth <= 0 || texHeight <= 0 || numCellsX <= 0 || numCellsY <= 0) {
+    Log::warning("Invalid impostor size: %dx%d texels, %dx%d cells", texWidth, texHeight, numCellsX, numCellsY);
+    return {};
+  }
+
+  const std::uint64_t key = (cacheDirectory.empty() ? 0 : getCacheKey(entity, texWidth, texHeight, layout, numCellsX, numCellsY));
+  if (!cacheDirectory.empty()) {
+    const CompressedImage image = loadCached(key, texWidth, texHeight);
+    if (image.valid()) {
+      numLoaded++;
+      return MultidirTexture(Texture(image, TexWrap::REPEAT, TexFilter::LINEAR), numCellsX, numCellsY, layout);
+    }
+  }
+
+  const Shader &shader = getBakeShader();
+  const Model *model = entity.modelInstance.model;
+  if (shader.shaderProgramHandle == 0 || model == nullptr) {
+    return {};
+  }
+
+  MultidirTexture mdTex(Texture(ImageFormat::RGBA8, texWidth, texHeight, TexWrap::REPEAT, TexFilter::LINEAR, TexMipmaps::STANDARD, nullptr), numCellsX, numCellsY, layout);
+
+  GLuint fbo = 0;
+  glCreateFramebuffers(1, &fbo);
+  GLuint depthBuf = 0;
+  glCreateRenderbuffers(1, &depthBuf);
+  glNamedRenderbufferStorage(depthBuf, GL_DEPTH_COMPONENT24, texWidth, texHeight);
+  glNamedFramebufferRenderbuffer(fbo, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthBuf);
+  glNamedFramebufferTexture(fbo, GL_COLOR_ATTACHMENT0, mdTex.tex.handle, 0);
+
+  if (glCheckNamedFramebufferStatus(fbo, GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+    Log::warning("Incomplete FBO");
+    glDeleteFramebuffers(1, &fbo);
+    glDeleteRenderbuffers(1, &depthBuf);
+    return mdTex;
+  }
+
+  // One view per cell, centered on the bounding sphere
+  const Matrix44d mtxModel = entity.getTransform() * entity.modelInstance.mtxTransform;
+  const Vector3d center = (mtxModel * Vector4d(entity.bsphereLocal.center, 1.0)).xyz;
+  const double radius = entity.bsphereLocal.radius;
+  const Vector3d worldLightDir(20, -40, 100); // Same as FrameUniforms
+
+  std::vector<GpuCell> cells;
+  cells.reserve(std::size_t(numCellsX) * numCellsY);
+  for (int iCellY = 0; iCellY < numCellsY; iCellY++) {
+    for (int iCellX = 0; iCellX < numCellsX; iCellX++) {
+      Camera cam = getCellCamera(layout, numCellsX, numCellsY, iCellX, iCellY);
+      cam.pos = center - cam.forward() * (radius * 2.0);
+      cam.buildViewMatrix();
+
+      GpuCell cell;
+      cell.mtxView = (Matrix44f)(cam.view * mtxModel);
+      cell.lightDir = Vector4f((Vector3f)(cam.view * Vector4d(worldLightDir, 0.0)).xyz.normalized(), 0.f);
+      cell.rect = Vector4f(-1.f + 2.f * iCellX / numCellsX, -1.f + 2.f * iCellY / numCellsY, -1.f + 2.f * (iCellX + 1) / numCellsX, -1.f + 2.f * (iCellY + 1) / numCellsY);
+      cells.push_back(cell);
+    }
+  }
+
+  Camera cellCam; // Projection only; orthographic, so it is the same for every cell
+  cellCam.projMode = ProjectionMode::ORTHO;
+  cellCam.orthoHeight = (radius * 2.0);
+  cellCam.aspectRatio = (double(texWidth) / numCellsX) / (double(texHeight) / numCellsY);
+  cellCam.nearDist = radius;
+  cellCam.farDist = (radius * 3.0);
+  cellCam.buildProjMatrix();
+
+  GLuint cellsBuffer = 0;
+  glCreateBuffers(1, &cellsBuffer);
+  glNamedBufferData(cellsBuffer, cells.size() * sizeof(GpuCell), cells.data(), GL_STATIC_DRAW);
+
+  GLint prevViewport[4];
+  glGetIntegerv(GL_VIEWPORT, prevViewport);
+  glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+  glViewport(0, 0, texWidth, texHeight);
+  glClearColor(0, 0, 0, 0);
+  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+  for (int i = 0; i < 4; i++) {
+    glEnable(GL_CLIP_DISTANCE0 + i);
+  }
+
+  RenderState &renderState = RenderState::global();
+  renderState.bindBufferBase(GL_SHADER_STORAGE_BUFFER, cellsBinding, cellsBuffer);
+
+  Viewport viewport;
+  viewport.width = texWidth;
+  viewport.height = texHeight;
+
+  // Bind pose; meshes are drawn once for all cells
+  for (const ModelNode *node : model->nodes) {
+    for (int iMesh : node->meshIndices) {
+      const ModelMesh &mesh = model->meshes[iMesh];
+      if (mesh.renderData._indexData.primitiveType != PrimitiveType::TRIANGLES) {
+        continue;
+      }
+      if (!RenderData::bindDrawState(shader, model->getMaterial(mesh.materialIndex), viewport, Matrix44f::identity(), (Matrix44f)node->mtxRelToModel, (Matrix44f)cellCam.proj) || !mesh.renderData.bindVertexArray()) {
+        continue;
+      }
+
+      if (mesh.renderData.ebo != 0) {
+        for (const IndexChunk &chunk : mesh.renderData.indexChunks) {
+          const void *offset = ((const std::uint8_t*)nullptr) + chunk.firstIndex * sizeof(std::uint16_t);
+          glDrawElementsInstancedBaseVertex(GL_TRIANGLES, chunk.indexCount, GL_UNSIGNED_SHORT, offset, (GLsizei)cells.size(), chunk.baseVertex);
+        }
+      }
+      else {
+        glDrawArraysInstanced(GL_TRIANGLES, 0, mesh.renderData._vertData.vertCount, (GLsizei)cells.size());
+      }
+    }
+  }
+
+  for (int i = 0; i < 4; i++) {
+    glDisable(GL_CLIP_DISTANCE0 + i);
+  }
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  glViewport(prevViewport[0], prevViewport[1], prevViewport[2], prevViewport[3]);
+  renderState.deleteBuffer(cellsBuffer);
+  glDeleteFramebuffers(1, &fbo);
+  glDeleteRenderbuffers(1, &depthBuf);
+
+  mdTex.tex.buildMipmaps();
+  numBaked++;
+
+  if (!cacheDirectory.empty()) {
+    saveCached(key, CompressedImage::compress(mdTex.tex.downloadImageData(), BlockFormat::BC3, true, ThreadPool::global())); // A quarter of the size, and no mipmaps to build on load
+  }
+
+  return mdTex;
+}
+
+std::uint64_t ImpostorBaker::getCacheKey(const Entity &entity, int texWidth, int texHeight, ImpostorLayout layout, int numCellsX, int numCellsY) const
+{
+  std::uint64_t hash = HashUtil::initialHash;
+  hash = HashUtil::hashValue(cacheVersion, hash);
+  hash = HashUtil::hashValue(texWidth, hash);
+  hash = HashUtil::hashValue(texHeight, hash);
+  hash = HashUtil::hashValue(layout, hash);
+  hash = HashUtil::hashValue(numCellsX, hash);
+  hash = HashUtil::hashValue(numCellsY, hash);
+  hash = HashUtil::hashValue(entity.getTransform(), hash);
+  hash = HashUtil::hashValue(entity.modelInstance.mtxTransform, hash);
+
+  const Model *model = entity.modelInstance.model;
+  if (model == nullptr) {
+    return hash;
+  }
+
+  hash = HashUtil::hashString(model->name, hash);
+  for (const ModelNode *node : model->nodes) {
+    hash = HashUtil::hashValue(node->mtxRelToModel, hash);
+    for (int iMesh : node->meshIndices) {
+      const ModelMesh &mesh = model->meshes[iMesh];
+      hash = HashUtil::hashValue(mesh.mesh.hash(), hash); // The render data has released its CPU copy
+
+      const Material &mtl = model->getMaterial(mesh.materialIndex);
+      hash = HashUtil::hashValue(mtl.ambient, hash);
+      hash = HashUtil::hashValue(mtl.diffuse, hash);
+      hash = HashUtil::hashValue(mtl.specular, hash);
+      hash = HashUtil::hashValue(mtl.emissive, hash);
+      hash = HashUtil::hashValue(mtl.shininess, hash);
+      hash = HashUtil::hashValue(mtl.shininessStrength, hash);
+      hash = HashUtil::hashValue(mtl.opacity, hash);
+      hash = HashUtil::hashString(mtl.tex.imageFilePath, hash); // Textures without a file are assumed not to change
+    }
+  }
+
+  return hash;
+}
+
+CompressedImage ImpostorBaker::loadCached(std::uint64_t key, int texWidth, int texHeight) const
+{
+  std::ifstream ifs(fs::u8path(getCachePath(key)), std::ios::binary);
+  CacheHeader header;
+  if (!ifs || !ifs.read((char*)&header, sizeof(header))) {
+    return {};
+  }
+
+  if (header.magic != cacheMagic || header.version != cacheVersion || header.key != key || header.width != texWidth || header.height != texHeight
+    || header.numLevels < 1 || header.numLevels > 32) { // Stale; overwritten after baking
+    return {};
+  }
+
+  CompressedImage image;
+  image.format = BlockFormat::BC3;
+  image.width = texWidth;
+  image.height = texHeight;
+  image.levels.resize(header.numLevels);
+  for (int level = 0; level < header.numLevels; level++) {
+    const std::size_t numBlocks = std::size_t((image.getLevelWidth(level) + 3) / 4) * ((image.getLevelHeight(level) + 3) / 4);
+    image.levels[level].resize(numBlocks * CompressedImage::getBlockBytes(image.format));
+    if (!ifs.read((char*)image.levels[level].data(), image.levels[level].size())) {
+      return {};
+    }
+  }
+  return image;
+}
+
+void ImpostorBaker::saveCached(std::uint64_t key, const CompressedImage &image) const
+{
+  if (!image.valid() || image.format != BlockFormat::BC3) {
+    return;
+  }
+
+  const fs::path dir = fs::u8path(cacheDirectory);
+  if (!fs::is_directory(dir) && !fs::create_directories(dir)) {
+    Log::warning("Failed to create impostor cache directory: %s", cacheDirectory.c_str());
+    return;
+  }
+
+  CacheHeader header;
+  std::memset(&header, 0, sizeof(header));
+  header.magic = cacheMagic;
+  header.version = cacheVersion;
+  header.key = key;
+  header.width = image.width;
+  header.height = image.height;
+  header.numLevels = (std::int32_t)image.levels.size();
+
+  std::ofstream ofs(fs::u8path(getCachePath(key)), std::ios::binary | std::ios::trunc);
+  ofs.write((const char*)&header, sizeof(header));
+  for (const std::vector<std::uint8_t> &level : image.levels) {
+    ofs.write((const char*)level.data(), level.size());
+  }
+  if (!ofs) {
+    Log::warning("Failed to write impostor: %s", getCachePath(key).c_str());
+  }
+}
+
+std::string ImpostorBaker::getCachePath(std::uint64_t key) const
+{
+  std::ostringstream oss;
+  oss << cacheDirectory << "/" << std::hex << std::setw(16) << std::setfill('0') << key << ".impostor";
+  return oss.str();
+}
+
+}
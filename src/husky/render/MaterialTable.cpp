@@ -0,0 +1,228 @@
+#include <husky/render/MaterialTable.hpp>
+#include <husky/mesh/Material.hpp>
+#include <husky/render/RenderState.hpp>
+#include <husky/render/Shader.hpp>
+#include <husky/Log.hpp>
+#include <glad/glad.h>
+#include <algorithm>
+
+namespace husky {
+
+static GLenum getSizedFormat(GLint internalFormat)
+{
+  switch (internalFormat)
+  {
+  case GL_RGB  : { return GL_RGB8; } // Texture uses unsized formats; array storage needs sized ones
+  case GL_RGBA : { return GL_RGBA8; }
+  default      : { return (GLenum)internalFormat; }
+  }
+}
+
+MaterialTable::MaterialTable()
+  : entries()
+  , indices()
+  , textureArrays()
+  , buffer(0)
+{
+}
+
+MaterialTable::~MaterialTable()
+{
+  destroyArrays();
+  if (buffer != 0) {
+    RenderState::global().deleteBuffer(buffer);
+  }
+}
+
+int MaterialTable::add(const Material &material)
+{
+  auto it = indices.find(&material);
+  if (it != indices.end()) {
+    return it->second;
+  }
+
+  const int index = (int)entries.size();
+  entries.push_back({ &material, -1, -1, true });
+  indices[&material] = index;
+  return index;
+}
+
+void MaterialTable::build()
+{
+  destroyArrays();
+
+  GLint maxLayers = 256;
+  glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &maxLayers);
+
+  // Group textures by everything a texture array has in common
+  for (int iEntry = 0; iEntry < (int)entries.size(); iEntry++) {
+    Entry &entry = entries[iEntry];
+    entry.arrayIndex = -1;
+    entry.layer = -1;
+    entry.packed = true;
+
+    const Texture &tex = entry.material->tex;
+    if (!tex.valid() || tex.handle == Texture::white1x1().handle) { // Untextured; batches with other untextured materials
+      continue;
+    }
+
+    GLint baseLevel = 0, maxLevel = 0, width = 0, height = 0, internalFormat = 0;
+    glGetTextureParameteriv(tex.handle, GL_TEXTURE_BASE_LEVEL, &baseLevel);
+    glGetTextureParameteriv(tex.handle, GL_TEXTURE_MAX_LEVEL, &maxLevel);
+    glGetTextureLevelParameteriv(tex.handle, 0, GL_TEXTURE_WIDTH, &width);
+    glGetTextureLevelParameteriv(tex.handle, 0, GL_TEXTURE_HEIGHT, &height);
+    glGetTextureLevelParameteriv(tex.handle, 0, GL_TEXTURE_INTERNAL_FORMAT, &internalFormat);
+    if (baseLevel != 0 || width == 0 || height == 0) { // E.g., still streaming; drawn with its own texture instead
+      Log::warning("Texture %u is not fully resident; material is left out of the table", tex.handle);
+      entry.packed = false;
+      continue;
+    }
+
+    int numLevels = 1;
+    while (numLevels <= maxLevel) {
+      GLint levelWidth = 0;
+      glGetTextureLevelParameteriv(tex.handle, numLevels, GL_TEXTURE_WIDTH, &levelWidth);
+      if (levelWidth != std::max(width >> numLevels, 1)) {
+        break;
+      }
+      numLevels++;
+    }
+
+    auto it = std::find_if(textureArrays.begin(), textureArrays.end(), [&](const TextureArray &a) {
+      return (a.width == width && a.height == height && a.internalFormat == internalFormat && a.wrap == tex.wrap && a.filter == tex.filter && (int)a.entries.size() < maxLayers);
+    });
+    if (it == textureArrays.end()) {
+      textureArrays.push_back({ 0, width, height, internalFormat, numLevels, tex.wrap, tex.filter, {} });
+      it = textureArrays.end() - 1;
+    }
+
+    it->numLevels = std::min(it->numLevels, numLevels); // Levels missing from any layer are left out
+    entry.arrayIndex = (int)(it - textureArrays.begin());
+    entry.layer = (int)it->entries.size();
+    it->entries.push_back(iEntry);
+  }
+
+  // Copy on the GPU; block-compressed textures directly, others through a pixel buffer, since drivers may not consider unsized formats copy-compatible with sized ones
+  RenderState &renderState = RenderState::global();
+  GLuint pixelBuffer = 0;
+  for (TextureArray &textureArray : textureArrays) {
+    glCreateTextures(GL_TEXTURE_2D_ARRAY, 1, &textureArray.handle);
+    glTextureStorage3D(textureArray.handle, textureArray.numLevels, getSizedFormat(textureArray.internalFormat), textureArray.width, textureArray.height, (GLsizei)textureArray.entries.size());
+
+    GLint compressed = GL_FALSE;
+    glGetTextureLevelParameteriv(entries[textureArray.entries.front()].material->tex.handle, 0, GL_TEXTURE_COMPRESSED, &compressed);
+    const GLsizei levelBytes = textureArray.width * textureArray.height * 4; // RGBA8
+    if (compressed == GL_FALSE && pixelBuffer == 0) {
+      glCreateBuffers(1, &pixelBuffer);
+    }
+    if (compressed == GL_FALSE) {
+      glNamedBufferData(pixelBuffer, levelBytes, nullptr, GL_STREAM_COPY);
+      renderState.bindBuffer(GL_PIXEL_PACK_BUFFER, pixelBuffer);
+      renderState.bindBuffer(GL_PIXEL_UNPACK_BUFFER, pixelBuffer);
+      glPixelStorei(GL_PACK_ALIGNMENT, 4);
+      glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    }
+
+    for (int layer = 0; layer < (int)textureArray.entries.size(); layer++) {
+      const unsigned int srcTexture = entries[textureArray.entries[layer]].material->tex.handle;
+      for (int level = 0; level < textureArray.numLevels; level++) {
+        const int levelWidth = std::max(textureArray.width >> level, 1);
+        const int levelHeight = std::max(textureArray.height >> level, 1);
+        if (compressed != GL_FALSE) {
+          glCopyImageSubData(srcTexture, GL_TEXTURE_2D, level, 0, 0, 0, textureArray.handle, GL_TEXTURE_2D_ARRAY, level, 0, 0, layer, levelWidth, levelHeight, 1);
+        }
+        else {
+          glGetTextureImage(srcTexture, level, GL_RGBA, GL_UNSIGNED_BYTE, levelBytes, nullptr);
+          glTextureSubImage3D(textureArray.handle, level, 0, 0, layer, levelWidth, levelHeight, 1, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+        }
+      }
+    }
+
+    if (compressed == GL_FALSE) {
+      renderState.bindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+      renderState.bindBuffer(GL_PIXEL_UNPACK_BUFFER, 0); // Other uploads read client memory
+    }
+
+    const GLint wrap = (textureArray.wrap == TexWrap::CLAMP ? GL_CLAMP_TO_EDGE : textureArray.wrap == TexWrap::MIRROR ? GL_MIRRORED_REPEAT : GL_REPEAT);
+    const bool nearest = (textureArray.filter == TexFilter::NEAREST);
+    const bool mipmaps = (textureArray.numLevels > 1);
+    glTextureParameteri(textureArray.handle, GL_TEXTURE_WRAP_S, wrap);
+    glTextureParameteri(textureArray.handle, GL_TEXTURE_WRAP_T, wrap);
+    glTextureParameteri(textureArray.handle, GL_TEXTURE_MAG_FILTER, nearest ? GL_NEAREST : GL_LINEAR);
+    glTextureParameteri(textureArray.handle, GL_TEXTURE_MIN_FILTER, mipmaps ? (nearest ? GL_NEAREST_MIPMAP_NEAREST : GL_LINEAR_MIPMAP_LINEAR) : (nearest ? GL_NEAREST : GL_LINEAR));
+  }
+
+  if (pixelBuffer != 0) {
+    renderState.deleteBuffer(pixelBuffer);
+  }
+
+  std::vector<GpuMaterial> gpuMaterials;
+  gpuMaterials.reserve(entries.size());
+  for (const Entry &entry : entries) {
+    const Material &mtl = *entry.material;
+    gpuMaterials.push_back({ Vector4f(mtl.ambient, 0.f), Vector4f(mtl.diffuse, 0.f), Vector4f(mtl.specular, 0.f), Vector4f(mtl.emissive, 0.f), mtl.shininess, mtl.shininessStrength, mtl.opacity, entry.layer });
+  }
+
+  if (buffer == 0) {
+    glCreateBuffers(1, &buffer);
+  }
+  glNamedBufferData(buffer, std::max<std::size_t>(gpuMaterials.size(), 1) * sizeof(GpuMaterial), gpuMaterials.data(), GL_STATIC_DRAW);
+}
+
+int MaterialTable::find(const Material &material) const
+{
+  auto it = indices.find(&material);
+  return ((it != indices.end() && entries[it->second].packed) ? it->second : -1);
+}
+
+unsigned int MaterialTable::getBatchKey(const Material &material) const
+{
+  const int index = find(material);
+  if (index < 0) {
+    return 0;
+  }
+  const std::uint32_t arrayBits = (std::uint32_t)(entries[index].arrayIndex + 2); // Untextured => 1
+  return ((arrayBits << 2) | (material.twoSided ? 1 : 0) | (material.depthTest ? 2 : 0));
+}
+
+bool MaterialTable::canBatch(const Material &a, const Material &b) const
+{
+  const unsigned int key = getBatchKey(a);
+  return (key != 0 && key == getBatchKey(b) && (a.opacity < 1.f) == (b.opacity < 1.f)); // Blending is part of the pipeline state too
+}
+
+void MaterialTable::bind(const Shader &shader, const Material &material) const
+{
+  RenderState &renderState = RenderState::global();
+  renderState.bindBufferBase(GL_SHADER_STORAGE_BUFFER, materialsBinding, buffer);
+
+  const int index = find(material);
+  if (index >= 0 && entries[index].arrayIndex >= 0) {
+    glBindTextureUnit(textureUnit, textureArrays[entries[index].arrayIndex].handle); // Not shadowed by RenderState, which tracks GL_TEXTURE_2D only
+  }
+
+  if (const ShaderUniform &uniform = shader.getUniform(UniformSlot::MTL_TEXTURES)) {
+    renderState.useProgram(shader.shaderProgramHandle);
+    glUniform1i(uniform.location, textureUnit);
+  }
+}
+
+int MaterialTable::size() const
+{
+  return (int)entries.size();
+}
+
+int MaterialTable::numTextureArrays() const
+{
+  return (int)textureArrays.size();
+}
+
+void MaterialTable::destroyArrays()
+{
+  for (const TextureArray &textureArray : textureArrays) {
+    glDeleteTextures(1, &textureArray.handle);
+  }
+  textureArrays.clear();
+}
+
+}
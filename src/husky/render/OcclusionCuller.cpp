@@ -0,0 +1,235 @@
+#include <husky/render/OcclusionCuller.hpp>
+#include <husky/mesh/Model.hpp>
+#include <husky/util/ThreadPool.hpp>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <emmintrin.h> // SSE2; always available on x64
+
+namespace husky {
+
+static constexpr int rowsPerTask = 8;
+static constexpr double minW = 1e-5; // Closer to the camera plane => Not rasterized, or never occluded
+
+OcclusionCuller::OcclusionCuller(int width, int height)
+  : width((std::max(width, 4) + 3) & ~3)
+  , height(std::max(height, 1))
+  , depth()
+  , numOccluderTriangles(0)
+  , viewProjection(Matrix44d::identity())
+  , occluders()
+  , occluderTriangles()
+{
+  depth.assign(this->width * this->height, std::numeric_limits<float>::max());
+}
+
+void OcclusionCuller::beginFrame(const Matrix44d &viewProjection)
+{
+  this->viewProjection = viewProjection;
+  occluders.clear();
+  std::fill(depth.begin(), depth.end(), std::numeric_limits<float>::max());
+}
+
+void OcclusionCuller::addOccluder(const Mesh &mesh, const Matrix44d &transform)
+{
+  if (mesh.hasFaces()) {
+    occluders.push_back({ &mesh, viewProjection * transform });
+  }
+}
+
+void OcclusionCuller::addOccluder(const Model &model, const Matrix44d &transform)
+{
+  if (model.nodes.empty()) {
+    for (const ModelMesh &mesh : model.meshes) {
+      addOccluder(mesh.mesh, transform);
+    }
+    return;
+  }
+
+  for (const ModelNode *node : model.nodes) {
+    for (int iMesh : node->meshIndices) {
+      addOccluder(model.meshes[iMesh].mesh, transform * node->mtxRelToModel);
+    }
+  }
+}
+
+void OcclusionCuller::rasterize(ThreadPool &threadPool)
+{
+  occluderTriangles.resize(occluders.size());
+  threadPool.parallelFor(0, (int)occluders.size(), 1, [this](int begin, int end) {
+    for (int i = begin; i < end; i++) {
+      setupTriangles(occluders[i], occluderTriangles[i]);
+    }
+  });
+
+  numOccluderTriangles = 0;
+  for (const std::vector<ScreenTriangle> &triangles : occluderTriangles) {
+    numOccluderTriangles += (int)triangles.size();
+  }
+
+  // Each task owns a band of rows, so no two tasks write the same pixel
+  const int numTasks = (height + rowsPerTask - 1) / rowsPerTask;
+  threadPool.parallelFor(0, numTasks, 1, [this](int begin, int end) {
+    rasterizeRows(begin * rowsPerTask, std::min(end * rowsPerTask, height));
+  });
+}
+
+bool OcclusionCuller::isVisible(const Box &bboxLocal, const Matrix44d &transform) const
+{
+  const Matrix44d mtxClip = viewProjection * transform;
+  double minX = std::numeric_limits<double>::max();
+  double minY = std::numeric_limits<double>::max();
+  double maxX = std::numeric_limits<double>::lowest();
+  double maxY = std::numeric_limits<double>::lowest();
+  double nearestW = std::numeric_limits<double>::max();
+
+  for (const Vector3d &corner : bboxLocal.corners()) {
+    const Vector4d clip = mtxClip * Vector4d(corner, 1.0);
+    if (clip.w < minW) {
+      return true;
+    }
+    const double x = (clip.x / clip.w * 0.5 + 0.5) * width;
+    const double y = (clip.y / clip.w * 0.5 + 0.5) * height;
+    minX = std::min(minX, x);
+    minY = std::min(minY, y);
+    maxX = std::max(maxX, x);
+    maxY = std::max(maxY, y);
+    nearestW = std::min(nearestW, clip.w);
+  }
+
+  // Every pixel the box touches must be covered by an occluder in front of it
+  const int x0 = std::max((int)std::floor(minX), 0);
+  const int y0 = std::max((int)std::floor(minY), 0);
+  const int x1 = std::min((int)std::floor(maxX), width - 1);
+  const int y1 = std::min((int)std::floor(maxY), height - 1);
+  if (x0 > x1 || y0 > y1) { // Off-screen
+    return false;
+  }
+
+  const float boxW = (float)nearestW;
+  for (int y = y0; y <= y1; y++) {
+    const float *row = &depth[y * width];
+    for (int x = x0; x <= x1; x++) {
+      if (row[x] >= boxW) {
+        return true;
+      }
+    }
+  }
+
+  return false;
+}
+
+void OcclusionCuller::setupTriangles(const Occluder &occluder, std::vector<ScreenTriangle> &triangles) const
+{
+  const Mesh &mesh = *occluder.mesh;
+  const std::vector<Mesh::Position> &positions = mesh.getPositions();
+
+  std::vector<Vector4d> clipPositions(positions.size());
+  for (int i = 0; i < (int)positions.size(); i++) {
+    clipPositions[i] = occluder.mtxClip * Vector4d(positions[i], 1.0);
+  }
+
+  triangles.clear();
+  auto addTriangle = [&](int i0, int i1, int i2) {
+    const Vector4d *v[3] = { &clipPositions[i0], &clipPositions[i1], &clipPositions[i2] };
+    ScreenTriangle tri;
+    tri.farW = 0.f;
+    for (int i = 0; i < 3; i++) {
+      if (v[i]->w < minW) { // Not clipped; dropping the triangle only makes the result more conservative
+        return;
+      }
+      tri.x[i] = (float)((v[i]->x / v[i]->w * 0.5 + 0.5) * width);
+      tri.y[i] = (float)((v[i]->y / v[i]->w * 0.5 + 0.5) * height);
+      tri.farW = std::max(tri.farW, (float)v[i]->w);
+    }
+    triangles.emplace_back(tri);
+  };
+
+  for (int i = 0; i < mesh.numTriangles(); i++) {
+    const Mesh::Triangle &t = mesh.getTriangle(i);
+    addTriangle(t[0], t[1], t[2]);
+  }
+
+  for (int i = 0; i < mesh.numQuads(); i++) {
+    const Mesh::Quad &q = mesh.getQuad(i);
+    addTriangle(q[0], q[1], q[2]);
+    addTriangle(q[0], q[2], q[3]);
+  }
+}
+
+void OcclusionCuller::rasterizeRows(int rowBegin, int rowEnd)
+{
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 pixelOffsets = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+
+  for (const std::vector<ScreenTriangle> &triangles : occluderTriangles) {
+    for (const ScreenTriangle &tri : triangles) {
+      const float minY = std::min({ tri.y[0], tri.y[1], tri.y[2] });
+      const float maxY = std::max({ tri.y[0], tri.y[1], tri.y[2] });
+      const int y0 = std::max((int)std::floor(minY), rowBegin);
+      const int y1 = std::min((int)std::ceil(maxY), rowEnd - 1);
+      if (y0 > y1) {
+        continue;
+      }
+
+      const float minX = std::min({ tri.x[0], tri.x[1], tri.x[2] });
+      const float maxX = std::max({ tri.x[0], tri.x[1], tri.x[2] });
+      const int x0 = std::max((int)std::floor(minX), 0) & ~3;
+      const int x1 = std::min((int)std::ceil(maxX), width - 1);
+      if (x0 > x1) {
+        continue;
+      }
+
+      const float area = (tri.x[1] - tri.x[0]) * (tri.y[2] - tri.y[0]) - (tri.x[2] - tri.x[0]) * (tri.y[1] - tri.y[0]);
+      if (std::abs(area) < 1e-6f) {
+        continue;
+      }
+      const int i1 = (area > 0.f ? 1 : 2); // Counter-clockwise order, so inside is positive for all edges
+      const int i2 = (area > 0.f ? 2 : 1);
+      const float vx[3] = { tri.x[0], tri.x[i1], tri.x[i2] };
+      const float vy[3] = { tri.y[0], tri.y[i1], tri.y[i2] };
+
+      // Edge functions a * x + b * y + c, sampled at pixel centers; the top-left rule keeps shared edges watertight
+      float a[3], b[3], c[3];
+      __m128 topLeft[3];
+      for (int i = 0; i < 3; i++) {
+        const int j = (i + 1) % 3;
+        a[i] = vy[i] - vy[j];
+        b[i] = vx[j] - vx[i];
+        c[i] = -(a[i] * vx[i] + b[i] * vy[i]);
+        topLeft[i] = _mm_castsi128_ps(_mm_set1_epi32((a[i] > 0.f || (a[i] == 0.f && b[i] < 0.f)) ? -1 : 0));
+      }
+
+      const __m128 a0 = _mm_set1_ps(a[0]);
+      const __m128 a1 = _mm_set1_ps(a[1]);
+      const __m128 a2 = _mm_set1_ps(a[2]);
+      const __m128 triW = _mm_set1_ps(tri.farW);
+      auto edgeInside = [&](__m128 e, int i) { return _mm_or_ps(_mm_and_ps(topLeft[i], _mm_cmpge_ps(e, zero)), _mm_andnot_ps(topLeft[i], _mm_cmpgt_ps(e, zero))); };
+
+      for (int y = y0; y <= y1; y++) {
+        const float py = y + 0.5f;
+        const __m128 row0 = _mm_set1_ps(b[0] * py + c[0]);
+        const __m128 row1 = _mm_set1_ps(b[1] * py + c[1]);
+        const __m128 row2 = _mm_set1_ps(b[2] * py + c[2]);
+        float *depthRow = &depth[y * width];
+
+        for (int x = x0; x <= x1; x += 4) { // Width is a multiple of 4, so x + 3 is in the row
+          const __m128 px = _mm_add_ps(_mm_set1_ps((float)x), pixelOffsets);
+          const __m128 e0 = _mm_add_ps(_mm_mul_ps(a0, px), row0);
+          const __m128 e1 = _mm_add_ps(_mm_mul_ps(a1, px), row1);
+          const __m128 e2 = _mm_add_ps(_mm_mul_ps(a2, px), row2);
+          const __m128 inside = _mm_and_ps(_mm_and_ps(edgeInside(e0, 0), edgeInside(e1, 1)), edgeInside(e2, 2));
+          if (_mm_movemask_ps(inside) == 0) {
+            continue;
+          }
+
+          const __m128 current = _mm_loadu_ps(depthRow + x);
+          const __m128 nearer = _mm_min_ps(current, triW);
+          _mm_storeu_ps(depthRow + x, _mm_or_ps(_mm_and_ps(inside, nearer), _mm_andnot_ps(inside, current)));
+        }
+      }
+    }
+  }
+}
+
+}
@@ -1,12 +1,19 @@
 #include <husky/render/RenderData.hpp>
+#include <husky/render/RenderState.hpp>
 #include <husky/render/Shader.hpp>
 #include <husky/render/Viewport.hpp>
 #include <husky/mesh/Material.hpp>
 #include <husky/Log.hpp>
 #include <glad/glad.h>
+#include <algorithm>
+#include <limits>
 
 namespace husky {
 
+static constexpr int maxQuads = 16384; // Per pulled points draw; four vertices each fill the 16-bit index range
+static GLuint quadVao = 0; // Shared by all pulled points draws; see RenderData::releaseSharedGpuData()
+static GLuint quadEbo = 0;
+
 int VertexAttribute::getBytesPerElement(VertexAttributeDataType dataType)
 {
   switch (dataType)
@@ -23,6 +30,32 @@ int VertexAttribute::getBytesPerElement(VertexAttributeDataType dataType)
   }
 }
 
+static const char *locationNames[VertexAttribute::LOCATION_COUNT] = {
+  VertexAttribute::POSITION,
+  VertexAttribute::NORMAL,
+  VertexAttribute::TEXCOORD,
+  VertexAttribute::COLOR,
+  VertexAttribute::BONE_INDICES,
+  VertexAttribute::BONE_WEIGHTS,
+  VertexAttribute::TANGENTS,
+  VertexAttribute::DRAW_ID,
+};
+
+int VertexAttribute::getLocation(const std::string &name)
+{
+  for (int location = 0; location < LOCATION_COUNT; location++) {
+    if (name == locationNames[location]) {
+      return location;
+    }
+  }
+  return -1;
+}
+
+const char* VertexAttribute::getLocationName(int location)
+{
+  return (location >= 0 && location < LOCATION_COUNT) ? locationNames[location] : "";
+}
+
 VertexAttribute::VertexAttribute(const std::string &name, VertexAttributeDataType dataType, int elementCount, bool normalize, int byteOffset)
   : name(name)
   , dataType(dataType)
@@ -99,6 +132,16 @@ VertexData::VertexData(const VertexDescription &vertDesc, int vertCount)
   bytes.resize(vertCount * vertDesc.byteCount);
 }
 
+int IndexData::getIndicesPerPrimitive(PrimitiveType primitiveType)
+{
+  switch (primitiveType) {
+  case PrimitiveType::POINTS:    return 1;
+  case PrimitiveType::LINES:     return 2;
+  case PrimitiveType::TRIANGLES: return 3;
+  default:                       return 1;
+  }
+}
+
 IndexData::IndexData(PrimitiveType primitiveType)
   : primitiveType(primitiveType)
   , indices16{}
@@ -108,7 +151,7 @@ IndexData::IndexData(PrimitiveType primitiveType)
 
 void IndexData::addPoint(int v0)
 {
-  if (v0 <= std::numeric_limits<std::uint16_t>::max()) {
+  if (indices32.empty() && v0 <= std::numeric_limits<std::uint16_t>::max()) {
     indices16.emplace_back(v0);
     return;
   }
@@ -137,220 +180,398 @@ void IndexData::addTriangle(int v0, int v1, int v2)
   addPoint(v2);
 }
 
+int IndexData::getIndexCount() const
+{
+  return (int)(indices16.size() + indices32.size());
+}
+
+std::vector<IndexChunk> IndexData::buildChunks(std::vector<std::uint16_t> &chunkIndices) const
+{
+  std::vector<IndexChunk> chunks;
+
+  if (!indices16.empty()) { // Already fits
+    chunkIndices = indices16;
+    chunks.push_back({ 0, (int)indices16.size(), 0 });
+    return chunks;
+  }
+
+  chunkIndices.clear();
+  chunkIndices.reserve(indices32.size());
+
+  static constexpr std::uint32_t maxRange = std::numeric_limits<std::uint16_t>::max();
+  const int n = getIndicesPerPrimitive(primitiveType);
+  const int indexCount = (int)indices32.size() - (int)indices32.size() % n;
+
+  int chunkBegin = 0;
+  while (chunkBegin < indexCount) {
+    // Grow the chunk one primitive at a time while its index range fits in 16 bits
+    std::uint32_t minIndex = std::numeric_limits<std::uint32_t>::max();
+    std::uint32_t maxIndex = 0;
+    int chunkEnd = chunkBegin;
+    while (chunkEnd < indexCount) {
+      std::uint32_t primMin = minIndex;
+      std::uint32_t primMax = maxIndex;
+      for (int i = 0; i < n; i++) {
+        primMin = std::min(primMin, indices32[chunkEnd + i]);
+        primMax = std::max(primMax, indices32[chunkEnd + i]);
+      }
+      if (primMax - primMin > maxRange) {
+        break;
+      }
+      minIndex = primMin;
+      maxIndex = primMax;
+      chunkEnd += n;
+    }
+
+    if (chunkEnd == chunkBegin) { // A single primitive spans more than 16 bits; cannot happen for valid input
+      Log::warning("Primitive index range too large for 16-bit chunk");
+      chunkBegin += n;
+      continue;
+    }
+
+    chunks.push_back({ (int)chunkIndices.size(), chunkEnd - chunkBegin, (int)minIndex });
+    for (int i = chunkBegin; i < chunkEnd; i++) {
+      chunkIndices.emplace_back((std::uint16_t)(indices32[i] - minIndex));
+    }
+
+    chunkBegin = chunkEnd;
+  }
+
+  return chunks;
+}
+
 void RenderData::uploadToGpu()
 {
   glGenBuffers(1, &vbo);
-  glBindBuffer(GL_ARRAY_BUFFER, vbo);
+  RenderState::global().bindBuffer(GL_ARRAY_BUFFER, vbo);
   glBufferData(GL_ARRAY_BUFFER, _vertData.bytes.size(), _vertData.bytes.data(), GL_STATIC_DRAW);
 
-  glGenVertexArrays(1, &vao);
-  //glBindVertexArray(vao);
+  if (_indexData.getIndexCount() > 0) {
+    std::vector<std::uint16_t> chunkIndices;
+    indexChunks = _indexData.buildChunks(chunkIndices);
+    glCreateBuffers(1, &ebo);
+    glNamedBufferStorage(ebo, chunkIndices.size() * sizeof(std::uint16_t), chunkIndices.data(), 0);
+  }
+
+  glCreateVertexArrays(1, &vao);
+  configureVertexArray(vao, _vertData.vertDesc, vbo, ebo, false);
+
+  if (_vertData.vertDesc.getAttr(VertexAttribute::BONE_INDICES)) { // May be drawn from SkinningPass buffers
+    glCreateVertexArrays(1, &skinnedVao);
+    configureVertexArray(skinnedVao, _vertData.vertDesc, vbo, ebo, true);
+  }
+
+  // Constant values for missing bone attributes make the default shader apply bone 0, which is identity for unskinned draws.
+  // These are context state rather than VAO state, so setting them once is enough.
+  glVertexAttribI4i(VertexAttribute::getLocation(VertexAttribute::BONE_INDICES), 0, 0, 0, 0);
+  glVertexAttrib4f(VertexAttribute::getLocation(VertexAttribute::BONE_WEIGHTS), 1.f, 0.f, 0.f, 0.f);
 }
 
-void RenderData::draw(const Shader &shader, const Material &mtl, const Viewport &viewport, const Matrix44f &view, const Matrix44f &modelView, const Matrix44f &projection, const std::vector<Matrix44f> &mtxBones) const
+void RenderData::releaseCpuData()
 {
-  if (shader.shaderProgramHandle == 0) {
-    Log::warning("Invalid shader program");
+  if (vbo == 0) {
+    Log::warning("Releasing data that was never uploaded");
+    return;
+  }
+
+  std::vector<std::uint8_t>().swap(_vertData.bytes);
+  std::vector<std::uint16_t>().swap(_indexData.indices16);
+  std::vector<std::uint32_t>().swap(_indexData.indices32);
+}
+
+void RenderData::releaseGpuData()
+{
+  if (sharedBuffer == nullptr) {
+    RenderState::global().deleteBuffer(vbo);
+    RenderState::global().deleteBuffer(ebo);
+    RenderState::global().deleteVertexArray(vao);
+  }
+  RenderState::global().deleteVertexArray(skinnedVao);
+
+  vbo = 0;
+  vao = 0;
+  skinnedVao = 0;
+  ebo = 0;
+  indexChunks.clear();
+  sharedBuffer = nullptr;
+  skinnedVaoVbo = 0;
+}
+
+void RenderData::releaseSharedGpuData()
+{
+  RenderState::global().deleteVertexArray(quadVao);
+  RenderState::global().deleteBuffer(quadEbo);
+  quadVao = 0;
+  quadEbo = 0;
+}
+
+void RenderData::draw(const Shader &shader, const Material &mtl, const Viewport &viewport, const Matrix44f &view, const Matrix44f &modelView, const Matrix44f &projection, const std::vector<Matrix44f> &mtxBones, unsigned int skinnedVbo) const
+{
+  if (!bindDrawState(shader, mtl, viewport, view, modelView, projection, mtxBones)) {
     return;
   }
 
-  if (mtl.twoSided) {
-    glDisable(GL_CULL_FACE);
+  if (shader.hasPulledPoints()) { // Reads the vertex buffer itself
+    drawPulledPoints(shader);
+    return;
   }
-  else {
-    glEnable(GL_CULL_FACE);
+
+  if (!bindVertexArray(skinnedVbo)) {
+    return;
   }
 
-  if (mtl.depthTest) {
-    glEnable(GL_DEPTH_TEST);
+  GLenum mode = GL_POINTS; // Default fallback
+  switch (_indexData.primitiveType) {
+  case PrimitiveType::POINTS: mode = GL_POINTS; break;
+  case PrimitiveType::LINES: mode = GL_LINES; break;
+  case PrimitiveType::TRIANGLES: mode = GL_TRIANGLES; break;
+  default: Log::warning("Unsupported PrimitiveType: %d", mode); break;
+  }
+
+  if (ebo != 0) { // The element buffer is part of the VAO
+    for (const IndexChunk &chunk : indexChunks) {
+      const void *offset = ((const std::uint8_t*)nullptr) + chunk.firstIndex * sizeof(std::uint16_t);
+      glDrawElementsBaseVertex(mode, chunk.indexCount, GL_UNSIGNED_SHORT, offset, chunk.baseVertex);
+    }
   }
   else {
-    glDisable(GL_DEPTH_TEST);
+    glDrawArrays(mode, 0, _vertData.vertCount);
+  }
+}
+
+void RenderData::drawPulledPoints(const Shader &shader) const
+{
+  // The shader reads 32-bit words, so attributes must be word-aligned floats or packed bytes as Mesh::getRenderData() creates them
+  const VertexDescription &vertDesc = _vertData.vertDesc;
+  const VertexAttribute &position = vertDesc.getAttr(VertexAttribute::POSITION);
+  const VertexAttribute &texCoord = vertDesc.getAttr(VertexAttribute::TEXCOORD);
+  const VertexAttribute &color = vertDesc.getAttr(VertexAttribute::COLOR);
+  const auto isPullable = [](const VertexAttribute &attr, VertexAttributeDataType dataType, int elementCount) {
+    return (!attr || (attr.dataType == dataType && attr.elementCount == elementCount && attr.byteOffset % 4 == 0));
+  };
+
+  if (vbo == 0) {
+    Log::warning("VBO is 0");
+    return;
+  }
+
+  if (_indexData.primitiveType != PrimitiveType::POINTS || !position || vertDesc.byteCount % 4 != 0
+    || !isPullable(position, VertexAttributeDataType::FLOAT32, 3) || !isPullable(texCoord, VertexAttributeDataType::FLOAT32, 2) || !isPullable(color, VertexAttributeDataType::UINT8, 4)) {
+    Log::warning("Vertex data cannot be pulled as points");
+    return;
+  }
+
+  if (const ShaderUniform &uniform = shader.getUniform(UniformSlot::POINT_LAYOUT)) {
+    glUniform4i(uniform.location, vertDesc.byteCount / 4, position.byteOffset / 4, texCoord ? texCoord.byteOffset / 4 : -1, color ? color.byteOffset / 4 : -1);
+  }
+
+  // Quads of four vertices share one index buffer; the shader finds the point and corner from gl_VertexID, so indexed draws reuse the corners of both triangles
+  if (quadVao == 0) {
+    std::vector<std::uint16_t> quadIndices;
+    quadIndices.reserve(maxQuads * 6);
+    for (int iQuad = 0; iQuad < maxQuads; iQuad++) {
+      const std::uint16_t v = (std::uint16_t)(iQuad * 4);
+      quadIndices.insert(quadIndices.end(), { v, (std::uint16_t)(v + 1), (std::uint16_t)(v + 2), (std::uint16_t)(v + 2), (std::uint16_t)(v + 1), (std::uint16_t)(v + 3) });
+    }
+    glCreateBuffers(1, &quadEbo);
+    glNamedBufferStorage(quadEbo, quadIndices.size() * sizeof(std::uint16_t), quadIndices.data(), 0);
+    glCreateVertexArrays(1, &quadVao);
+    glVertexArrayElementBuffer(quadVao, quadEbo); // No attributes
+  }
+
+  RenderState &renderState = RenderState::global();
+  renderState.bindVertexArray(quadVao);
+  renderState.bindBufferBase(GL_SHADER_STORAGE_BUFFER, pulledPointsBinding, vbo);
+  for (int firstPoint = 0; firstPoint < _vertData.vertCount; firstPoint += maxQuads) { // Points meshes have no indices of their own
+    const int numPoints = std::min(maxQuads, _vertData.vertCount - firstPoint);
+    glDrawElementsBaseVertex(GL_TRIANGLES, numPoints * 6, GL_UNSIGNED_SHORT, nullptr, firstPoint * 4);
+  }
+}
+
+bool RenderData::bindDrawState(const Shader &shader, const Material &mtl, const Viewport &viewport, const Matrix44f &view, const Matrix44f &modelView, const Matrix44f &projection, const std::vector<Matrix44f> &mtxBones)
+{
+  if (shader.shaderProgramHandle == 0) {
+    Log::warning("Invalid shader program");
+    return false;
+  }
+
+  RenderState &renderState = RenderState::global();
+  renderState.apply(PipelineState(!mtl.twoSided, mtl.depthTest, mtl.opacity < 1.f));
+  renderState.useProgram(shader.shaderProgramHandle);
+
+  // Camera, light and material data live in uniform buffers that are only re-uploaded when they change
+  if (shader.hasUniformBlock(UniformBlock::FRAME)) {
+    static UniformBuffer frameUniformBuffer;
+    const FrameUniforms frameUniforms(view, projection, viewport.width, viewport.height);
+    frameUniformBuffer.update(&frameUniforms, sizeof(frameUniforms));
+    frameUniformBuffer.bind(UniformBlock::FRAME);
   }
 
-  glUseProgram(shader.shaderProgramHandle);
+  if (shader.hasUniformBlock(UniformBlock::MATERIAL)) {
+    const MaterialUniforms mtlUniforms = mtl.getUniforms();
+    mtl.uniformBuffer.update(&mtlUniforms, sizeof(mtlUniforms));
+    mtl.uniformBuffer.bind(UniformBlock::MATERIAL);
+  }
 
-  if (const ShaderUniform &uniform = shader.getUniform("mtxModelView")) {
+  // Per-object uniforms
+  if (const ShaderUniform &uniform = shader.getUniform(UniformSlot::MTX_MODEL_VIEW)) {
     glUniformMatrix4fv(uniform.location, 1, GL_FALSE, modelView.m);
   }
 
   const Matrix33f normalMatrix = modelView.get3x3(); // Fast, but only works with uniform scaling
   //const Matrix33f normalMatrix = modelView.inverted().transposed().get3x3(); // TODO: Use pre-inverted matrix for better performance
   //const Matrix33f normalMatrix = modelView.get3x3().inverted().transposed();
-  if (const ShaderUniform &uniform = shader.getUniform("mtxNormal")) {
+  if (const ShaderUniform &uniform = shader.getUniform(UniformSlot::MTX_NORMAL)) {
     glUniformMatrix3fv(uniform.location, 1, GL_FALSE, normalMatrix.m);
   }
 
-  if (const ShaderUniform &uniform = shader.getUniform("mtxProjection")) {
-    glUniformMatrix4fv(uniform.location, 1, GL_FALSE, projection.m);
-  }
-
-  if (const ShaderUniform &uniform = shader.getUniform("mtxBones")) {
+  if (const ShaderUniform &uniform = shader.getUniform(UniformSlot::MTX_BONES)) {
     if (mtxBones.empty()) {
       glUniformMatrix4fv(uniform.location, 1, GL_FALSE, Matrix44f::identity().m); // Single identity matrix
     }
+    else if ((int)mtxBones.size() > Shader::maxUniformBones) {
+      Log::warning("%d bones do not fit the mtxBones uniform; load the model with maxBonesPerMesh = Shader::maxUniformBones", (int)mtxBones.size());
+      return false;
+    }
     else {
       glUniformMatrix4fv(uniform.location, (GLsizei)mtxBones.size(), GL_FALSE, mtxBones.front().m);
     }
   }
 
-  if (const ShaderUniform &uniform = shader.getUniform("useBones")) {
-    glUniform1i(uniform.location, !mtxBones.empty());
+  // Plain uniforms for shaders without uniform blocks (e.g., line shader)
+  if (const ShaderUniform &uniform = shader.getUniform(UniformSlot::MTX_PROJECTION)) {
+    glUniformMatrix4fv(uniform.location, 1, GL_FALSE, projection.m);
   }
 
-  if (const ShaderUniform &uniform = shader.getUniform("tex")) {
+  if (const ShaderUniform &uniform = shader.getUniform(UniformSlot::TEX)) {
     glUniform1i(uniform.location, 0);
   }
 
-  if (const ShaderUniform &uniform = shader.getUniform("lightDir")) {
+  if (const ShaderUniform &uniform = shader.getUniform(UniformSlot::LIGHT_DIR)) {
     Vector3f lightDir(20, -40, 100); // TODO
     lightDir = (view * Vector4f(lightDir, 0.0)).xyz.normalized();
     glUniform3fv(uniform.location, 1, lightDir.val);
   }
 
-  if (const ShaderUniform &uniform = shader.getUniform("mtlAmbient")) {
+  if (const ShaderUniform &uniform = shader.getUniform(UniformSlot::MTL_AMBIENT)) {
     glUniform3fv(uniform.location, 1, mtl.ambient.val);
   }
 
-  if (const ShaderUniform &uniform = shader.getUniform("mtlDiffuse")) {
+  if (const ShaderUniform &uniform = shader.getUniform(UniformSlot::MTL_DIFFUSE)) {
     glUniform3fv(uniform.location, 1, mtl.diffuse.val);
   }
 
-  if (const ShaderUniform &uniform = shader.getUniform("mtlSpecular")) {
+  if (const ShaderUniform &uniform = shader.getUniform(UniformSlot::MTL_SPECULAR)) {
     glUniform3fv(uniform.location, 1, mtl.specular.val);
   }
 
-  if (const ShaderUniform &uniform = shader.getUniform("mtlEmissive")) {
+  if (const ShaderUniform &uniform = shader.getUniform(UniformSlot::MTL_EMISSIVE)) {
     glUniform3fv(uniform.location, 1, mtl.emissive.val);
   }
 
-  if (const ShaderUniform &uniform = shader.getUniform("mtlShininess")) {
+  if (const ShaderUniform &uniform = shader.getUniform(UniformSlot::MTL_SHININESS)) {
     glUniform1f(uniform.location, mtl.shininess);
   }
 
-  if (const ShaderUniform &uniform = shader.getUniform("mtlShininessStrength")) {
+  if (const ShaderUniform &uniform = shader.getUniform(UniformSlot::MTL_SHININESS_STRENGTH)) {
     glUniform1f(uniform.location, mtl.shininessStrength);
   }
 
-  if (const ShaderUniform &uniform = shader.getUniform("viewportSize")) {
+  if (const ShaderUniform &uniform = shader.getUniform(UniformSlot::VIEWPORT_SIZE)) {
     glUniform2f(uniform.location, (float)viewport.width, (float)viewport.height);
   }
 
-  if (const ShaderUniform &uniform = shader.getUniform("lineWidth")) {
+  if (const ShaderUniform &uniform = shader.getUniform(UniformSlot::LINE_WIDTH)) {
     glUniform1f(uniform.location, mtl.lineWidth);
   }
 
-  if (mtl.tex.valid()) {
-    //glEnable(GL_TEXTURE_2D);
-    glActiveTexture(GL_TEXTURE0 + 0);
-    glBindTexture(GL_TEXTURE_2D, mtl.tex.handle);
-  }
-  else {
-    glBindTexture(GL_TEXTURE_2D, 0);
-    //glDisable(GL_TEXTURE_2D);
-  }
+  renderState.bindTexture(0, mtl.tex.valid() ? mtl.tex.handle : 0);
+  return true;
+}
 
+bool RenderData::bindVertexArray(unsigned int skinnedVbo) const
+{
   if (vbo == 0) {
     Log::warning("VBO is 0");
-    return;
+    return false;
+  }
+
+  if (skinnedVbo != 0) {
+    if (skinnedVao == 0) {
+      Log::warning("Skinned VAO is 0");
+      return false;
+    }
+
+    if (skinnedVaoVbo != skinnedVbo) { // The only per-draw change to the VAO
+      glVertexArrayVertexBuffer(skinnedVao, 1, skinnedVbo, 0, 6 * sizeof(float));
+      skinnedVaoVbo = skinnedVbo;
+    }
+
+    RenderState::global().bindVertexArray(skinnedVao);
+    return true;
   }
 
   if (vao == 0) {
     Log::warning("VAO is 0");
-    return;
+    return false;
   }
 
-  glBindBuffer(GL_ARRAY_BUFFER, vbo);
-  glBindVertexArray(vao);
-
-  const VertexDescription &vertDesc = _vertData.vertDesc;
-  const int stride = vertDesc.byteCount;
+  RenderState::global().bindVertexArray(vao);
+  return true;
+}
 
-  for (const ShaderAttribute &shaderAttr : shader.attrs) {
-    if (const VertexAttribute &attr = vertDesc.getAttr(shaderAttr.name)) {
-      glEnableVertexAttribArray(shaderAttr.location);
+void RenderData::configureVertexArray(unsigned int vertexArray, const VertexDescription &vertDesc, unsigned int vbo, unsigned int ebo, bool skinned)
+{
+  // Binding 0 is the interleaved vertex buffer; binding 1 is an interleaved vec3 position, vec3 normal buffer from SkinningPass
+  glVertexArrayVertexBuffer(vertexArray, 0, vbo, 0, vertDesc.byteCount);
+  glVertexArrayElementBuffer(vertexArray, ebo);
+
+  for (const VertexAttribute &attr : vertDesc.attrs) {
+    const int location = VertexAttribute::getLocation(attr.name);
+    if (location < 0) {
+      Log::warning("Vertex attribute has no fixed location: %s", attr.name.c_str());
+      continue;
+    }
 
-      const void *attrPtr = attr.getAttribPointer();
+    const bool boneAttr = (attr.name == VertexAttribute::BONE_INDICES || attr.name == VertexAttribute::BONE_WEIGHTS);
+    if (skinned && boneAttr) { // Skinned data ignores bone attributes
+      continue;
+    }
 
-      if (attr.dataType == VertexAttributeDataType::FLOAT32) {
-        glVertexAttribPointer(shaderAttr.location, attr.elementCount, GL_FLOAT, GL_FALSE, stride, attrPtr);
-      }
-      else if (attr.dataType == VertexAttributeDataType::FLOAT64) {
-        glVertexAttribLPointer(shaderAttr.location, attr.elementCount, GL_DOUBLE, stride, attrPtr);
-      }
-      else if (attr.dataType == VertexAttributeDataType::INT8) {
-        if (attr.normalize) {
-          glVertexAttribPointer(shaderAttr.location, attr.elementCount, GL_BYTE, GL_TRUE, stride, attrPtr);
-        }
-        else { // TODO: Do we ever want to call glVertexAttribPointer() instead of glVertexAttribIPointer() for integer data types when attr.normalize is false?
-          glVertexAttribIPointer(shaderAttr.location, attr.elementCount, GL_BYTE, stride, attrPtr);
-        }
-      }
-      else if (attr.dataType == VertexAttributeDataType::INT16) {
-        if (attr.normalize) {
-          glVertexAttribPointer(shaderAttr.location, attr.elementCount, GL_SHORT, GL_TRUE, stride, attrPtr);
-        }
-        else {
-          glVertexAttribIPointer(shaderAttr.location, attr.elementCount, GL_SHORT, stride, attrPtr);
-        }
-      }
-      else if (attr.dataType == VertexAttributeDataType::INT32) {
-        if (attr.normalize) {
-          glVertexAttribPointer(shaderAttr.location, attr.elementCount, GL_INT, GL_TRUE, stride, attrPtr);
-        }
-        else {
-          glVertexAttribIPointer(shaderAttr.location, attr.elementCount, GL_INT, stride, attrPtr);
-        }
-      }
-      else if (attr.dataType == VertexAttributeDataType::UINT8) {
-        if (attr.normalize) {
-          glVertexAttribPointer(shaderAttr.location, attr.elementCount, GL_UNSIGNED_BYTE, GL_TRUE, stride, attrPtr);
-        }
-        else {
-          glVertexAttribIPointer(shaderAttr.location, attr.elementCount, GL_UNSIGNED_BYTE, stride, attrPtr);
-        }
-      }
-      else if (attr.dataType == VertexAttributeDataType::UINT16) {
-        if (attr.normalize) {
-          glVertexAttribPointer(shaderAttr.location, attr.elementCount, GL_UNSIGNED_SHORT, GL_TRUE, stride, attrPtr);
-        }
-        else {
-          glVertexAttribIPointer(shaderAttr.location, attr.elementCount, GL_UNSIGNED_SHORT, stride, attrPtr);
-        }
-      }
-      else if (attr.dataType == VertexAttributeDataType::UINT32) {
-        if (attr.normalize) {
-          glVertexAttribPointer(shaderAttr.location, attr.elementCount, GL_UNSIGNED_INT, GL_TRUE, stride, attrPtr);
-        }
-        else {
-          glVertexAttribIPointer(shaderAttr.location, attr.elementCount, GL_UNSIGNED_INT, stride, attrPtr);
-        }
-      }
-      else {
-        Log::warning("Unsupported VertexAttributeDataType: %d", attr.dataType);
-      }
+    if (skinned && (attr.name == VertexAttribute::POSITION || attr.name == VertexAttribute::NORMAL)) {
+      const int skinnedOffset = (attr.name == VertexAttribute::POSITION ? 0 : 3 * sizeof(float));
+      glEnableVertexArrayAttrib(vertexArray, location);
+      glVertexArrayAttribFormat(vertexArray, location, 3, GL_FLOAT, GL_FALSE, skinnedOffset);
+      glVertexArrayAttribBinding(vertexArray, location, 1);
+      continue;
     }
-    else {
-      glDisableVertexAttribArray(shaderAttr.location);
+
+    GLenum type = GL_NONE;
+    switch (attr.dataType) {
+    case VertexAttributeDataType::FLOAT32: type = GL_FLOAT;          break;
+    case VertexAttributeDataType::FLOAT64: type = GL_DOUBLE;         break;
+    case VertexAttributeDataType::INT8:    type = GL_BYTE;           break;
+    case VertexAttributeDataType::INT16:   type = GL_SHORT;          break;
+    case VertexAttributeDataType::INT32:   type = GL_INT;            break;
+    case VertexAttributeDataType::UINT8:   type = GL_UNSIGNED_BYTE;  break;
+    case VertexAttributeDataType::UINT16:  type = GL_UNSIGNED_SHORT; break;
+    case VertexAttributeDataType::UINT32:  type = GL_UNSIGNED_INT;   break;
+    default: Log::warning("Unsupported VertexAttributeDataType: %d", attr.dataType); continue;
     }
-  }
 
-  GLenum mode = GL_POINTS; // Default fallback
-  switch (_indexData.primitiveType) {
-  case PrimitiveType::POINTS: mode = GL_POINTS; break;
-  case PrimitiveType::LINES: mode = GL_LINES; break;
-  case PrimitiveType::TRIANGLES: mode = GL_TRIANGLES; break;
-  default: Log::warning("Unsupported PrimitiveType: %d", mode); break;
-  }
+    glEnableVertexArrayAttrib(vertexArray, location);
 
-  if (!_indexData.indices16.empty()) {
-    glDrawElements(mode, (int)_indexData.indices16.size(), GL_UNSIGNED_SHORT, _indexData.indices16.data());
-  }
-  else if (!_indexData.indices32.empty()) {
-    glDrawElements(mode, (int)_indexData.indices32.size(), GL_UNSIGNED_INT, _indexData.indices32.data());
-  }
-  else {
-    glDrawArrays(mode, 0, _vertData.vertCount);
+    if (attr.dataType == VertexAttributeDataType::FLOAT64) {
+      glVertexArrayAttribLFormat(vertexArray, location, attr.elementCount, type, attr.byteOffset);
+    }
+    else if (attr.dataType == VertexAttributeDataType::FLOAT32 || attr.normalize) {
+      glVertexArrayAttribFormat(vertexArray, location, attr.elementCount, type, attr.normalize ? GL_TRUE : GL_FALSE, attr.byteOffset);
+    }
+    else { // TODO: Do we ever want glVertexArrayAttribFormat() instead of glVertexArrayAttribIFormat() for integer data types when attr.normalize is false?
+      glVertexArrayAttribIFormat(vertexArray, location, attr.elementCount, type, attr.byteOffset);
+    }
+
+    glVertexArrayAttribBinding(vertexArray, location, 0);
   }
 }
 
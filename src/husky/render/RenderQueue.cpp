@@ -0,0 +1,344 @@
+#include <husky/render/RenderQueue.hpp>
+#include <husky/mesh/Material.hpp>
+#include <husky/render/MaterialTable.hpp>
+#include <husky/render/BakedAnimation.hpp>
+#include <husky/render/RenderData.hpp>
+#include <husky/render/RenderState.hpp>
+#include <husky/render/RingBuffer.hpp>
+#include <husky/render/Shader.hpp>
+#include <husky/render/SharedMeshBuffer.hpp>
+#include <husky/Log.hpp>
+#include <glad/glad.h>
+#include <algorithm>
+#include <array>
+#include <cstring>
+
+namespace husky {
+
+static std::uint64_t getDepthBits(float depth, int numBits)
+{
+  // The bit pattern of a non-negative float increases monotonically with its value
+  depth = std::max(depth, 0.f);
+  std::uint32_t bits;
+  std::memcpy(&bits, &depth, sizeof(bits));
+  return (bits >> (31 - numBits));
+}
+
+std::uint64_t RenderQueue::makeSortKey(RenderPass pass, unsigned int shaderId, unsigned int textureId, unsigned int materialId, float depth)
+{
+  // Solid:       | pass:2 | shader:12 | texture:12 | material:14 | depth:24 |
+  // Translucent: | pass:2 | ~depth:24 | shader:12 | texture:12 | material:14 |
+  const std::uint64_t state = ((std::uint64_t)(shaderId & 0xFFF) << 26) | ((std::uint64_t)(textureId & 0xFFF) << 14) | (materialId & 0x3FFF);
+  const std::uint64_t depthBits = getDepthBits(depth, 24);
+
+  if (pass == RenderPass::SOLID) {
+    return ((std::uint64_t)pass << 62) | (state << 24) | depthBits;
+  }
+  else {
+    return ((std::uint64_t)pass << 62) | ((~depthBits & 0xFFFFFF) << 38) | state;
+  }
+}
+
+RenderQueue::RenderQueue()
+  : viewport()
+  , view(Matrix44f::identity())
+  , projection(Matrix44f::identity())
+  , cullingPass(nullptr)
+  , ringBuffer(nullptr)
+  , materialTable(nullptr)
+  , items()
+  , order()
+  , sortScratch()
+  , batches()
+  , drawCommands()
+  , drawModelViews()
+  , drawMaterials()
+  , cullingDraws()
+  , commandBuffer(0)
+  , drawParamsBuffer(0)
+  , drawMaterialsBuffer(0)
+  , frameCommandBuffer(0)
+  , frameCommandOffset(0)
+  , frameParamsBuffer(0)
+  , frameParamsOffset(0)
+  , frameMaterialsBuffer(0)
+  , frameMaterialsOffset(0)
+{
+}
+
+RenderQueue::~RenderQueue()
+{
+  if (commandBuffer != 0) {
+    RenderState::global().deleteBuffer(commandBuffer);
+    RenderState::global().deleteBuffer(drawParamsBuffer);
+    RenderState::global().deleteBuffer(drawMaterialsBuffer);
+  }
+}
+
+void RenderQueue::begin(const Viewport &viewport, const Matrix44f &view, const Matrix44f &projection)
+{
+  this->viewport = viewport;
+  this->view = view;
+  this->projection = projection;
+  items.clear();
+  order.clear();
+}
+
+void RenderQueue::add(const Shader &shader, const Material &material, const RenderData &renderData, const Matrix44f &modelView)
+{
+  addItem(shader, material, renderData, modelView);
+}
+
+DrawItem& RenderQueue::addItem(const Shader &shader, const Material &material, const RenderData &renderData, const Matrix44f &modelView)
+{
+  const RenderPass pass = (material.opacity < 1.f ? RenderPass::TRANSLUCENT : RenderPass::SOLID);
+  const float depth = -modelView.m[14]; // View space distance of the object origin along the view direction
+  unsigned int textureId = material.tex.handle;
+  unsigned int materialId = (unsigned int)((std::uintptr_t)&material >> 4); // Only used for grouping; collisions are harmless
+  if (materialTable != nullptr && shader.hasMaterialTable()) {
+    if (const unsigned int batchKey = materialTable->getBatchKey(material)) { // Table materials that can share a multi-draw sort together, front-to-back
+      textureId = batchKey;
+      materialId = 0;
+    }
+  }
+
+  DrawItem item;
+  item.sortKey = makeSortKey(pass, shader.shaderProgramHandle, textureId, materialId, depth);
+  item.shader = &shader;
+  item.material = &material;
+  item.renderData = &renderData;
+  item.mtxBones = nullptr;
+  item.bakedAnimation = nullptr;
+  item.bakedTime = 0.f;
+  item.boneOffset = 0;
+  item.skinnedVbo = 0;
+  item.modelView = modelView;
+  item.boundingSphere = Vector4f(0.f, 0.f, 0.f, -1.f);
+
+  order.push_back({ item.sortKey, (int)items.size() });
+  items.emplace_back(item);
+  return items.back();
+}
+
+void RenderQueue::sort()
+{
+  for (SortEntry &entry : order) { // Keys may have been changed through addItem()
+    entry.key = items[entry.itemIndex].sortKey;
+  }
+
+  if (order.size() < 2) {
+    return;
+  }
+
+  // LSD radix sort with 8-bit digits; stable, so equal keys keep their insertion order
+  sortScratch.resize(order.size());
+  for (int shift = 0; shift < 64; shift += 8) {
+    std::array<int, 257> offsets = {};
+    for (const SortEntry &entry : order) {
+      offsets[((entry.key >> shift) & 0xFF) + 1]++;
+    }
+
+    const int firstDigit = (int)((order.front().key >> shift) & 0xFF);
+    if (offsets[firstDigit + 1] == (int)order.size()) { // All keys share this digit
+      continue;
+    }
+
+    for (int i = 1; i < 257; i++) {
+      offsets[i] += offsets[i - 1];
+    }
+    for (const SortEntry &entry : order) {
+      sortScratch[offsets[(entry.key >> shift) & 0xFF]++] = entry;
+    }
+    order.swap(sortScratch);
+  }
+}
+
+void RenderQueue::submit()
+{
+  buildBatches();
+  uploadDrawParams();
+
+  if (cullingPass != nullptr) { // Culled commands keep their slot with an instance count of 0, so the batches stay valid
+    cullingPass->cull(frameCommandBuffer, frameCommandOffset, cullingDraws, view, projection);
+  }
+
+  RenderState &renderState = RenderState::global();
+  const int drawIdLocation = VertexAttribute::getLocation(VertexAttribute::DRAW_ID);
+  int boundSegment = 0; // The whole range is bound, which starts with segment 0
+
+  for (const DrawBatch &batch : batches) {
+    const DrawItem &item = items[order[batch.firstOrder].itemIndex];
+    const Shader &shader = *item.shader;
+
+    const int segment = (batch.firstDrawId >= 0 ? batch.firstDrawId / SharedMeshBuffer::maxDrawIds : boundSegment);
+    if (segment != boundSegment) {
+      bindDrawParamSegment(segment);
+      boundSegment = segment;
+    }
+
+    if (batch.commandCount > 0) { // All items of the batch share shader, vertex array and material, or a material table batch key
+      if (!RenderData::bindDrawState(shader, *item.material, viewport, view, item.modelView, projection)) {
+        continue;
+      }
+      if (materialTable != nullptr && shader.hasMaterialTable()) {
+        materialTable->bind(shader, *item.material);
+      }
+      renderState.bindVertexArray(item.renderData->sharedBuffer->vao);
+      renderState.bindBuffer(GL_DRAW_INDIRECT_BUFFER, frameCommandBuffer);
+      const void *offset = ((const std::uint8_t*)nullptr) + frameCommandOffset + batch.firstCommand * sizeof(DrawCommand);
+      glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_SHORT, offset, batch.commandCount, 0);
+      continue;
+    }
+
+    if (batch.firstDrawId >= 0) { // Other VAOs have no draw ID array, so the constant attribute value is read instead
+      glVertexAttribI4ui(drawIdLocation, (GLuint)(batch.firstDrawId % SharedMeshBuffer::maxDrawIds), 0, 0, 0);
+    }
+
+    if (item.bakedAnimation != nullptr) {
+      item.bakedAnimation->bind(shader, item.bakedTime, item.boneOffset);
+    }
+    else if (const ShaderUniform &uniform = shader.getUniform(UniformSlot::BONE_OFFSET)) {
+      renderState.useProgram(shader.shaderProgramHandle);
+      glUniform1i(uniform.location, item.boneOffset);
+    }
+
+    if (materialTable != nullptr && shader.hasMaterialTable()) {
+      materialTable->bind(shader, *item.material);
+    }
+
+    static const std::vector<Matrix44f> noBones;
+    item.renderData->draw(shader, *item.material, viewport, view, item.modelView, projection, (item.mtxBones != nullptr ? *item.mtxBones : noBones), item.skinnedVbo);
+  }
+}
+
+int RenderQueue::numBatches() const
+{
+  return (int)batches.size();
+}
+
+int RenderQueue::size() const
+{
+  return (int)order.size();
+}
+
+const DrawItem& RenderQueue::operator[](int i) const
+{
+  return items[order[i].itemIndex];
+}
+
+void RenderQueue::buildBatches()
+{
+  batches.clear();
+  drawCommands.clear();
+  drawModelViews.clear();
+  drawMaterials.clear();
+  cullingDraws.clear();
+
+  for (int iOrder = 0; iOrder < (int)order.size(); iOrder++) {
+    const DrawItem &item = items[order[iOrder].itemIndex];
+
+    if (!item.shader->hasDrawParams()) {
+      batches.push_back({ iOrder, -1, 0, 0 });
+      continue;
+    }
+
+    const int drawId = (int)drawModelViews.size();
+    drawModelViews.push_back(item.modelView);
+    if (materialTable != nullptr) {
+      drawMaterials.push_back(item.shader->hasMaterialTable() ? materialTable->find(*item.material) : -1);
+    }
+
+    const RenderData &renderData = *item.renderData;
+    if (renderData.sharedBuffer == nullptr) {
+      batches.push_back({ iOrder, drawId, 0, 0 });
+      continue;
+    }
+
+    bool join = false;
+    if (!batches.empty() && batches.back().commandCount > 0) {
+      const DrawItem &first = items[order[batches.back().firstOrder].itemIndex];
+      const bool sameMaterial = (first.material == item.material || (materialTable != nullptr && item.shader->hasMaterialTable() && materialTable->canBatch(*first.material, *item.material)));
+      const bool sameSegment = (drawId % SharedMeshBuffer::maxDrawIds != 0); // Draw IDs of a multi-draw are relative to one segment
+      join = (first.shader == item.shader && sameMaterial && first.renderData->sharedBuffer == renderData.sharedBuffer && sameSegment);
+    }
+
+    if (!join) {
+      batches.push_back({ iOrder, drawId, (int)drawCommands.size(), 0 });
+    }
+
+    if (item.boundingSphere.w >= 0.f) {
+      cullingDraws.push_back({ item.boundingSphere, (std::uint32_t)drawCommands.size(), (std::uint32_t)renderData.indexChunks.size(), (std::uint32_t)drawId, 0 });
+    }
+
+    for (const IndexChunk &chunk : renderData.indexChunks) {
+      drawCommands.push_back({ (std::uint32_t)chunk.indexCount, 1, (std::uint32_t)chunk.firstIndex, chunk.baseVertex, (std::uint32_t)(drawId % SharedMeshBuffer::maxDrawIds) });
+      batches.back().commandCount++;
+    }
+  }
+}
+
+void RenderQueue::uploadDrawParams()
+{
+  if (drawModelViews.empty()) {
+    return;
+  }
+
+  const std::size_t commandBytes = drawCommands.size() * sizeof(DrawCommand);
+  const std::size_t paramBytes = drawModelViews.size() * sizeof(Matrix44f);
+  const std::size_t materialBytes = drawMaterials.size() * sizeof(std::int32_t);
+
+  if (ringBuffer != nullptr) {
+    const RingAllocation commands = ringBuffer->upload(drawCommands.data(), commandBytes);
+    const RingAllocation params = ringBuffer->upload(drawModelViews.data(), paramBytes);
+    const RingAllocation materials = (materialBytes > 0 ? ringBuffer->upload(drawMaterials.data(), materialBytes) : RingAllocation());
+    if (commands.valid() && params.valid() && (materialBytes == 0 || materials.valid())) {
+      frameCommandBuffer = commands.buffer;
+      frameCommandOffset = commands.offset;
+      frameParamsBuffer = params.buffer;
+      frameParamsOffset = params.offset;
+      frameMaterialsBuffer = materials.buffer;
+      frameMaterialsOffset = materials.offset;
+      RenderState::global().bindBufferRange(GL_SHADER_STORAGE_BUFFER, drawParamsBinding, params.buffer, params.offset, params.size);
+      if (materialBytes > 0) {
+        RenderState::global().bindBufferRange(GL_SHADER_STORAGE_BUFFER, MaterialTable::drawMaterialsBinding, materials.buffer, materials.offset, materials.size);
+      }
+      return;
+    }
+  }
+
+  // Without a ring buffer, or if it is full this frame
+  if (commandBuffer == 0) {
+    glCreateBuffers(1, &commandBuffer);
+    glCreateBuffers(1, &drawParamsBuffer);
+    glCreateBuffers(1, &drawMaterialsBuffer);
+  }
+
+  // Orphan the previous contents so the driver does not stall on draws still reading them
+  glNamedBufferData(commandBuffer, commandBytes, drawCommands.data(), GL_STREAM_DRAW);
+  glNamedBufferData(drawParamsBuffer, paramBytes, drawModelViews.data(), GL_STREAM_DRAW);
+  RenderState::global().bindBufferBase(GL_SHADER_STORAGE_BUFFER, drawParamsBinding, drawParamsBuffer);
+  if (materialBytes > 0) {
+    glNamedBufferData(drawMaterialsBuffer, materialBytes, drawMaterials.data(), GL_STREAM_DRAW);
+    RenderState::global().bindBufferBase(GL_SHADER_STORAGE_BUFFER, MaterialTable::drawMaterialsBinding, drawMaterialsBuffer);
+  }
+  frameCommandBuffer = commandBuffer;
+  frameCommandOffset = 0;
+  frameParamsBuffer = drawParamsBuffer;
+  frameParamsOffset = 0;
+  frameMaterialsBuffer = drawMaterialsBuffer;
+  frameMaterialsOffset = 0;
+}
+
+void RenderQueue::bindDrawParamSegment(int segment)
+{
+  // Segments start at multiples of maxDrawIds, which keeps the offsets aligned
+  const int firstDrawId = segment * SharedMeshBuffer::maxDrawIds;
+  const int drawCount = std::min((int)drawModelViews.size() - firstDrawId, SharedMeshBuffer::maxDrawIds);
+  RenderState &renderState = RenderState::global();
+  renderState.bindBufferRange(GL_SHADER_STORAGE_BUFFER, drawParamsBinding, frameParamsBuffer, frameParamsOffset + firstDrawId * sizeof(Matrix44f), drawCount * sizeof(Matrix44f));
+  if (!drawMaterials.empty()) {
+    renderState.bindBufferRange(GL_SHADER_STORAGE_BUFFER, MaterialTable::drawMaterialsBinding, frameMaterialsBuffer, frameMaterialsOffset + firstDrawId * sizeof(std::int32_t), drawCount * sizeof(std::int32_t));
+  }
+}
+
+}
@@ -0,0 +1,236 @@
+#include <husky/render/RenderState.hpp>
+#include <glad/glad.h>
+
+namespace husky {
+
+PipelineState::PipelineState(bool cullFace, bool depthTest, bool blend)
+  : cullFace(cullFace)
+  , depthTest(depthTest)
+  , blend(blend)
+{
+}
+
+bool PipelineState::operator==(const PipelineState &other) const
+{
+  return (cullFace == other.cullFace && depthTest == other.depthTest && blend == other.blend);
+}
+
+bool PipelineState::operator!=(const PipelineState &other) const
+{
+  return !(*this == other);
+}
+
+RenderState& RenderState::global()
+{
+  static RenderState *renderState = new RenderState(); // Never destroyed, so GL objects released during static destruction can still use it
+  return *renderState;
+}
+
+RenderState::RenderState()
+  : numStateChanges(0)
+  , numSkippedChanges(0)
+  , cullFace(-1)
+  , depthTest(-1)
+  , blend(-1)
+  , program(unknown)
+  , activeTextureUnit(-1)
+  , textures()
+  , buffers()
+  , indexedBuffers()
+  , vertexArray(unknown)
+{
+  invalidate();
+}
+
+void RenderState::apply(const PipelineState &pipelineState)
+{
+  setCapability(GL_CULL_FACE, cullFace, pipelineState.cullFace);
+  setCapability(GL_DEPTH_TEST, depthTest, pipelineState.depthTest);
+
+  if (pipelineState.blend && blend != 1) { // Others (e.g., ImGui) may have changed the blend function while blending was off
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+  }
+  setCapability(GL_BLEND, blend, pipelineState.blend);
+}
+
+void RenderState::useProgram(unsigned int newProgram)
+{
+  if (skip(program == newProgram)) {
+    return;
+  }
+  glUseProgram(newProgram);
+  program = newProgram;
+}
+
+void RenderState::bindTexture(int unit, unsigned int texture)
+{
+  if (unit < 0 || unit >= maxTextureUnits) { // Not shadowed
+    glActiveTexture(GL_TEXTURE0 + unit);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    activeTextureUnit = unit;
+    numStateChanges++;
+    return;
+  }
+
+  if (skip(textures[unit] == texture)) {
+    return;
+  }
+  if (activeTextureUnit != unit) {
+    glActiveTexture(GL_TEXTURE0 + unit);
+    activeTextureUnit = unit;
+  }
+  glBindTexture(GL_TEXTURE_2D, texture);
+  textures[unit] = texture;
+}
+
+void RenderState::bindBuffer(unsigned int target, unsigned int buffer)
+{
+  const int iTarget = getBufferTarget(target);
+  if (iTarget == (int)BufferTarget::ELEMENT_ARRAY) { // Part of the VAO state
+    glBindBuffer(target, buffer);
+    numStateChanges++;
+    return;
+  }
+
+  if (iTarget >= 0 && skip(buffers[iTarget] == buffer)) {
+    return;
+  }
+  glBindBuffer(target, buffer);
+  if (iTarget >= 0) {
+    buffers[iTarget] = buffer;
+  }
+  else {
+    numStateChanges++;
+  }
+}
+
+void RenderState::bindBufferBase(unsigned int target, int index, unsigned int buffer)
+{
+  const int iTarget = getBufferTarget(target);
+  if (iTarget < 0 || index < 0 || index >= maxIndexedBindings) {
+    glBindBufferBase(target, index, buffer);
+    if (iTarget >= 0) {
+      buffers[iTarget] = buffer;
+    }
+    numStateChanges++;
+    return;
+  }
+
+  if (skip(indexedBuffers[iTarget][index] == buffer)) {
+    return;
+  }
+  glBindBufferBase(target, index, buffer);
+  indexedBuffers[iTarget][index] = buffer;
+  buffers[iTarget] = buffer;
+}
+
+void RenderState::bindBufferRange(unsigned int target, int index, unsigned int buffer, std::size_t offset, std::size_t size)
+{
+  glBindBufferRange(target, index, buffer, (GLintptr)offset, (GLsizeiptr)size);
+  numStateChanges++;
+
+  const int iTarget = getBufferTarget(target);
+  if (iTarget >= 0) {
+    buffers[iTarget] = buffer;
+    if (index >= 0 && index < maxIndexedBindings) {
+      indexedBuffers[iTarget][index] = unknown; // A later bindBufferBase() of the same buffer must not be skipped
+    }
+  }
+}
+
+void RenderState::bindVertexArray(unsigned int vao)
+{
+  if (skip(vertexArray == vao)) {
+    return;
+  }
+  glBindVertexArray(vao);
+  vertexArray = vao;
+}
+
+void RenderState::deleteBuffer(unsigned int buffer)
+{
+  glDeleteBuffers(1, &buffer);
+
+  for (unsigned int &binding : buffers) {
+    if (binding == buffer) {
+      binding = 0;
+    }
+  }
+  for (auto &bindings : indexedBuffers) {
+    for (unsigned int &binding : bindings) {
+      if (binding == buffer) {
+        binding = 0;
+      }
+    }
+  }
+}
+
+void RenderState::deleteVertexArray(unsigned int vao)
+{
+  glDeleteVertexArrays(1, &vao);
+
+  if (vertexArray == vao) {
+    vertexArray = 0;
+  }
+}
+
+void RenderState::invalidate()
+{
+  cullFace = -1;
+  depthTest = -1;
+  blend = -1;
+  program = unknown;
+  activeTextureUnit = -1;
+  textures.fill(unknown);
+  buffers.fill(unknown);
+  for (auto &bindings : indexedBuffers) {
+    bindings.fill(unknown);
+  }
+  vertexArray = unknown;
+}
+
+void RenderState::resetCounters()
+{
+  numStateChanges = 0;
+  numSkippedChanges = 0;
+}
+
+int RenderState::getBufferTarget(unsigned int target)
+{
+  switch (target) {
+  case GL_ARRAY_BUFFER:              return (int)BufferTarget::ARRAY;
+  case GL_ELEMENT_ARRAY_BUFFER:      return (int)BufferTarget::ELEMENT_ARRAY;
+  case GL_UNIFORM_BUFFER:            return (int)BufferTarget::UNIFORM;
+  case GL_SHADER_STORAGE_BUFFER:     return (int)BufferTarget::SHADER_STORAGE;
+  case GL_TRANSFORM_FEEDBACK_BUFFER: return (int)BufferTarget::TRANSFORM_FEEDBACK;
+  case GL_DRAW_INDIRECT_BUFFER:      return (int)BufferTarget::DRAW_INDIRECT;
+  default:                           return -1;
+  }
+}
+
+void RenderState::setCapability(unsigned int cap, int &current, bool enable)
+{
+  if (skip(current == (int)enable)) {
+    return;
+  }
+  if (enable) {
+    glEnable(cap);
+  }
+  else {
+    glDisable(cap);
+  }
+  current = (int)enable;
+}
+
+bool RenderState::skip(bool unchanged)
+{
+  if (unchanged) {
+    numSkippedChanges++;
+  }
+  else {
+    numStateChanges++;
+  }
+  return unchanged;
+}
+
+}
@@ -0,0 +1,158 @@
+#include <husky/render/RingBuffer.hpp>
+#include <husky/render/RenderState.hpp>
+#include <husky/Log.hpp>
+#include <glad/glad.h>
+#include <algorithm>
+#include <cstring>
+
+namespace husky {
+
+static constexpr GLbitfield mapFlags = (GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT);
+
+RingAllocation::RingAllocation()
+  : buffer(0)
+  , offset(0)
+  , size(0)
+  , data(nullptr)
+{
+}
+
+bool RingAllocation::valid() const
+{
+  return (buffer != 0);
+}
+
+RingBuffer::RingBuffer(std::size_t frameSize)
+  : frameSize(frameSize)
+  , buffer(0)
+  , numStalls(0)
+  , numOverflows(0)
+  , fences()
+  , offsetAlignment(256)
+  , frameOffset(0)
+  , requiredFrameSize(0)
+  , frameIndex(0)
+  , mappedData(nullptr)
+{
+  fences.fill(nullptr);
+}
+
+RingBuffer::~RingBuffer()
+{
+  if (buffer != 0) {
+    destroy();
+  }
+}
+
+void RingBuffer::beginFrame()
+{
+  if (requiredFrameSize > frameSize) { // Rare; the old regions must be idle before the buffer can be replaced
+    destroy();
+    frameSize = std::max(requiredFrameSize, frameSize * 2);
+    numOverflows = 0;
+  }
+
+  if (buffer == 0) {
+    create();
+  }
+
+  frameIndex = (frameIndex + 1) % framesInFlight;
+  frameOffset = 0;
+  requiredFrameSize = 0;
+
+  if (GLsync fence = (GLsync)fences[frameIndex]) {
+    if (glClientWaitSync(fence, 0, 0) == GL_TIMEOUT_EXPIRED) { // The GPU is more than two frames behind
+      numStalls++;
+      while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED) {}
+    }
+    glDeleteSync(fence);
+    fences[frameIndex] = nullptr;
+  }
+}
+
+void RingBuffer::endFrame()
+{
+  if (buffer == 0) {
+    return;
+  }
+
+  if (fences[frameIndex] != nullptr) { // endFrame() without beginFrame()
+    glDeleteSync((GLsync)fences[frameIndex]);
+  }
+  fences[frameIndex] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+RingAllocation RingBuffer::allocate(std::size_t size, std::size_t alignment)
+{
+  RingAllocation allocation;
+  if (buffer == 0) {
+    Log::warning("RingBuffer::allocate() before beginFrame()");
+    return allocation;
+  }
+
+  if (alignment == 0) {
+    alignment = offsetAlignment;
+  }
+
+  const std::size_t offset = (frameOffset + alignment - 1) / alignment * alignment;
+  requiredFrameSize = std::max(requiredFrameSize, offset + size);
+  if (offset + size > frameSize) {
+    numOverflows++;
+    return allocation;
+  }
+
+  frameOffset = offset + size;
+  allocation.buffer = buffer;
+  allocation.offset = frameIndex * frameSize + offset;
+  allocation.size = size;
+  allocation.data = mappedData + allocation.offset;
+  return allocation;
+}
+
+RingAllocation RingBuffer::upload(const void *data, std::size_t size, std::size_t alignment)
+{
+  RingAllocation allocation = allocate(size, alignment);
+  if (allocation.valid()) {
+    std::memcpy(allocation.data, data, size);
+  }
+  return allocation;
+}
+
+void RingBuffer::create()
+{
+  GLint uniformAlignment = 0;
+  GLint storageAlignment = 0;
+  glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &uniformAlignment);
+  glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &storageAlignment);
+  offsetAlignment = (std::size_t)std::max({ uniformAlignment, storageAlignment, 16 });
+  frameSize = (frameSize + offsetAlignment - 1) / offsetAlignment * offsetAlignment; // Every region starts aligned
+
+  glCreateBuffers(1, &buffer);
+  glNamedBufferStorage(buffer, frameSize * framesInFlight, nullptr, mapFlags);
+  mappedData = (std::uint8_t*)glMapNamedBufferRange(buffer, 0, frameSize * framesInFlight, mapFlags);
+  if (mappedData == nullptr) {
+    Log::warning("Failed to map ring buffer");
+    RenderState::global().deleteBuffer(buffer);
+    buffer = 0;
+  }
+}
+
+void RingBuffer::destroy()
+{
+  for (void *&fence : fences) {
+    if (fence != nullptr) {
+      glClientWaitSync((GLsync)fence, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+      glDeleteSync((GLsync)fence);
+      fence = nullptr;
+    }
+  }
+
+  if (buffer != 0) {
+    glUnmapNamedBuffer(buffer);
+    RenderState::global().deleteBuffer(buffer);
+    buffer = 0;
+    mappedData = nullptr;
+  }
+}
+
+}
@@ -1,4 +1,6 @@
 #include <husky/render/Shader.hpp>
+#include <husky/render/RenderData.hpp>
+#include <husky/render/ShaderRegistry.hpp>
 #include <husky/Log.hpp>
 #include <glad/glad.h>
 #include <vector>
@@ -43,6 +45,36 @@ ShaderAttribute::operator bool() const
   return (location != -1);
 }
 
+static const char *uniformSlotNames[(int)UniformSlot::COUNT] = {
+  "mtxModelView",
+  "mtxNormal",
+  "mtxProjection",
+  "mtxBones",
+  "boneOffset",
+  "bakedBoneOffset",
+  "bakedBones",
+  "bakedTime",
+  "bakedFramesPerSecond",
+  "bakedFrameCount",
+  "tex",
+  "lightDir",
+  "mtlAmbient",
+  "mtlDiffuse",
+  "mtlSpecular",
+  "mtlEmissive",
+  "mtlShininess",
+  "mtlShininessStrength",
+  "viewportSize",
+  "lineWidth",
+  "mtlTextures",
+  "pointLayout",
+};
+
+static const char *uniformBlockNames[(int)UniformBlock::COUNT] = {
+  "FrameUniforms",
+  "MaterialUniforms",
+};
+
 static GLuint compileShader(GLenum shaderType, const std::string &shaderSrc)
 {
   GLuint shader = glCreateShader(shaderType);
@@ -69,21 +101,8 @@ static GLuint compileShader(GLenum shaderType, const std::string &shaderSrc)
   return shader;
 }
 
-static GLuint compileShaderProgram(const std::string &vertSrc, const std::string &geomSrc, const std::string &fragSrc)
+static GLuint linkShaderProgram(GLuint program)
 {
-  GLuint program = glCreateProgram();
-
-  GLuint vertShader = compileShader(GL_VERTEX_SHADER, vertSrc);
-  glAttachShader(program, vertShader);
-
-  if (!geomSrc.empty()) {
-    GLuint geomShader = compileShader(GL_GEOMETRY_SHADER, geomSrc);
-    glAttachShader(program, geomShader);
-  }
-
-  GLuint fragShader = compileShader(GL_FRAGMENT_SHADER, fragSrc);
-  glAttachShader(program, fragShader);
-
   glLinkProgram(program);
 
   GLint isLinked = GL_FALSE;
@@ -105,22 +124,90 @@ static GLuint compileShaderProgram(const std::string &vertSrc, const std::string
   return program;
 }
 
+static GLuint compileShaderProgram(const std::string &vertSrc, const std::string &geomSrc, const std::string &fragSrc, const std::vector<const char*> &feedbackVaryings = {})
+{
+  GLuint program = glCreateProgram();
+
+  GLuint vertShader = compileShader(GL_VERTEX_SHADER, vertSrc);
+  glAttachShader(program, vertShader);
+
+  if (!geomSrc.empty()) {
+    GLuint geomShader = compileShader(GL_GEOMETRY_SHADER, geomSrc);
+    glAttachShader(program, geomShader);
+  }
+
+  if (!fragSrc.empty()) { // May be empty for transform feedback programs
+    GLuint fragShader = compileShader(GL_FRAGMENT_SHADER, fragSrc);
+    glAttachShader(program, fragShader);
+  }
+
+  if (!feedbackVaryings.empty()) {
+    glTransformFeedbackVaryings(program, (GLsizei)feedbackVaryings.size(), feedbackVaryings.data(), GL_INTERLEAVED_ATTRIBS);
+  }
+
+  // Fixed locations let each RenderData configure its VAO once for all shaders
+  for (int location = 0; location < VertexAttribute::LOCATION_COUNT; location++) {
+    glBindAttribLocation(program, location, VertexAttribute::getLocationName(location));
+  }
+
+  return linkShaderProgram(program);
+}
+
 Shader Shader::getDefaultShader(bool texture, bool bones)
+{
+  return getDefaultShader(texture, bones ? SkinningMode::UNIFORM_ARRAY : SkinningMode::NONE);
+}
+
+Shader Shader::getDefaultShader(bool texture, SkinningMode skinning, bool multiDraw, bool materialTable)
+{
+  return ShaderRegistry::global().get(getDefaultShaderSource(texture, skinning, multiDraw, materialTable));
+}
+
+ShaderSource Shader::getDefaultShaderSource(bool texture, SkinningMode skinning, bool multiDraw, bool materialTable)
 {
   static const char *defaultVertSrc =
 R"(//#version 400 core
-#ifdef USE_BONES
-#ifndef MAX_BONES
-#define MAX_BONES 100 // Note: We use 8-bit bone indices, so use MAX_BONES <= 256
-#endif
-uniform mat4 mtxBones[MAX_BONES] = mat4[MAX_BONES](mat4(1.0));
-uniform bool useBones = true; // TODO: Rewrite shader to avoid if-else branching
+#if defined(USE_BONES) || defined(USE_BONE_BUFFER) || defined(USE_BAKED_BONES)
 in ivec4 vertBoneIndices;
 in vec4 vertBoneWeights;
 #endif
+#ifdef USE_BONE_BUFFER
+layout(std430, binding = 0) readonly buffer BonePalettes { mat4 bonePalettes[]; }; // See BonePaletteBuffer
+uniform int boneOffset = 0; // Index of the first bone of this draw; 0 => Identity
+#endif
+#ifdef USE_BONES
+uniform mat4 mtxBones[MAX_BONES] = mat4[MAX_BONES](mat4(1.0)); // Meshes without bones get constant bone weights (1,0,0,0)
+#endif
+#ifdef USE_BAKED_BONES
+uniform sampler2D bakedBones; // RGBA32F; one row per frame, four texels (matrix columns) per bone
+uniform float bakedTime = 0.0; // Seconds
+uniform float bakedFramesPerSecond = 30.0;
+uniform int bakedFrameCount = 1;
+uniform int bakedBoneOffset = -1; // -1 => Mesh has no bones
+mat4 getBakedBone(int iBone, int iFrame) {
+  int x = (bakedBoneOffset + iBone) * 4;
+  return mat4(texelFetch(bakedBones, ivec2(x + 0, iFrame), 0),
+              texelFetch(bakedBones, ivec2(x + 1, iFrame), 0),
+              texelFetch(bakedBones, ivec2(x + 2, iFrame), 0),
+              texelFetch(bakedBones, ivec2(x + 3, iFrame), 0));
+}
+mat4 getBakedBone(int iBone, int iFrame0, int iFrame1, float t) {
+  return getBakedBone(iBone, iFrame0) * (1.0 - t) + getBakedBone(iBone, iFrame1) * t;
+}
+#endif
+#ifdef USE_DRAW_PARAMS
+layout(std430, binding = 1) readonly buffer DrawParams { mat4 drawModelViews[]; }; // See RenderQueue::submit()
+in uint vertDrawId; // gl_DrawID needs GLSL 4.60, so the instanced draw ID attribute is offset by baseInstance instead
+#define mtxModelView drawModelViews[vertDrawId]
+#define mtxNormal mat3(drawModelViews[vertDrawId]) // Uniform scaling only
+#ifdef USE_MATERIAL_TABLE
+layout(std430, binding = 6) readonly buffer DrawMaterials { int drawMaterials[]; }; // See RenderQueue::materialTable
+flat out int varMaterial;
+#endif
+#else
 uniform mat4 mtxModelView;
 uniform mat3 mtxNormal;
-uniform mat4 mtxProjection;
+#endif
 in vec3 vertPosition;
 in vec3 vertNormal;
 in vec2 vertTexCoord;
@@ -130,14 +217,30 @@ out vec3 varNormal;
 out vec2 varTexCoord;
 out vec4 varColor;
 void main() {
-#ifdef USE_BONES
+#if defined(USE_BAKED_BONES)
   mat4 mtxBone = mat4(1.0);
-  if (useBones) {
-    mtxBone = mtxBones[vertBoneIndices[0]] * vertBoneWeights[0]
-            + mtxBones[vertBoneIndices[1]] * vertBoneWeights[1]
-            + mtxBones[vertBoneIndices[2]] * vertBoneWeights[2]
-            + mtxBones[vertBoneIndices[3]] * vertBoneWeights[3];
+  if (bakedBoneOffset >= 0) {
+    float frame = mod(bakedTime * bakedFramesPerSecond, float(bakedFrameCount));
+    int iFrame0 = min(int(frame), bakedFrameCount - 1);
+    int iFrame1 = (iFrame0 + 1) % bakedFrameCount;
+    float t = frame - float(iFrame0);
+    mtxBone = getBakedBone(vertBoneIndices[0], iFrame0, iFrame1, t) * vertBoneWeights[0]
+            + getBakedBone(vertBoneIndices[1], iFrame0, iFrame1, t) * vertBoneWeights[1]
+            + getBakedBone(vertBoneIndices[2], iFrame0, iFrame1, t) * vertBoneWeights[2]
+            + getBakedBone(vertBoneIndices[3], iFrame0, iFrame1, t) * vertBoneWeights[3];
   }
+#elif defined(USE_BONES)
+  mat4 mtxBone = mtxBones[vertBoneIndices[0]] * vertBoneWeights[0]
+               + mtxBones[vertBoneIndices[1]] * vertBoneWeights[1]
+               + mtxBones[vertBoneIndices[2]] * vertBoneWeights[2]
+               + mtxBones[vertBoneIndices[3]] * vertBoneWeights[3];
+#elif defined(USE_BONE_BUFFER)
+  mat4 mtxBone = bonePalettes[boneOffset + vertBoneIndices[0]] * vertBoneWeights[0]
+               + bonePalettes[boneOffset + vertBoneIndices[1]] * vertBoneWeights[1]
+               + bonePalettes[boneOffset + vertBoneIndices[2]] * vertBoneWeights[2]
+               + bonePalettes[boneOffset + vertBoneIndices[3]] * vertBoneWeights[3];
+#endif
+#if defined(USE_BONES) || defined(USE_BONE_BUFFER) || defined(USE_BAKED_BONES)
   varPosition = mtxModelView * mtxBone * vec4(vertPosition, 1.0);
   varNormal = normalize(mtxNormal * (mtxBone * vec4(vertNormal, 0.0)).xyz);
 #else
@@ -146,24 +249,30 @@ void main() {
 #endif
   varTexCoord = vec2(vertTexCoord.x, 1.0 - vertTexCoord.y); // Flip V
   varColor = vertColor;
+#ifdef USE_MATERIAL_TABLE
+  varMaterial = drawMaterials[vertDrawId];
+#endif
   gl_Position = mtxProjection * varPosition;
 })";
 
   static const char *defaultFragSrc =
 R"(//#version 400 core
+#if defined(USE_TEXTURE) && defined(USE_MATERIAL_TABLE)
+uniform sampler2DArray mtlTextures; // See MaterialTable::bind()
+#endif
 #ifdef USE_TEXTURE
 uniform sampler2D tex;
 #endif
-uniform vec3 lightDir = vec3(20.0, -40.0, 100.0);
-uniform vec3 lightAmbient = vec3(0.05, 0.05, 0.05);
-uniform vec3 lightDiffuse = vec3(1.0, 1.0, 1.0);
-uniform vec3 lightSpecular = vec3(1.0, 1.0, 1.0);
-uniform vec3 mtlAmbient = vec3(1.0, 1.0, 1.0);
-uniform vec3 mtlDiffuse = vec3(1.0, 1.0, 1.0);
-uniform vec3 mtlSpecular = vec3(1.0, 1.0, 1.0);
-uniform vec3 mtlEmissive = vec3(0.0, 0.0, 0.0);
-uniform float mtlShininess = 100.0;
-uniform float mtlShininessStrength = 1.0;
+#ifdef USE_MATERIAL_TABLE
+flat in int varMaterial; // -1 => Not in the table; MaterialUniforms and tex hold the material of the draw
+#define mtlAmbient (varMaterial >= 0 ? tableMaterials[varMaterial].ambient : mtlAmbient)
+#define mtlDiffuse (varMaterial >= 0 ? tableMaterials[varMaterial].diffuse : mtlDiffuse)
+#define mtlSpecular (varMaterial >= 0 ? tableMaterials[varMaterial].specular : mtlSpecular)
+#define mtlEmissive (varMaterial >= 0 ? tableMaterials[varMaterial].emissive : mtlEmissive)
+#define mtlShininess (varMaterial >= 0 ? tableMaterials[varMaterial].shininess : mtlShininess)
+#define mtlShininessStrength (varMaterial >= 0 ? tableMaterials[varMaterial].shininessStrength : mtlShininessStrength)
+#define opacity (varMaterial >= 0 ? tableMaterials[varMaterial].opacity : opacity)
+#endif
 in vec4 varPosition;
 in vec3 varNormal;
 in vec2 varTexCoord;
@@ -172,29 +281,71 @@ out vec4 fragColor;
 void main() {
   vec3 v = varPosition.xyz;
   vec3 N = varNormal;
-  vec3 L = lightDir;
+  vec3 L = lightDir.xyz;
   vec3 E = normalize(-v);
   vec3 R = normalize(-reflect(L, N));
-  vec3 ambientColor = (lightAmbient * mtlAmbient);
+  vec3 ambientColor = (lightAmbient.rgb * mtlAmbient.rgb);
   float diffuseIntensity = clamp(dot(N, L), 0.0, 1.0);
-  vec3 diffuseColor = diffuseIntensity * lightDiffuse * mtlDiffuse;
+  vec3 diffuseColor = diffuseIntensity * lightDiffuse.rgb * mtlDiffuse.rgb;
   float specularIntensity = clamp(pow(max(dot(R, E), 0.0), mtlShininess) * mtlShininessStrength, 0.0, 1.0);
-  vec3 specularColor = specularIntensity * lightSpecular * mtlSpecular;
-#ifdef USE_TEXTURE
+  vec3 specularColor = specularIntensity * lightSpecular.rgb * mtlSpecular.rgb;
+#if defined(USE_TEXTURE) && defined(USE_MATERIAL_TABLE)
+  int layer = (varMaterial >= 0 ? tableMaterials[varMaterial].layer : -1);
+  vec4 texColor = (layer >= 0 ? texture(mtlTextures, vec3(varTexCoord, float(layer))) : (varMaterial >= 0 ? vec4(1.0) : texture(tex, varTexCoord)));
+#elif defined(USE_TEXTURE)
   vec4 texColor = texture(tex, varTexCoord);
 #else
   const vec4 texColor = vec4(1.0);
 #endif
   //texColor = vec4(1.0);
-  fragColor.rgb = ambientColor + (diffuseColor * varColor.rgb * texColor.rgb) + specularColor + mtlEmissive;
-  fragColor.a = varColor.a * texColor.a;
+  fragColor.rgb = ambientColor + (diffuseColor * varColor.rgb * texColor.rgb) + specularColor + mtlEmissive.rgb;
+  fragColor.a = varColor.a * texColor.a * opacity;
 })";
 
-  std::string header = "#version 400 core\n";
+  std::string header = ((skinning == SkinningMode::BONE_BUFFER || multiDraw || materialTable) ? "#version 430 core\n" : "#version 400 core\n");
   if (texture) { header += "#define USE_TEXTURE\n"; }
-  if (bones) { header += "#define USE_BONES\n"; }
-  
-  return Shader(header + defaultVertSrc, "", header + defaultFragSrc);
+  if (multiDraw || materialTable) { header += "#define USE_DRAW_PARAMS\n"; }
+  if (materialTable) { header += "#define USE_MATERIAL_TABLE\n"; }
+  if (skinning == SkinningMode::UNIFORM_ARRAY) { header += "#define USE_BONES\n#define MAX_BONES " + std::to_string(maxUniformBones) + "\n"; }
+  if (skinning == SkinningMode::BONE_BUFFER) { header += "#define USE_BONE_BUFFER\n"; }
+  if (skinning == SkinningMode::BAKED_TEXTURE) { header += "#define USE_BAKED_BONES\n"; }
+
+  // Shared by both stages; see FrameUniforms and MaterialUniforms
+  header +=
+R"(layout(std140) uniform FrameUniforms {
+  mat4 mtxProjection;
+  vec4 lightDir; // View space
+  vec4 lightAmbient;
+  vec4 lightDiffuse;
+  vec4 lightSpecular;
+  vec4 viewportSize;
+};
+#ifdef USE_MATERIAL_TABLE
+struct TableMaterial {
+  vec4 ambient;
+  vec4 diffuse;
+  vec4 specular;
+  vec4 emissive;
+  float shininess;
+  float shininessStrength;
+  float opacity;
+  int layer; // In mtlTextures; -1 => Untextured
+};
+layout(std430, binding = 5) readonly buffer MaterialTable { TableMaterial tableMaterials[]; };
+#endif
+layout(std140) uniform MaterialUniforms {
+  vec4 mtlAmbient;
+  vec4 mtlDiffuse;
+  vec4 mtlSpecular;
+  vec4 mtlEmissive;
+  float mtlShininess;
+  float mtlShininessStrength;
+  float lineWidth;
+  float opacity;
+};
+)";
+
+  return ShaderSource::graphics(header + defaultVertSrc, "", header + defaultFragSrc);
 }
 
 Shader Shader::getLineShader()
@@ -260,7 +411,37 @@ void main()
   fsColor = gsColor * vec4(mtlDiffuse, 1.0);
 })";
 
-  return Shader(lineVertSrc, lineGeomSrc, lineFragSrc);
+  return ShaderRegistry::global().get(ShaderSource::graphics(lineVertSrc, lineGeomSrc, lineFragSrc));
+}
+
+Shader Shader::getSkinningShader()
+{
+  static const char *skinningVertSrc =
+R"(#version 430 core
+layout(std430, binding = 3) readonly buffer BonePalettes { mat4 bonePalettes[]; }; // See SkinningPass::bonePalettesBinding
+uniform int boneOffset = 0;
+in vec3 vertPosition;
+in vec3 vertNormal;
+in ivec4 vertBoneIndices;
+in vec4 vertBoneWeights;
+out vec3 skinnedPosition;
+out vec3 skinnedNormal;
+void main()
+{
+  mat4 mtxBone = bonePalettes[boneOffset + vertBoneIndices[0]] * vertBoneWeights[0]
+               + bonePalettes[boneOffset + vertBoneIndices[1]] * vertBoneWeights[1]
+               + bonePalettes[boneOffset + vertBoneIndices[2]] * vertBoneWeights[2]
+               + bonePalettes[boneOffset + vertBoneIndices[3]] * vertBoneWeights[3];
+  skinnedPosition = (mtxBone * vec4(vertPosition, 1.0)).xyz;
+  skinnedNormal = normalize((mtxBone * vec4(vertNormal, 0.0)).xyz);
+})";
+
+  return ShaderRegistry::global().get(ShaderSource::graphics(skinningVertSrc, "", "", { "skinnedPosition", "skinnedNormal" }));
+}
+
+Shader Shader::getComputeShader(const std::string &compSrc)
+{
+  return ShaderRegistry::global().get(ShaderSource::compute(compSrc));
 }
 
 Shader::Shader()
@@ -270,6 +451,13 @@ Shader::Shader()
 
 Shader::Shader(unsigned int shaderProgramHandle)
   : shaderProgramHandle(shaderProgramHandle)
+  , uniforms()
+  , attrs()
+  , slotUniforms()
+  , uniformBlocks()
+  , drawParams(false)
+  , materialTable(false)
+  , pulledPoints(false)
 {
   GLint varSize;
   GLenum varType;
@@ -278,8 +466,10 @@ Shader::Shader(unsigned int shaderProgramHandle)
   GLsizei varNameLength;
 
   // Get active uniforms
-  int uniformCount;
-  glGetProgramiv(shaderProgramHandle, GL_ACTIVE_UNIFORMS, &uniformCount);
+  int uniformCount = 0;
+  if (shaderProgramHandle != 0) { // Invalid handles would only raise GL errors
+    glGetProgramiv(shaderProgramHandle, GL_ACTIVE_UNIFORMS, &uniformCount);
+  }
   for (int iUniform = 0; iUniform < uniformCount; iUniform++) {
     glGetActiveUniform(shaderProgramHandle, (GLuint)iUniform, varNameLengthMax, &varNameLength, &varSize, &varType, varName);
     std::string uniformName = varName;
@@ -291,12 +481,30 @@ Shader::Shader(unsigned int shaderProgramHandle)
   }
 
   // Get active (vertex) attributes
-  int attrCount;
-  glGetProgramiv(shaderProgramHandle, GL_ACTIVE_ATTRIBUTES, &attrCount);
+  int attrCount = 0;
+  if (shaderProgramHandle != 0) {
+    glGetProgramiv(shaderProgramHandle, GL_ACTIVE_ATTRIBUTES, &attrCount);
+  }
   for (int iAttr = 0; iAttr < attrCount; iAttr++) {
     glGetActiveAttrib(shaderProgramHandle, (GLuint)iAttr, varNameLengthMax, &varNameLength, &varSize, &varType, varName);
     attrs.emplace_back(varName, glGetAttribLocation(shaderProgramHandle, varName), varType, varSize);
   }
+
+  for (int iSlot = 0; iSlot < (int)UniformSlot::COUNT; iSlot++) {
+    slotUniforms[iSlot] = getUniform(uniformSlotNames[iSlot]);
+  }
+  drawParams = (bool)getAttribute(VertexAttribute::DRAW_ID);
+  materialTable = (shaderProgramHandle != 0 && glGetProgramResourceIndex(shaderProgramHandle, GL_SHADER_STORAGE_BLOCK, "MaterialTable") != GL_INVALID_INDEX);
+  pulledPoints = (shaderProgramHandle != 0 && glGetProgramResourceIndex(shaderProgramHandle, GL_SHADER_STORAGE_BLOCK, "PulledPoints") != GL_INVALID_INDEX);
+
+  // Uniform block bindings are fixed, so buffers bound once per frame or material serve all shaders
+  for (int iBlock = 0; iBlock < (int)UniformBlock::COUNT; iBlock++) {
+    const GLuint blockIndex = (shaderProgramHandle != 0 ? glGetUniformBlockIndex(shaderProgramHandle, uniformBlockNames[iBlock]) : GL_INVALID_INDEX);
+    uniformBlocks[iBlock] = (blockIndex != GL_INVALID_INDEX);
+    if (uniformBlocks[iBlock]) {
+      glUniformBlockBinding(shaderProgramHandle, blockIndex, (GLuint)iBlock);
+    }
+  }
 }
 
 Shader::Shader(const std::string &vertSrc, const std::string &geomSrc, const std::string &fragSrc)
@@ -315,6 +523,31 @@ const ShaderUniform& Shader::getUniform(const std::string &uniformName) const
   return empty;
 }
 
+const ShaderUniform& Shader::getUniform(UniformSlot slot) const
+{
+  return slotUniforms[(int)slot];
+}
+
+bool Shader::hasUniformBlock(UniformBlock block) const
+{
+  return uniformBlocks[(int)block];
+}
+
+bool Shader::hasDrawParams() const
+{
+  return drawParams;
+}
+
+bool Shader::hasMaterialTable() const
+{
+  return materialTable;
+}
+
+bool Shader::hasPulledPoints() const
+{
+  return pulledPoints;
+}
+
 const ShaderAttribute& Shader::getAttribute(const std::string &attrName) const
 {
   for (const ShaderAttribute &attr : attrs) {
@@ -0,0 +1,318 @@
+#include <husky/render/ShaderRegistry.hpp>
+#include <husky/render/RenderData.hpp>
+#include <husky/util/HashUtil.hpp>
+#include <husky/Log.hpp>
+#include <glad/glad.h>
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1 // GL_KHR_parallel_shader_compile
+#endif
+
+namespace fs = std::experimental::filesystem;
+
+namespace husky {
+
+static constexpr std::uint32_t binaryMagic = 0x42505348; // "HSPB"
+
+class BinaryHeader // Precedes the program binary in cache files
+{
+public:
+  std::uint32_t magic;
+  std::uint32_t format;
+  std::uint64_t driverHash;
+  std::uint64_t sourceHash;
+  std::uint32_t length;
+  std::uint32_t padding;
+};
+
+ShaderSource ShaderSource::graphics(const std::string &vertSrc, const std::string &geomSrc, const std::string &fragSrc, const std::vector<std::string> &feedbackVaryings)
+{
+  ShaderSource source;
+  source.vertSrc = vertSrc;
+  source.geomSrc = geomSrc;
+  source.fragSrc = fragSrc;
+  source.feedbackVaryings = feedbackVaryings;
+  return source;
+}
+
+ShaderSource ShaderSource::compute(const std::string &compSrc)
+{
+  ShaderSource source;
+  source.compSrc = compSrc;
+  return source;
+}
+
+std::uint64_t ShaderSource::hash() const
+{
+  std::uint64_t hash = HashUtil::initialHash;
+  for (const std::string *src : { &vertSrc, &geomSrc, &fragSrc, &compSrc }) {
+    hash = HashUtil::hashString(*src, hash);
+  }
+  for (const std::string &varying : feedbackVaryings) {
+    hash = HashUtil::hashString(varying, hash);
+  }
+  return hash;
+}
+
+ShaderRegistry& ShaderRegistry::global()
+{
+  static ShaderRegistry *registry = new ShaderRegistry(); // Never destroyed, like RenderState::global()
+  return *registry;
+}
+
+ShaderRegistry::ShaderRegistry()
+  : binaryCacheDirectory()
+  , numCompiled(0)
+  , numLoaded(0)
+  , entries()
+  , driverHash(0)
+  , parallelCompile(false)
+  , driverChecked(false)
+{
+}
+
+void ShaderRegistry::precompile(const ShaderSource &source)
+{
+  start(source);
+}
+
+bool ShaderRegistry::isReady(const ShaderSource &source)
+{
+  const Entry &entry = start(source);
+  if (entry.finished || !parallelCompile) {
+    return true;
+  }
+
+  GLint completed = GL_FALSE;
+  glGetProgramiv(entry.program, GL_COMPLETION_STATUS_KHR, &completed);
+  return (completed == GL_TRUE);
+}
+
+const Shader& ShaderRegistry::get(const ShaderSource &source)
+{
+  const std::uint64_t hash = source.hash();
+  Entry &entry = start(source);
+  if (!entry.finished) {
+    finish(entry, source, hash);
+  }
+  return entry.shader;
+}
+
+ShaderRegistry::Entry& ShaderRegistry::start(const ShaderSource &source)
+{
+  const std::uint64_t hash = source.hash();
+  auto it = entries.find(hash);
+  if (it != entries.end()) {
+    return it->second;
+  }
+
+  checkDriver();
+
+  Entry &entry = entries[hash];
+  entry.program = glCreateProgram();
+  entry.fromBinary = loadBinary(entry.program, hash);
+  entry.finished = false;
+  if (!entry.fromBinary) {
+    compile(entry, source);
+  }
+  return entry;
+}
+
+void ShaderRegistry::compile(Entry &entry, const ShaderSource &source)
+{
+  // No status queries here; they would wait for the driver and defeat parallel compilation
+  auto addShader = [&entry](GLenum shaderType, const std::string &shaderSrc) {
+    GLuint shader = glCreateShader(shaderType);
+    const char *cShaderSrc = shaderSrc.c_str();
+    glShaderSource(shader, 1, &cShaderSrc, NULL);
+    glCompileShader(shader);
+    glAttachShader(entry.program, shader);
+    entry.shaders.emplace_back(shader);
+  };
+
+  if (!source.compSrc.empty()) {
+    addShader(GL_COMPUTE_SHADER, source.compSrc);
+  }
+  else {
+    addShader(GL_VERTEX_SHADER, source.vertSrc);
+    if (!source.geomSrc.empty()) {
+      addShader(GL_GEOMETRY_SHADER, source.geomSrc);
+    }
+    if (!source.fragSrc.empty()) {
+      addShader(GL_FRAGMENT_SHADER, source.fragSrc);
+    }
+
+    if (!source.feedbackVaryings.empty()) {
+      std::vector<const char*> varyings;
+      for (const std::string &varying : source.feedbackVaryings) {
+        varyings.emplace_back(varying.c_str());
+      }
+      glTransformFeedbackVaryings(entry.program, (GLsizei)varyings.size(), varyings.data(), GL_INTERLEAVED_ATTRIBS);
+    }
+
+    // Same fixed locations as Shader(vertSrc, geomSrc, fragSrc)
+    for (int location = 0; location < VertexAttribute::LOCATION_COUNT; location++) {
+      glBindAttribLocation(entry.program, location, VertexAttribute::getLocationName(location));
+    }
+  }
+
+  if (!binaryCacheDirectory.empty()) {
+    glProgramParameteri(entry.program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+  }
+  glLinkProgram(entry.program);
+}
+
+void ShaderRegistry::finish(Entry &entry, const ShaderSource &source, std::uint64_t hash)
+{
+  GLint isLinked = GL_FALSE;
+  glGetProgramiv(entry.program, GL_LINK_STATUS, &isLinked);
+
+  if (entry.fromBinary && isLinked == GL_FALSE) { // Rejected by the driver despite the matching version; rebuild and overwrite it
+    glDeleteProgram(entry.program);
+    entry.program = glCreateProgram();
+    entry.fromBinary = false;
+    compile(entry, source);
+    glGetProgramiv(entry.program, GL_LINK_STATUS, &isLinked);
+  }
+
+  if (isLinked == GL_FALSE) {
+    for (GLuint shader : entry.shaders) {
+      GLint isCompiled = GL_FALSE;
+      glGetShaderiv(shader, GL_COMPILE_STATUS, &isCompiled);
+      if (isCompiled == GL_FALSE) {
+        GLint logLength = 0;
+        glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &logLength);
+        std::vector<GLchar> log(std::max(logLength, 1), '\0');
+        glGetShaderInfoLog(shader, (GLsizei)log.size(), nullptr, log.data());
+        Log::error(log.data());
+      }
+    }
+
+    GLint logLength = 0;
+    glGetProgramiv(entry.program, GL_INFO_LOG_LENGTH, &logLength);
+    std::vector<GLchar> log(std::max(logLength, 1), '\0');
+    glGetProgramInfoLog(entry.program, (GLsizei)log.size(), nullptr, log.data());
+    Log::error(log.data());
+
+    glDeleteProgram(entry.program);
+    entry.program = 0;
+  }
+  else if (entry.fromBinary) {
+    numLoaded++;
+  }
+  else {
+    numCompiled++;
+    saveBinary(entry.program, hash);
+  }
+
+  for (GLuint shader : entry.shaders) {
+    if (entry.program != 0) {
+      glDetachShader(entry.program, shader);
+    }
+    glDeleteShader(shader);
+  }
+  entry.shaders.clear();
+
+  entry.shader = Shader(entry.program);
+  entry.finished = true;
+}
+
+bool ShaderRegistry::loadBinary(unsigned int program, std::uint64_t hash) const
+{
+  if (binaryCacheDirectory.empty()) {
+    return false;
+  }
+
+  std::ifstream ifs(fs::u8path(getBinaryPath(hash)), std::ios::binary);
+  BinaryHeader header;
+  if (!ifs || !ifs.read((char*)&header, sizeof(header))) {
+    return false;
+  }
+
+  if (header.magic != binaryMagic || header.driverHash != driverHash || header.sourceHash != hash) { // Stale; overwritten after compiling
+    return false;
+  }
+
+  std::vector<char> binary(header.length);
+  if (!ifs.read(binary.data(), binary.size())) {
+    return false;
+  }
+
+  glProgramBinary(program, header.format, binary.data(), (GLsizei)binary.size());
+  return true; // Link status is checked in finish()
+}
+
+void ShaderRegistry::saveBinary(unsigned int program, std::uint64_t hash) const
+{
+  if (binaryCacheDirectory.empty()) {
+    return;
+  }
+
+  GLint length = 0;
+  glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+  if (length <= 0) { // No binary formats, e.g., a driver without a shader cache
+    return;
+  }
+
+  BinaryHeader header;
+  std::memset(&header, 0, sizeof(header));
+  std::vector<char> binary(length);
+  GLenum format = 0;
+  glGetProgramBinary(program, length, nullptr, &format, binary.data());
+  header.magic = binaryMagic;
+  header.format = format;
+  header.driverHash = driverHash;
+  header.sourceHash = hash;
+  header.length = (std::uint32_t)length;
+
+  const fs::path dir = fs::u8path(binaryCacheDirectory);
+  if (!fs::is_directory(dir) && !fs::create_directories(dir)) {
+    Log::warning("Failed to create shader cache directory: %s", binaryCacheDirectory.c_str());
+    return;
+  }
+
+  std::ofstream ofs(fs::u8path(getBinaryPath(hash)), std::ios::binary | std::ios::trunc);
+  ofs.write((const char*)&header, sizeof(header));
+  ofs.write(binary.data(), binary.size());
+  if (!ofs) {
+    Log::warning("Failed to write shader binary: %s", getBinaryPath(hash).c_str());
+  }
+}
+
+std::string ShaderRegistry::getBinaryPath(std::uint64_t hash) const
+{
+  std::ostringstream oss;
+  oss << binaryCacheDirectory << "/" << std::hex << std::setw(16) << std::setfill('0') << hash << ".bin";
+  return oss.str();
+}
+
+void ShaderRegistry::checkDriver()
+{
+  if (driverChecked) {
+    return;
+  }
+  driverChecked = true;
+
+  driverHash = HashUtil::initialHash;
+  for (GLenum name : { GL_VENDOR, GL_RENDERER, GL_VERSION, GL_SHADING_LANGUAGE_VERSION }) {
+    const char *value = (const char*)glGetString(name);
+    driverHash = HashUtil::hashString(value != nullptr ? value : "", driverHash);
+  }
+
+  GLint extensionCount = 0;
+  glGetIntegerv(GL_NUM_EXTENSIONS, &extensionCount);
+  for (int i = 0; i < extensionCount; i++) {
+    const char *extension = (const char*)glGetStringi(GL_EXTENSIONS, (GLuint)i);
+    if (std::strcmp(extension, "GL_KHR_parallel_shader_compile") == 0 || std::strcmp(extension, "GL_ARB_parallel_shader_compile") == 0) {
+      parallelCompile = true; // The default thread count is chosen by the driver
+    }
+  }
+}
+
+}
@@ -0,0 +1,169 @@
+#include <husky/render/SharedMeshBuffer.hpp>
+#include <husky/render/RenderState.hpp>
+#include <husky/Log.hpp>
+#include <glad/glad.h>
+
+namespace husky {
+
+static unsigned int getDrawIdBuffer()
+{
+  // Instanced attribute values 0, 1, 2, ...; the baseInstance of an indirect draw selects its draw ID
+  static unsigned int drawIdBuffer = 0;
+  if (drawIdBuffer == 0) {
+    std::vector<std::uint32_t> drawIds(SharedMeshBuffer::maxDrawIds);
+    for (int i = 0; i < (int)drawIds.size(); i++) {
+      drawIds[i] = (std::uint32_t)i;
+    }
+    glCreateBuffers(1, &drawIdBuffer);
+    glNamedBufferStorage(drawIdBuffer, drawIds.size() * sizeof(std::uint32_t), drawIds.data(), 0);
+  }
+  return drawIdBuffer;
+}
+
+SharedMeshBuffer::SharedMeshBuffer(const VertexDescription &vertDesc)
+  : vertDesc(vertDesc)
+  , vbo(0)
+  , ebo(0)
+  , vao(0)
+  , vertCount(0)
+  , indexCount(0)
+  , vertBytes()
+  , indices()
+  , allocations()
+  , dirty(false)
+{
+}
+
+SharedMeshBuffer::~SharedMeshBuffer()
+{
+  if (vao != 0) { // Never uploaded => No GL objects
+    RenderState::global().deleteBuffer(vbo);
+    RenderState::global().deleteBuffer(ebo);
+    RenderState::global().deleteVertexArray(vao);
+  }
+}
+
+bool SharedMeshBuffer::matches(const VertexDescription &other) const
+{
+  if (other.byteCount != vertDesc.byteCount || other.attrs.size() != vertDesc.attrs.size()) {
+    return false;
+  }
+
+  for (int i = 0; i < (int)vertDesc.attrs.size(); i++) {
+    const VertexAttribute &a = vertDesc.attrs[i];
+    const VertexAttribute &b = other.attrs[i];
+    if (a.name != b.name || a.dataType != b.dataType || a.elementCount != b.elementCount || a.normalize != b.normalize || a.byteOffset != b.byteOffset) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool SharedMeshBuffer::add(RenderData &renderData)
+{
+  const VertexData &vertData = renderData._vertData;
+  const IndexData &indexData = renderData._indexData;
+
+  if (!matches(vertData.vertDesc)) {
+    Log::warning("Vertex layout does not match shared buffer");
+    return false;
+  }
+
+  if (indexData.primitiveType != PrimitiveType::TRIANGLES || indexData.getIndexCount() == 0) {
+    Log::warning("Shared buffers only hold indexed triangles");
+    return false;
+  }
+
+  if (vertData.bytes.size() != (size_t)vertData.vertCount * vertDesc.byteCount) {
+    Log::warning("Render data has no CPU vertex data");
+    return false;
+  }
+
+  std::vector<std::uint16_t> chunkIndices;
+  Allocation allocation;
+  allocation.renderData = &renderData;
+  allocation.indexChunks = indexData.buildChunks(chunkIndices);
+  for (IndexChunk &chunk : allocation.indexChunks) {
+    chunk.firstIndex += indexCount;
+    chunk.baseVertex += vertCount;
+  }
+
+  vertBytes.insert(vertBytes.end(), vertData.bytes.begin(), vertData.bytes.end());
+  indices.insert(indices.end(), chunkIndices.begin(), chunkIndices.end());
+  vertCount += vertData.vertCount;
+  indexCount += (int)chunkIndices.size();
+  allocations.emplace_back(std::move(allocation));
+  dirty = true;
+  return true;
+}
+
+void SharedMeshBuffer::upload()
+{
+  if (!dirty) {
+    return;
+  }
+
+  // Immutable storage; growing means recreating both buffers from the CPU copy
+  RenderState &renderState = RenderState::global();
+  renderState.deleteBuffer(vbo);
+  renderState.deleteBuffer(ebo);
+  glCreateBuffers(1, &vbo);
+  glNamedBufferStorage(vbo, vertBytes.size(), vertBytes.data(), 0);
+  glCreateBuffers(1, &ebo);
+  glNamedBufferStorage(ebo, indices.size() * sizeof(std::uint16_t), indices.data(), 0);
+
+  if (vao == 0) {
+    glCreateVertexArrays(1, &vao);
+  }
+  RenderData::configureVertexArray(vao, vertDesc, vbo, ebo, false);
+
+  // Binding 2 advances once per instance
+  const int drawIdLocation = VertexAttribute::getLocation(VertexAttribute::DRAW_ID);
+  glVertexArrayVertexBuffer(vao, 2, getDrawIdBuffer(), 0, sizeof(std::uint32_t));
+  glVertexArrayBindingDivisor(vao, 2, 1);
+  glEnableVertexArrayAttrib(vao, drawIdLocation);
+  glVertexArrayAttribIFormat(vao, drawIdLocation, 1, GL_UNSIGNED_INT, 0);
+  glVertexArrayAttribBinding(vao, drawIdLocation, 2);
+
+  for (const Allocation &allocation : allocations) {
+    RenderData &renderData = *allocation.renderData;
+    if (renderData.sharedBuffer == nullptr) {
+      renderData.releaseGpuData(); // Drop any private buffers
+    }
+    renderData.vbo = vbo;
+    renderData.vao = vao;
+    renderData.ebo = ebo;
+    renderData.indexChunks = allocation.indexChunks;
+    renderData.sharedBuffer = this;
+    renderData.releaseCpuData();
+  }
+
+  dirty = false;
+}
+
+SharedMeshBuffers::SharedMeshBuffers()
+  : buffers()
+{
+}
+
+SharedMeshBuffer* SharedMeshBuffers::add(RenderData &renderData)
+{
+  for (const auto &buffer : buffers) {
+    if (buffer->matches(renderData._vertData.vertDesc)) {
+      return (buffer->add(renderData) ? buffer.get() : nullptr);
+    }
+  }
+
+  buffers.emplace_back(std::make_unique<SharedMeshBuffer>(renderData._vertData.vertDesc));
+  return (buffers.back()->add(renderData) ? buffers.back().get() : nullptr);
+}
+
+void SharedMeshBuffers::upload()
+{
+  for (const auto &buffer : buffers) {
+    buffer->upload();
+  }
+}
+
+}
@@ -0,0 +1,128 @@
+#include <husky/render/SkinningPass.hpp>
+#include <husky/mesh/Model.hpp>
+#include <husky/render/RenderState.hpp>
+#include <husky/Log.hpp>
+#include <glad/glad.h>
+
+namespace husky {
+
+static constexpr int skinnedVertexByteCount = 6 * sizeof(float); // vec3 position, vec3 normal
+
+SkinningPass::SkinningPass()
+  : numSkinnedMeshes(0)
+  , shader(Shader::getSkinningShader())
+  , bonePalettes(bonePalettesBinding) // Separate from the BonePaletteBuffer of SkinningMode::BONE_BUFFER draws
+  , jobs()
+  , buffers()
+  , numBuffersUsed(0)
+  , skinnedPoses()
+{
+}
+
+SkinningPass::~SkinningPass()
+{
+  for (const SkinnedBuffer &buffer : buffers) {
+    RenderState::global().deleteBuffer(buffer.vbo);
+  }
+}
+
+void SkinningPass::beginFrame()
+{
+  numBuffersUsed = 0;
+  numSkinnedMeshes = 0;
+  skinnedPoses.clear();
+  bonePalettes.beginFrame();
+  jobs.clear();
+}
+
+void SkinningPass::skin(ModelInstance &modelInstance)
+{
+  modelInstance.skinnedVbos.clear();
+
+  if (shader.shaderProgramHandle == 0 || modelInstance.bakedAnimation != nullptr) {
+    return;
+  }
+
+  const Model &model = *modelInstance.model;
+  const AnimationPose &pose = modelInstance.getPose();
+
+  auto it = skinnedPoses.find(&pose);
+  if (it != skinnedPoses.end()) { // Already skinned this frame
+    modelInstance.skinnedVbos = it->second;
+    return;
+  }
+
+  std::vector<unsigned int> skinnedVbos(model.meshes.size(), 0);
+
+  for (int iMesh = 0; iMesh < (int)model.meshes.size(); iMesh++) {
+    if (iMesh >= (int)pose.mtxBones.size() || pose.mtxBones[iMesh].empty()) {
+      continue;
+    }
+
+    const RenderData &renderData = model.meshes[iMesh].renderData;
+    const SkinningJob job = { &renderData, bonePalettes.add(pose.mtxBones[iMesh]), acquireBuffer(renderData._vertData.vertCount * skinnedVertexByteCount) };
+    jobs.emplace_back(job);
+    skinnedVbos[iMesh] = job.vbo;
+  }
+
+  skinnedPoses[&pose] = skinnedVbos;
+  modelInstance.skinnedVbos = std::move(skinnedVbos);
+}
+
+void SkinningPass::execute()
+{
+  if (jobs.empty()) {
+    return;
+  }
+
+  bonePalettes.upload();
+
+  RenderState &renderState = RenderState::global();
+  renderState.useProgram(shader.shaderProgramHandle);
+  glEnable(GL_RASTERIZER_DISCARD);
+
+  const ShaderUniform &offsetUniform = shader.getUniform(UniformSlot::BONE_OFFSET);
+
+  for (const SkinningJob &job : jobs) {
+    if (!job.renderData->bindVertexArray()) {
+      continue;
+    }
+
+    if (offsetUniform) {
+      glUniform1i(offsetUniform.location, job.boneOffset);
+    }
+
+    // Each vertex is processed exactly once when drawn as unindexed points
+    renderState.bindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, job.vbo);
+    glBeginTransformFeedback(GL_POINTS);
+    glDrawArrays(GL_POINTS, 0, job.renderData->_vertData.vertCount);
+    glEndTransformFeedback();
+    renderState.bindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+
+    numSkinnedMeshes++;
+  }
+
+  glDisable(GL_RASTERIZER_DISCARD);
+  jobs.clear();
+}
+
+unsigned int SkinningPass::acquireBuffer(int byteCount)
+{
+  if (numBuffersUsed == (int)buffers.size()) {
+    SkinnedBuffer buffer = { 0, 0 };
+    glGenBuffers(1, &buffer.vbo);
+    buffers.emplace_back(buffer);
+  }
+
+  SkinnedBuffer &buffer = buffers[numBuffersUsed++];
+
+  if (buffer.byteCount < byteCount) {
+    RenderState::global().bindBuffer(GL_ARRAY_BUFFER, buffer.vbo);
+    glBufferData(GL_ARRAY_BUFFER, byteCount, nullptr, GL_DYNAMIC_COPY);
+    buffer.byteCount = byteCount;
+  }
+
+  return buffer.vbo;
+}
+
+}
@@ -1,10 +1,16 @@
 #include <husky/render/Texture.hpp>
 #include <husky/image/Image.hpp>
 #include <husky/math/Vector4.hpp>
+#include <husky/render/RenderState.hpp>
 #include <husky/util/SharedResource.hpp>
 #include <husky/Log.hpp>
 #include <glad/glad.h>
 
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT // GL_EXT_texture_compression_s3tc; not core, but supported by all desktop drivers
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+
 namespace husky {
 
 const Texture& Texture::white1x1()
@@ -29,9 +35,10 @@ static bool imageFormatToGL(ImageFormat imageFormat, GLint &internalFormat, GLen
   switch (imageFormat)
   {
   // TODO: Support more values
-  case ImageFormat::RGB8  : { internalFormat = GL_RGB;  dataFormat = GL_RGB;  dataType = GL_UNSIGNED_BYTE;  return true; }
-  case ImageFormat::RGBA8 : { internalFormat = GL_RGBA; dataFormat = GL_RGBA; dataType = GL_UNSIGNED_BYTE;  return true; }
-  default                 : { internalFormat = 0;       dataFormat = 0;       dataType = 0;                 return false; }
+  case ImageFormat::RGB8    : { internalFormat = GL_RGB;     dataFormat = GL_RGB;  dataType = GL_UNSIGNED_BYTE;  return true; }
+  case ImageFormat::RGBA8   : { internalFormat = GL_RGBA;    dataFormat = GL_RGBA; dataType = GL_UNSIGNED_BYTE;  return true; }
+  case ImageFormat::RGBA32F : { internalFormat = GL_RGBA32F; dataFormat = GL_RGBA; dataType = GL_FLOAT;          return true; }
+  default                   : { internalFormat = 0;          dataFormat = 0;       dataType = 0;                 return false; }
   }
 }
 
@@ -40,29 +47,15 @@ static ImageFormat imageFormatFromGL(GLint internalFormat)
   switch (internalFormat)
   {
     // TODO: Support more values
-  case GL_RGB   : { return ImageFormat::RGB8; }
-  case GL_RGBA  : { return ImageFormat::RGBA8; }
-  default       : { return ImageFormat::UNDEFINED; }
+  case GL_RGB     : { return ImageFormat::RGB8; }
+  case GL_RGBA    : { return ImageFormat::RGBA8; }
+  case GL_RGBA32F : { return ImageFormat::RGBA32F; }
+  default         : { return ImageFormat::UNDEFINED; }
   }
 }
 
-Texture::Texture()
-  : handle(0)
-  , wrap(TexWrap::REPEAT)
-  , filter(TexFilter::LINEAR)
-  , mipmaps(TexMipmaps::STANDARD)
-{
-}
-
-Texture::Texture(ImageFormat imageFormat, int w, int h, TexWrap wrap, TexFilter filter, TexMipmaps mipmaps, const void *data)
-  : handle(0)
-  , wrap(wrap)
-  , filter(filter)
-  , mipmaps(mipmaps)
+static void setSamplerParameters(TexWrap wrap, TexFilter filter, TexMipmaps mipmaps) // Of the texture bound to GL_TEXTURE_2D
 {
-  glGenTextures(1, &handle);
-  glBindTexture(GL_TEXTURE_2D, handle);
-
   if (wrap == TexWrap::REPEAT) {
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
@@ -102,6 +95,38 @@ Texture::Texture(ImageFormat imageFormat, int w, int h, TexWrap wrap, TexFilter
   else {
     Log::warning("Unsupported texture filter: %d", filter);
   }
+}
+
+static GLenum blockFormatToGL(BlockFormat format)
+{
+  switch (format)
+  {
+  case BlockFormat::BC1 : { return GL_COMPRESSED_RGB_S3TC_DXT1_EXT; }
+  case BlockFormat::BC3 : { return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT; }
+  case BlockFormat::BC4 : { return GL_COMPRESSED_RED_RGTC1; }
+  case BlockFormat::BC5 : { return GL_COMPRESSED_RG_RGTC2; }
+  case BlockFormat::BC7 : { return GL_COMPRESSED_RGBA_BPTC_UNORM; }
+  default               : { return 0; }
+  }
+}
+
+Texture::Texture()
+  : handle(0)
+  , wrap(TexWrap::REPEAT)
+  , filter(TexFilter::LINEAR)
+  , mipmaps(TexMipmaps::STANDARD)
+{
+}
+
+Texture::Texture(ImageFormat imageFormat, int w, int h, TexWrap wrap, TexFilter filter, TexMipmaps mipmaps, const void *data)
+  : handle(0)
+  , wrap(wrap)
+  , filter(filter)
+  , mipmaps(mipmaps)
+{
+  glGenTextures(1, &handle);
+  RenderState::global().bindTexture(0, handle);
+  setSamplerParameters(wrap, filter, mipmaps);
 
   glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
 
@@ -121,6 +146,29 @@ Texture::Texture(const Image &image, TexWrap wrap, TexFilter filter, TexMipmaps
 {
 }
 
+Texture::Texture(const CompressedImage &image, TexWrap wrap, TexFilter filter)
+  : handle(0)
+  , wrap(wrap)
+  , filter(filter)
+  , mipmaps(image.levels.size() > 1 ? TexMipmaps::STANDARD : TexMipmaps::NONE)
+{
+  if (!image.valid()) {
+    Log::warning("Invalid compressed image");
+    return;
+  }
+
+  glGenTextures(1, &handle);
+  RenderState::global().bindTexture(0, handle);
+  setSamplerParameters(wrap, filter, mipmaps);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint)image.levels.size() - 1); // The chain may stop before 1x1
+
+  // The mip chain comes with the image; glGenerateMipmap() does not support compressed formats
+  const GLenum internalFormat = blockFormatToGL(image.format);
+  for (int level = 0; level < (int)image.levels.size(); level++) {
+    glCompressedTexImage2D(GL_TEXTURE_2D, level, internalFormat, image.getLevelWidth(level), image.getLevelHeight(level), 0, (GLsizei)image.levels[level].size(), image.levels[level].data());
+  }
+}
+
 Texture::Texture(const std::string &imageFilePath, TexWrap wrap, TexFilter filter, TexMipmaps mipmaps)
   : Texture(*SharedResource::loadImage(imageFilePath), wrap, filter, mipmaps)
 {
@@ -138,7 +186,7 @@ void Texture::uploadImageData(const Image &image) const
     return;
   }
 
-  glBindTexture(GL_TEXTURE_2D, handle);
+  RenderState::global().bindTexture(0, handle);
 
   GLint internalFormat;
   GLenum dataFormat, dataType;
@@ -157,7 +205,7 @@ Image Texture::downloadImageData() const
     return{};
   }
 
-  glBindTexture(GL_TEXTURE_2D, handle);
+  RenderState::global().bindTexture(0, handle);
 
   GLint internalFormat;
   glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_INTERNAL_FORMAT, &internalFormat);
@@ -171,8 +219,11 @@ Image Texture::downloadImageData() const
   glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &w);
   glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &h);
 
+  GLenum dataFormat, dataType;
+  imageFormatToGL(imageFormat, internalFormat, dataFormat, dataType);
+
   Image image(w, h, imageFormat);
-  glGetTexImage(GL_TEXTURE_2D, 0, internalFormat, GL_UNSIGNED_BYTE, image.data()); // TODO: Is this call really correct? (Seems to be working...)
+  glGetTexImage(GL_TEXTURE_2D, 0, dataFormat, dataType, image.data());
   //glReadPixels(0, 0, w, h, internalFormat, GL_UNSIGNED_BYTE, image.data());
 
   return image;
@@ -184,7 +235,7 @@ void Texture::buildMipmaps() const
     return;
   }
 
-  glBindTexture(GL_TEXTURE_2D, handle);
+  RenderState::global().bindTexture(0, handle);
 
   if (mipmaps == TexMipmaps::ANISOTROPIC) {
     //glGetFloatv(GL_MAX_TEXTURE_MAX_ANISOTROPY, &maxAnisotropy);
@@ -199,13 +250,15 @@ MultidirTexture::MultidirTexture()
   : tex()
   , numLon()
   , numLat()
+  , layout(ImpostorLayout::LON_LAT)
 {
 }
 
-MultidirTexture::MultidirTexture(Texture &&tex, int numLon, int numLat)
+MultidirTexture::MultidirTexture(Texture &&tex, int numLon, int numLat, ImpostorLayout layout)
   : tex(tex)
   , numLon(numLon)
   , numLat(numLat)
+  , layout(layout)
 {
 }
 
@@ -0,0 +1,310 @@
+#include <husky/render/TextureStreamer.hpp>
+#include <husky/math/Sphere.hpp>
+#include <husky/mesh/Model.hpp>
+#include <husky/render/RenderState.hpp>
+#include <husky/render/Viewport.hpp>
+#include <husky/util/ThreadPool.hpp>
+#include <husky/Log.hpp>
+#include <glad/glad.h>
+#include <algorithm>
+#include <cmath>
+
+namespace husky {
+
+static GLenum getPixelFormat(const Image &image) // Also the internal format, like Texture
+{
+  return (image.format == ImageFormat::RGBA8 ? GL_RGBA : GL_RGB);
+}
+
+static std::size_t alignUp(std::size_t size)
+{
+  return (size + 15) / 16 * 16; // Staging allocations are 16-byte aligned
+}
+
+TextureStreamer::TextureStreamer(int numThreads, std::size_t uploadBudget)
+  : uploadBudget(uploadBudget)
+  , tailSize(64)
+  , lodBias(0.0)
+  , evictionDelay(120)
+  , numBytesUploaded(0)
+  , numPending(0)
+  , entries()
+  , textures()
+  , stagingBuffer(uploadBudget)
+  , threads()
+  , mutex()
+  , wakeCondition()
+  , decodeQueue()
+  , decoded()
+  , stopping(false)
+{
+  for (int i = 0; i < std::max(numThreads, 1); i++) {
+    threads.emplace_back(&TextureStreamer::workerMain, this);
+  }
+}
+
+TextureStreamer::~TextureStreamer()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  wakeCondition.notify_all();
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+}
+
+Texture TextureStreamer::add(const std::string &imageFilePath, TexWrap wrap, TexFilter filter)
+{
+  auto it = textures.find(imageFilePath);
+  if (it != textures.end()) {
+    return it->second;
+  }
+
+  static const std::uint8_t white[4] = { 255, 255, 255, 255 }; // Same as Texture::white1x1()
+  Texture tex(ImageFormat::RGBA8, 1, 1, wrap, filter, TexMipmaps::STANDARD, white);
+  tex.imageFilePath = imageFilePath;
+  textures[imageFilePath] = tex;
+
+  Entry &entry = entries[tex.handle];
+  entry.imageFilePath = imageFilePath;
+  entry.tailLevel = 0;
+  entry.residentLevel = 0;
+  entry.uploadRow = 0;
+  entry.framesSinceNeeded = 0;
+  entry.screenSize = 0.0;
+  entry.decoding = true;
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    decodeQueue.emplace_back(tex.handle, imageFilePath);
+  }
+  wakeCondition.notify_one();
+
+  return tex;
+}
+
+void TextureStreamer::request(const Texture &texture, double screenSize)
+{
+  auto it = entries.find(texture.handle);
+  if (it != entries.end()) { // Other textures, e.g., Texture::white1x1(), are ignored
+    it->second.screenSize = std::max(it->second.screenSize, screenSize);
+  }
+}
+
+void TextureStreamer::request(const ModelInstance &modelInstance, const Matrix44d &mtxTransform, const Camera &cam, const Viewport &viewport)
+{
+  const Box bboxLocal = modelInstance.getBbox();
+  const double scale = std::max({ mtxTransform.col[0].xyz.length(), mtxTransform.col[1].xyz.length(), mtxTransform.col[2].xyz.length() });
+  const Sphere bsphere((mtxTransform * Vector4d(bboxLocal.center(), 1.0)).xyz, bboxLocal.radius() * scale);
+
+  // Approximate projected diameter in pixels, like Animator
+  double screenSize;
+  if (cam.isOrtho()) {
+    screenSize = (2.0 * bsphere.radius / cam.orthoHeight) * viewport.height;
+  }
+  else {
+    const double dist = std::max((bsphere.center - cam.pos).length() - bsphere.radius, cam.nearDist);
+    screenSize = (bsphere.radius / (dist * std::tan(cam.vfovRad * 0.5))) * viewport.height;
+  }
+
+  for (const Material &material : modelInstance.model->materials) {
+    request(material.tex, screenSize);
+  }
+}
+
+void TextureStreamer::update()
+{
+  std::deque<Decoded> arrived;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    arrived.swap(decoded);
+  }
+
+  for (Decoded &d : arrived) {
+    Entry &entry = entries[d.handle];
+    entry.decoding = false;
+    entry.levels = std::move(d.levels);
+    entry.tailLevel = 0;
+    while (entry.tailLevel + 1 < (int)entry.levels.size() && (entry.levels[entry.tailLevel].width > tailSize || entry.levels[entry.tailLevel].height > tailSize)) {
+      entry.tailLevel++;
+    }
+    entry.residentLevel = (int)entry.levels.size(); // Nothing but the placeholder
+  }
+
+  stagingBuffer.beginFrame();
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1); // RGB8 rows are not padded
+  std::size_t budget = uploadBudget;
+
+  // Tails first; a blurry texture is better than a white one
+  for (auto &handleEntry : entries) {
+    Entry &entry = handleEntry.second;
+    if (entry.levels.empty() || entry.residentLevel < (int)entry.levels.size()) {
+      continue;
+    }
+
+    std::size_t tailBytes = 0;
+    for (int level = entry.tailLevel; level < (int)entry.levels.size(); level++) {
+      tailBytes += alignUp(entry.levels[level].numBytesTotal);
+    }
+    if (tailBytes > budget) { // Next frame
+      continue;
+    }
+
+    for (int level = entry.tailLevel; level < (int)entry.levels.size(); level++) {
+      uploadRows(handleEntry.first, entry, level, budget);
+    }
+    entry.residentLevel = entry.tailLevel;
+    glTextureParameteri(handleEntry.first, GL_TEXTURE_MAX_LEVEL, (GLint)entry.levels.size() - 1);
+    glTextureParameteri(handleEntry.first, GL_TEXTURE_BASE_LEVEL, entry.residentLevel); // Levels below the base are ignored, including the placeholder
+  }
+
+  // Finer levels, most blurry first
+  std::vector<std::pair<int, unsigned int>> candidates; // Missing levels and handle
+  for (auto &handleEntry : entries) {
+    const Entry &entry = handleEntry.second;
+    if (!entry.levels.empty() && entry.residentLevel < (int)entry.levels.size()) {
+      const int missingLevels = entry.residentLevel - getDesiredLevel(entry);
+      if (missingLevels > 0) {
+        candidates.emplace_back(missingLevels, handleEntry.first);
+      }
+    }
+  }
+  std::sort(candidates.begin(), candidates.end(), [](const std::pair<int, unsigned int> &a, const std::pair<int, unsigned int> &b) { return a.first > b.first; });
+
+  for (const auto &candidate : candidates) {
+    Entry &entry = entries[candidate.second];
+    const int desiredLevel = getDesiredLevel(entry);
+    while (entry.residentLevel > desiredLevel && uploadRows(candidate.second, entry, entry.residentLevel - 1, budget)) {
+      entry.residentLevel--;
+      glTextureParameteri(candidate.second, GL_TEXTURE_BASE_LEVEL, entry.residentLevel);
+    }
+    if (budget == 0) {
+      break;
+    }
+  }
+
+  // Drop levels that have not been needed for a while, one per delay, so a texture shrinks gradually
+  numPending = 0;
+  for (auto &handleEntry : entries) {
+    Entry &entry = handleEntry.second;
+    if (entry.decoding) {
+      numPending++;
+    }
+    if (entry.levels.empty()) { // Decoding, or failed to decode and stays white
+      entry.screenSize = 0.0;
+      continue;
+    }
+
+    const int desiredLevel = getDesiredLevel(entry);
+    if (entry.residentLevel > desiredLevel) {
+      numPending++;
+    }
+
+    if (entry.residentLevel < desiredLevel) {
+      entry.framesSinceNeeded++;
+      if (entry.framesSinceNeeded > evictionDelay) {
+        const Image &image = entry.levels[entry.residentLevel];
+        glTextureParameteri(handleEntry.first, GL_TEXTURE_BASE_LEVEL, entry.residentLevel + 1);
+        RenderState::global().bindTexture(0, handleEntry.first);
+        glTexImage2D(GL_TEXTURE_2D, entry.residentLevel, getPixelFormat(image), 0, 0, 0, getPixelFormat(image), GL_UNSIGNED_BYTE, nullptr); // Frees the level; the decoded image is kept for streaming it back in
+        entry.residentLevel++;
+        entry.uploadRow = 0; // Restart a partially uploaded level
+        entry.framesSinceNeeded = 0;
+      }
+    }
+    else {
+      entry.framesSinceNeeded = 0;
+    }
+
+    entry.screenSize = 0.0; // Requests are per frame
+  }
+
+  stagingBuffer.endFrame();
+  numBytesUploaded = uploadBudget - budget;
+}
+
+void TextureStreamer::workerMain()
+{
+  ThreadPool inlinePool(0); // Each worker builds its mip chains alone, so decoding stays off the shared pool
+
+  while (true) {
+    std::pair<unsigned int, std::string> job;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      wakeCondition.wait(lock, [this]() { return (stopping || !decodeQueue.empty()); });
+      if (stopping) {
+        return;
+      }
+      job = std::move(decodeQueue.front());
+      decodeQueue.pop_front();
+    }
+
+    Decoded d;
+    d.handle = job.first;
+    Image image = Image::load(job.second);
+    if (image.valid()) {
+      std::vector<Image> mipmaps = image.generateMipmaps(ResampleFilter::KAISER, true, inlinePool);
+      d.levels.reserve(mipmaps.size() + 1);
+      d.levels.emplace_back(std::move(image));
+      for (Image &mipmap : mipmaps) {
+        d.levels.emplace_back(std::move(mipmap));
+      }
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    decoded.emplace_back(std::move(d));
+  }
+}
+
+bool TextureStreamer::uploadRows(unsigned int handle, Entry &entry, int level, std::size_t &budget)
+{
+  const Image &image = entry.levels[level];
+  const GLenum format = getPixelFormat(image);
+  const std::size_t rowBytes = std::size_t(image.width) * image.numBytesPerPixel;
+
+  if (entry.uploadRow == 0) { // Mutable storage, so the levels of a texture can be freed and defined again
+    RenderState::global().bindTexture(0, handle);
+    glTexImage2D(GL_TEXTURE_2D, level, format, image.width, image.height, 0, format, GL_UNSIGNED_BYTE, nullptr);
+  }
+
+  int numRows = (int)std::min<std::size_t>(image.height - entry.uploadRow, budget / rowBytes);
+  while (numRows > 0 && alignUp(numRows * rowBytes) > budget) {
+    numRows--;
+  }
+  if (numRows <= 0) {
+    return false;
+  }
+
+  const RingAllocation allocation = stagingBuffer.upload(image.data() + entry.uploadRow * rowBytes, numRows * rowBytes, 16);
+  if (!allocation.valid()) {
+    budget = 0;
+    return false;
+  }
+  budget -= alignUp(allocation.size);
+
+  RenderState::global().bindBuffer(GL_PIXEL_UNPACK_BUFFER, allocation.buffer);
+  glTextureSubImage2D(handle, level, 0, entry.uploadRow, image.width, numRows, format, GL_UNSIGNED_BYTE, (const void*)allocation.offset);
+  RenderState::global().bindBuffer(GL_PIXEL_UNPACK_BUFFER, 0); // Other uploads read client memory
+
+  entry.uploadRow += numRows;
+  if (entry.uploadRow < image.height) {
+    return false;
+  }
+  entry.uploadRow = 0;
+  return true;
+}
+
+int TextureStreamer::getDesiredLevel(const Entry &entry) const
+{
+  if (entry.screenSize <= 0.0) { // Not requested this frame
+    return entry.tailLevel;
+  }
+
+  const Image &image = entry.levels.front();
+  const double level = std::floor(std::log2(std::max(image.width, image.height) / entry.screenSize) + lodBias); // One texel per pixel
+  return std::min(std::max((int)level, 0), entry.tailLevel);
+}
+
+}
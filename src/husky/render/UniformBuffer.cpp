@@ -0,0 +1,79 @@
+#include <husky/render/UniformBuffer.hpp>
+#include <husky/render/RenderState.hpp>
+#include <glad/glad.h>
+#include <cstring>
+
+namespace husky {
+
+static_assert(sizeof(FrameUniforms) == 144, "FrameUniforms must match the std140 block layout");
+static_assert(sizeof(MaterialUniforms) == 80, "MaterialUniforms must match the std140 block layout");
+
+FrameUniforms::FrameUniforms()
+  : FrameUniforms(Matrix44f::identity(), Matrix44f::identity(), 1, 1)
+{
+}
+
+FrameUniforms::FrameUniforms(const Matrix44f &view, const Matrix44f &projection, int viewportWidth, int viewportHeight)
+  : mtxProjection(projection)
+  , lightDir()
+  , lightAmbient(0.05f, 0.05f, 0.05f, 0.f)
+  , lightDiffuse(1.f, 1.f, 1.f, 0.f)
+  , lightSpecular(1.f, 1.f, 1.f, 0.f)
+  , viewportSize((float)viewportWidth, (float)viewportHeight, 0.f, 0.f)
+{
+  const Vector3f worldLightDir(20, -40, 100); // TODO
+  lightDir = Vector4f((view * Vector4f(worldLightDir, 0.0)).xyz.normalized(), 0.f);
+}
+
+UniformBuffer::UniformBuffer()
+  : handle(0)
+  , bytes()
+{
+}
+
+UniformBuffer::UniformBuffer(const UniformBuffer &)
+  : UniformBuffer()
+{
+}
+
+UniformBuffer& UniformBuffer::operator=(const UniformBuffer &)
+{
+  bytes.clear(); // Keep our GPU buffer, but force the next update() to upload
+  return *this;
+}
+
+UniformBuffer::~UniformBuffer()
+{
+  if (handle != 0) {
+    RenderState::global().deleteBuffer(handle);
+  }
+}
+
+void UniformBuffer::update(const void *data, int byteCount)
+{
+  if ((int)bytes.size() == byteCount && std::memcmp(bytes.data(), data, byteCount) == 0) { // Unchanged
+    return;
+  }
+
+  if (handle == 0) {
+    glGenBuffers(1, &handle);
+  }
+
+  RenderState::global().bindBuffer(GL_UNIFORM_BUFFER, handle);
+  if ((int)bytes.size() == byteCount) {
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, byteCount, data);
+  }
+  else {
+    glBufferData(GL_UNIFORM_BUFFER, byteCount, data, GL_DYNAMIC_DRAW);
+  }
+
+  const std::uint8_t *dataBytes = (const std::uint8_t*)data;
+  bytes.assign(dataBytes, dataBytes + byteCount);
+}
+
+void UniformBuffer::bind(UniformBlock block) const
+{
+  RenderState::global().bindBufferBase(GL_UNIFORM_BUFFER, (int)block, handle);
+}
+
+}
@@ -0,0 +1,19 @@
+#include <husky/util/HashUtil.hpp>
+
+namespace husky {
+
+std::uint64_t HashUtil::hashBytes(const void *data, std::size_t size, std::uint64_t hash)
+{
+  const std::uint8_t *bytes = static_cast<const std::uint8_t*>(data);
+  for (std::size_t i = 0; i < size; i++) {
+    hash = (hash ^ bytes[i]) * 1099511628211ull;
+  }
+  return hash;
+}
+
+std::uint64_t HashUtil::hashString(const std::string &s, std::uint64_t hash)
+{
+  return hashBytes(s.c_str(), s.size() + 1, hash);
+}
+
+}
@@ -0,0 +1,151 @@
+#include <husky/util/ThreadPool.hpp>
+#include <algorithm>
+
+namespace husky {
+
+ThreadPool& ThreadPool::global()
+{
+  static ThreadPool threadPool;
+  return threadPool;
+}
+
+ThreadPool::ThreadPool(int numThreads)
+  : queues()
+  , threads()
+  , wakeMutex()
+  , wakeCondition()
+  , pendingTaskCount(0)
+  , stopping(false)
+{
+  if (numThreads < 0) {
+    numThreads = std::max((int)std::thread::hardware_concurrency() - 1, 0);
+  }
+
+  for (int iQueue = 0; iQueue <= numThreads; iQueue++) {
+    queues.emplace_back(std::make_unique<TaskQueue>());
+  }
+
+  for (int iThread = 0; iThread < numThreads; iThread++) {
+    threads.emplace_back(&ThreadPool::workerMain, this, iThread + 1);
+  }
+}
+
+ThreadPool::~ThreadPool()
+{
+  {
+    std::lock_guard<std::mutex> lock(wakeMutex);
+    stopping = true;
+  }
+  wakeCondition.notify_all();
+
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+}
+
+int ThreadPool::numThreads() const
+{
+  return (int)threads.size();
+}
+
+void ThreadPool::parallelFor(int begin, int end, int grainSize, const std::function<void(int, int)> &func)
+{
+  if (end <= begin) {
+    return;
+  }
+
+  grainSize = std::max(grainSize, 1);
+
+  if (threads.empty() || (end - begin) <= grainSize) { // Not worth distributing
+    func(begin, end);
+    return;
+  }
+
+  const int numTasks = (end - begin + grainSize - 1) / grainSize;
+  std::atomic<int> remaining(numTasks);
+
+  // Distribute tasks round-robin; idle workers steal from each other to balance the load
+  for (int iTask = 0; iTask < numTasks; iTask++) {
+    const int taskBegin = begin + iTask * grainSize;
+    const int taskEnd = std::min(taskBegin + grainSize, end);
+    pushTask(iTask % (int)queues.size(), { &func, taskBegin, taskEnd, &remaining });
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(wakeMutex);
+  }
+  wakeCondition.notify_all();
+
+  // Help out until our own tasks are done
+  while (remaining > 0) {
+    Task task;
+    if (popTask(0, task) || stealTask(0, task)) {
+      runTask(task);
+    }
+    else {
+      std::this_thread::yield();
+    }
+  }
+}
+
+void ThreadPool::workerMain(int iQueue)
+{
+  while (true) {
+    Task task;
+    if (popTask(iQueue, task) || stealTask(iQueue, task)) {
+      runTask(task);
+      continue;
+    }
+
+    std::unique_lock<std::mutex> lock(wakeMutex);
+    wakeCondition.wait(lock, [this]() { return (stopping || pendingTaskCount > 0); });
+    if (stopping) {
+      return;
+    }
+  }
+}
+
+void ThreadPool::pushTask(int iQueue, const Task &task)
+{
+  TaskQueue &queue = *queues[iQueue];
+  std::lock_guard<std::mutex> lock(queue.mutex);
+  queue.tasks.emplace_back(task);
+  pendingTaskCount++;
+}
+
+bool ThreadPool::popTask(int iQueue, Task &task)
+{
+  TaskQueue &queue = *queues[iQueue];
+  std::lock_guard<std::mutex> lock(queue.mutex);
+  if (queue.tasks.empty()) {
+    return false;
+  }
+  task = queue.tasks.back();
+  queue.tasks.pop_back();
+  pendingTaskCount--;
+  return true;
+}
+
+bool ThreadPool::stealTask(int iQueue, Task &task)
+{
+  const int numQueues = (int)queues.size();
+  for (int i = 1; i < numQueues; i++) {
+    TaskQueue &queue = *queues[(iQueue + i) % numQueues];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (!queue.tasks.empty()) {
+      task = queue.tasks.front();
+      queue.tasks.pop_front();
+      pendingTaskCount--;
+      return true;
+    }
+  }
+  return false;
+}
+
+void ThreadPool::runTask(const Task &task)
+{
+  (*task.func)(task.begin, task.end);
+  (*task.remaining)--;
+}
+
+}